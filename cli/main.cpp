@@ -5,7 +5,18 @@
 #include <QString>
 #include <QHostAddress>
 #include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QImageReader>
+#include <QMutex>
+#include <QSet>
+#include <QThreadPool>
+#include <QTimer>
+#include <QtConcurrent>
 #include <optional>
+#include <string>
 
 #include "structuredefinitions.h"
 #include "stellarsolver.h"
@@ -28,6 +39,18 @@ struct StellarSolverCliQuery
     // TODO what should be the default for mac or windows?
     QString index_files_path = "/usr/share/astrometry";
     SSolver::Parameters::ParametersProfile profile = SSolver::Parameters::PARALLEL_SMALLSCALE;
+    // Batch mode: number of images solved at the same time
+    int jobs = 1;
+    // Batch mode: keep reading image paths from stdin, one per line, until EOF
+    bool read_stdin = false;
+    // Batch mode: keep solving new images that appear in this directory
+    std::optional<QString> watch_dir = std::nullopt;
+    // The index files found in index_files_path, resolved once and shared by every solve
+    QStringList index_files;
+    // Convert the positional arguments, which are index files, to native index files instead of solving
+    bool convert_index = false;
+    // Store the trees of the converted index files as doubles
+    bool expand_index = false;
 };
 
 struct CommandLineParseResult
@@ -114,7 +137,7 @@ CommandLineParseResult parseCommandLine(QCommandLineParser &parser, StellarSolve
     using Status = CommandLineParseResult::Status;
 
     parser.setSingleDashWordOptionMode(QCommandLineParser::ParseAsLongOptions);
-    parser.addPositionalArgument("image-file", "Input image file(s) to solve", "image-file...");
+    parser.addPositionalArgument("image-file", "Input image file(s) to solve", "[image-file...]");
     auto builtInProfileNames = extractProfileNames(StellarSolver::getBuiltInProfiles());
     QString profileNamesConcat = concatProfileNames(builtInProfileNames);
     parser.addOptions({{{"3", "ra"},
@@ -160,7 +183,19 @@ CommandLineParseResult parseCommandLine(QCommandLineParser &parser, StellarSolve
                         "path"},
                        {"built-in-profile",
                         "One of:\n" + profileNamesConcat + "\n(default: 4-SmallScaleSolving)",
-                        "profilename"}});
+                        "profilename"},
+                       {{"j", "jobs"},
+                        "Number of images to solve at the same time (default: 1). Note that the parallel profiles already use several threads per image.",
+                        "number"},
+                       {"stdin",
+                        "Keep running and solve every image path read from stdin, one per line, until EOF"},
+                       {"watch",
+                        "Keep running and solve every new image that is written to this directory",
+                        "path"},
+                       {"convert-index",
+                        "Instead of solving, convert the given index files to native index files (.ssidx) next to them"},
+                       {"expand-index",
+                        "With --convert-index, store the index trees as doubles: larger files that are faster to search"}});
 
     const QCommandLineOption helpOption = parser.addHelpOption();
     const QCommandLineOption versionOption = parser.addVersionOption();
@@ -180,8 +215,51 @@ CommandLineParseResult parseCommandLine(QCommandLineParser &parser, StellarSolve
         return {Status::HelpRequested};
     }
 
+    if (parser.isSet("jobs"))
+    {
+        QString valueStr = parser.value("jobs");
+        bool ok = false;
+        int value = valueStr.toInt(&ok);
+        if (ok && value > 0)
+        {
+            query->jobs = value;
+        }
+        else
+        {
+            return {Status::Error, "Argument '-j, --jobs' is not a positive integer"};
+        }
+    }
+
+    query->read_stdin = parser.isSet("stdin");
+
+    if (parser.isSet("watch"))
+    {
+        QString valueStr = parser.value("watch");
+        if (!QFileInfo(valueStr).isDir())
+        {
+            return {Status::Error, "Argument '--watch' is not an existing directory"};
+        }
+        query->watch_dir = {valueStr};
+    }
+
+    if (query->read_stdin && query->watch_dir)
+    {
+        return {Status::Error, "Arguments '--stdin' and '--watch' can not be used together"};
+    }
+
+    query->convert_index = parser.isSet("convert-index");
+    query->expand_index = parser.isSet("expand-index");
+    if (query->expand_index && !query->convert_index)
+    {
+        return {Status::Error, "Argument '--expand-index' needs '--convert-index'"};
+    }
+    if (query->convert_index && (query->read_stdin || query->watch_dir))
+    {
+        return {Status::Error, "Argument '--convert-index' can not be used with '--stdin' or '--watch'"};
+    }
+
     const QStringList positionalArguments = parser.positionalArguments();
-    if (positionalArguments.isEmpty())
+    if (positionalArguments.isEmpty() && !query->read_stdin && !query->watch_dir)
     {
         return {Status::Error, "Argument 'image-file' missing."};
     }
@@ -397,26 +475,35 @@ CommandLineParseResult parseCommandLine(QCommandLineParser &parser, StellarSolve
 }
 
 /**
- * @brief starts the solving for a given image file based on the parsed parameters and print the results to console
- * 
+ * @brief starts the solving for a given image file based on the parsed parameters and writes the results to output
+ * The results are collected in a string instead of printed directly so that concurrent solves do not interleave their lines.
+ *
  * @param image_file the path to the image file to solve
  * @param query the object containing the parsed command line parameters
+ * @param output the text block to print for this image
+ * @return true if the image was solved
  */
-void solve(const QString &image_file, StellarSolverCliQuery *query)
+bool solve(const QString &image_file, const StellarSolverCliQuery *query, QString &output)
 {
-
     fileio imageLoader;
     imageLoader.logToSignal = false;
+    // imageLoader lives until the solve is done, so uncompressed FITS data can be mapped instead of copied
+    imageLoader.useMemoryMap = true;
     if (!imageLoader.loadImage(image_file))
     {
-        exit(1);
+        output += QString("Could not load input file: \"%1\"\n\n").arg(image_file);
+        return false;
     }
     FITSImage::Statistic stats = imageLoader.getStats();
     uint8_t *imageBuffer = imageLoader.getImageBuffer();
-    printf("Solving...\n");
-    printf("Field: %s\n", image_file.toUtf8().data());
+    output += "Solving...\n";
+    output += QString("Field: %1\n").arg(image_file);
     StellarSolver stellarSolver(stats, imageBuffer);
-    stellarSolver.setIndexFolderPaths(QStringList() << query->index_files_path);
+    // The index list was resolved once at startup, so the folder is not scanned again for every image
+    if (query->index_files.isEmpty())
+        stellarSolver.setIndexFolderPaths(QStringList() << query->index_files_path);
+    else
+        stellarSolver.setIndexFilePaths(query->index_files);
     stellarSolver.setParameterProfile(query->profile);
     SSolver::Parameters params = stellarSolver.getCurrentParameters();
     if (query->degrees)
@@ -443,20 +530,163 @@ void solve(const QString &image_file, StellarSolverCliQuery *query)
     stellarSolver.setParameters(params);
     if (!stellarSolver.solve()) // TODO Error Message CPU timeout or no index file found
     {
-        printf("Did not solve (or no WCS file was written).\n");
-        exit(1);
+        output += "Did not solve (or no WCS file was written).\n\n";
+        return false;
     }
 
     FITSImage::Solution solution = stellarSolver.getSolution();
 
-    printf("Field center: (RA,Dec) = (%f, %f) deg.\n", solution.ra, solution.dec);
+    output += QString::asprintf("Field center: (RA,Dec) = (%f, %f) deg.\n", solution.ra, solution.dec);
     dms ra_dms(solution.ra);
     dms dec_dms(solution.dec);
-    printf("Field center: (RA H:M:S, Dec D:M:S) = (%s, %s)\n", ra_dms.toHMSString(true).toUtf8().data(), dec_dms.toDMSString(true, true).toUtf8().data());
+    output += QString("Field center: (RA H:M:S, Dec D:M:S) = (%1, %2)\n").arg(ra_dms.toHMSString(true), dec_dms.toDMSString(true, true));
     // TODO how is the unit of this selected in solve-field?
-    printf("Field size: %f x %f arcminutes\n", solution.fieldWidth, solution.fieldHeight);
-    printf("Field rotation angle: up is %f degrees E of N\n", solution.orientation);
-    printf("Field parity: %s\n\n", FITSImage::getShortParityText(solution.parity).toUtf8().data());
+    output += QString::asprintf("Field size: %f x %f arcminutes\n", solution.fieldWidth, solution.fieldHeight);
+    output += QString::asprintf("Field rotation angle: up is %f degrees E of N\n", solution.orientation);
+    output += QString("Field parity: %1\n\n").arg(FITSImage::getShortParityText(solution.parity));
+    return true;
+}
+
+/**
+ * @brief runs the solves of a session on a thread pool and prints each result as soon as it is available
+ * The index list is resolved once for the whole session, so a resident worker only pays that cost at startup.
+ */
+class BatchSolver
+{
+    public:
+        explicit BatchSolver(StellarSolverCliQuery *query) : m_Query(query)
+        {
+            m_Pool.setMaxThreadCount(query->jobs);
+            // The StellarSolver objects live on the pool threads and wait with their own event loop
+            m_Pool.setExpiryTimeout(-1);
+        }
+
+        /**
+         * @brief queues an image to be solved, the result is printed when the solve finishes
+         * @param image_file the path to the image file to solve
+         */
+        void submit(const QString &image_file)
+        {
+            int number = ++m_Submitted;
+            {
+                QMutexLocker locker(&m_OutputMutex);
+                printf("Reading input file %d: \"%s\"\n", number, image_file.toUtf8().constData());
+                fflush(stdout);
+            }
+            const StellarSolverCliQuery *query = m_Query;
+            QtConcurrent::run(&m_Pool, [this, image_file, query, number]()
+            {
+                QString output;
+                bool success = solve(image_file, query, output);
+                if (!success)
+                    m_Failed.fetchAndAddOrdered(1);
+                QMutexLocker locker(&m_OutputMutex);
+                printf("Result for input file %d: \"%s\"\n%s", number, image_file.toUtf8().constData(), output.toUtf8().constData());
+                fflush(stdout);
+            });
+        }
+
+        /**
+         * @brief blocks until all the queued images are solved
+         */
+        void waitForDone()
+        {
+            m_Pool.waitForDone();
+        }
+
+        /**
+         * @return the number of images that could not be loaded or solved so far
+         */
+        int failedCount() const
+        {
+            return m_Failed.loadAcquire();
+        }
+
+    private:
+        StellarSolverCliQuery *m_Query { nullptr };
+        QThreadPool m_Pool;
+        QMutex m_OutputMutex;
+        int m_Submitted { 0 };
+        QAtomicInt m_Failed { 0 };
+};
+
+/**
+ * @brief gets the file name filters for all the image formats the cli can load
+ */
+QStringList imageNameFilters()
+{
+    QStringList filters;
+    filters << "*.fits" << "*.fit";
+    for (const QByteArray &format : QImageReader::supportedImageFormats())
+        filters << "*." + QString::fromLatin1(format);
+    return filters;
+}
+
+/**
+ * @brief watches a directory and solves every new image written into it, this only returns when the application quits
+ * A new file is only submitted once its size stopped changing between two polls so that images still being written are not read.
+ *
+ * @param batch the batch session to submit the images to
+ * @param directory the directory to watch
+ * @param app the application whose event loop drives the watcher
+ */
+int watchDirectory(BatchSolver &batch, const QString &directory, QCoreApplication &app)
+{
+    QDir dir(directory);
+    dir.setNameFilters(imageNameFilters());
+    dir.setFilter(QDir::Files);
+
+    // Files that are already there when the watch starts are not new frames
+    QSet<QString> seen;
+    for (const QString &file : dir.entryList())
+        seen.insert(dir.absoluteFilePath(file));
+
+    // Candidate file -> size seen at the previous poll
+    QHash<QString, qint64> pending;
+
+    QFileSystemWatcher watcher(QStringList() << dir.absolutePath());
+    QObject::connect(&watcher, &QFileSystemWatcher::directoryChanged, [&]()
+    {
+        dir.refresh();
+        for (const QString &file : dir.entryList())
+        {
+            QString path = dir.absoluteFilePath(file);
+            if (!seen.contains(path) && !pending.contains(path))
+                pending.insert(path, -1);
+        }
+    });
+
+    QTimer settleTimer;
+    settleTimer.setInterval(500);
+    QObject::connect(&settleTimer, &QTimer::timeout, [&]()
+    {
+        for (auto it = pending.begin(); it != pending.end();)
+        {
+            QFileInfo info(it.key());
+            if (!info.exists())
+            {
+                it = pending.erase(it);
+                continue;
+            }
+            qint64 size = info.size();
+            if (size > 0 && size == it.value())
+            {
+                seen.insert(it.key());
+                batch.submit(it.key());
+                it = pending.erase(it);
+            }
+            else
+            {
+                it.value() = size;
+                ++it;
+            }
+        }
+    });
+    settleTimer.start();
+
+    printf("Watching \"%s\" for new images\n", dir.absolutePath().toUtf8().constData());
+    fflush(stdout);
+    return app.exec();
 }
 
 int main(int argc, char *argv[])
@@ -472,13 +702,47 @@ int main(int argc, char *argv[])
     switch (parseResult.statusCode)
     {
     case Status::Ok:
-        for (int i = 0; i < query.image_files.size(); ++i)
+    {
+        if (query.convert_index)
         {
-            printf("Reading input file %d out of %d: \"%s\"\n", i + 1, query.image_files.size(), query.image_files[i].toUtf8().constData());
-            fflush(stdout);
-            solve(query.image_files[i], &query);
+            int failed = 0;
+            for (const QString &index_file : query.image_files)
+            {
+                if (StellarSolver::convertIndexFile(index_file, QString(), query.expand_index))
+                {
+                    printf("Converted \"%s\"\n", index_file.toUtf8().constData());
+                }
+                else
+                {
+                    fprintf(stderr, "Failed to convert \"%s\"\n", index_file.toUtf8().constData());
+                    failed++;
+                }
+            }
+            return failed > 0 ? 1 : 0;
+        }
+        query.index_files = StellarSolver::getIndexFiles(QStringList() << query.index_files_path);
+        BatchSolver batch(&query);
+        for (const QString &image_file : query.image_files)
+        {
+            batch.submit(image_file);
         }
-        break;
+        if (query.read_stdin)
+        {
+            std::string line;
+            while (std::getline(std::cin, line))
+            {
+                QString image_file = QString::fromStdString(line).trimmed();
+                if (!image_file.isEmpty())
+                    batch.submit(image_file);
+            }
+        }
+        else if (query.watch_dir)
+        {
+            watchDirectory(batch, query.watch_dir.value(), app);
+        }
+        batch.waitForDone();
+        return batch.failedCount() > 0 ? 1 : 0;
+    }
     case Status::Error:
         std::fputs(qPrintable(parseResult.errorString.value_or("Unknown error occurred")),
                    stderr);
@@ -0,0 +1,105 @@
+/*  StellarSolver Daemon, a resident solve service for the StellarSolver Internal Library
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QThread>
+
+#include <clocale>
+#include <cstdio>
+
+#include "solvedaemon.h"
+#include "stellarsolver.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationVersion(StellarSolver::getVersion());
+    QCoreApplication::setApplicationName("StellarSolver Daemon");
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Resident plate solving and star extraction service for local clients");
+    parser.addOptions({{"socket",
+                        "Path of the Unix domain socket to listen on (default: /tmp/stellarsolver.sock)",
+                        "path", "/tmp/stellarsolver.sock"},
+                       {"index-files",
+                        "Directory where the index files are located, may be given several times (default: /usr/share/astrometry)",
+                        "path"},
+                       {{"j", "jobs"},
+                        "Number of requests processed at the same time for all clients together (default: ideal thread count)",
+                        "number"},
+                       {"lock-indexes",
+                        "Lock up to this many MiB of index files in memory for as long as the daemon runs (default: 0, only read them into the file cache)",
+                        "MiB", "0"},
+                       {"built-in-profile",
+                        "Index of the built in profile used when a request does not ask for one (default: 4)",
+                        "number"}});
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.process(app);
+
+    SolveDaemon daemon;
+
+    QStringList indexFolders = parser.values("index-files");
+    if (indexFolders.isEmpty())
+        indexFolders << "/usr/share/astrometry";
+    daemon.setIndexFolderPaths(indexFolders);
+
+    bool lockOk = false;
+    qint64 lockMiB = parser.value("lock-indexes").toLongLong(&lockOk);
+    if (!lockOk || lockMiB < 0)
+    {
+        fputs("Argument '--lock-indexes' is not a non-negative integer\n", stderr);
+        return 1;
+    }
+
+    int jobs = QThread::idealThreadCount();
+    if (parser.isSet("jobs"))
+    {
+        bool ok = false;
+        jobs = parser.value("jobs").toInt(&ok);
+        if (!ok || jobs < 1)
+        {
+            fputs("Argument '-j, --jobs' is not a positive integer\n", stderr);
+            return 1;
+        }
+    }
+    daemon.setMaxConcurrentJobs(jobs);
+
+    if (parser.isSet("built-in-profile"))
+    {
+        bool ok = false;
+        int profile = parser.value("built-in-profile").toInt(&ok);
+        if (!ok || profile < 0 || profile >= StellarSolver::getBuiltInProfiles().count())
+        {
+            fputs("Argument '--built-in-profile' is not one of the built in profiles\n", stderr);
+            return 1;
+        }
+        daemon.setDefaultProfile(static_cast<SSolver::Parameters::ParametersProfile>(profile));
+    }
+
+    QString socketPath = parser.value("socket");
+    if (SolveDaemon::isServing(socketPath))
+    {
+        fprintf(stderr, "Another daemon is already listening on %s\n", socketPath.toUtf8().constData());
+        return 1;
+    }
+    if (!daemon.start(socketPath))
+    {
+        fprintf(stderr, "Could not listen on %s\n", socketPath.toUtf8().constData());
+        return 1;
+    }
+    // The requests share the index files that are read, and locked, here once
+    daemon.keepIndexesWarm(lockMiB * 1024 * 1024);
+    printf("Listening on %s with %d concurrent jobs\n", socketPath.toUtf8().constData(), jobs);
+    fflush(stdout);
+
+    return app.exec();
+}
@@ -0,0 +1,403 @@
+/*  StellarSolver Daemon, a resident solve service for the StellarSolver Internal Library
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#include "solvedaemon.h"
+
+//Qt Includes
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QPointer>
+#include <QtConcurrent>
+
+//System Includes
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//CFitsio Includes, for the data type codes
+#include "fitsio.h"
+
+//Includes for this project
+#include "stellarsolver.h"
+#include "sep/sep.h"
+
+namespace
+{
+
+/**
+ * @brief The SharedImage class maps the image a client placed in shared memory, read only, for the duration of one request.
+ * The image is either a POSIX shared memory object (shm_open name) or a file path, such as a file in /dev/shm or
+ * /proc/<pid>/fd/<n> for a memfd created by the client.
+ */
+class SharedImage
+{
+    public:
+        ~SharedImage()
+        {
+            if (m_Map != MAP_FAILED)
+                munmap(m_Map, m_MapSize);
+        }
+
+        bool map(const QJsonObject &request, size_t bytesNeeded, QString &error)
+        {
+            // JSON numbers are doubles, the offset has to be a whole number of bytes that a double holds exactly
+            size_t offset = 0;
+            if (request.contains("offset"))
+            {
+                const double requestedOffset = request["offset"].toDouble(-1);
+                if (!request["offset"].isDouble() || !(requestedOffset >= 0) || requestedOffset > 9007199254740992.0
+                        || std::floor(requestedOffset) != requestedOffset)
+                {
+                    error = "The 'offset' of the request has to be a non-negative integer";
+                    return false;
+                }
+                offset = static_cast<size_t>(requestedOffset);
+            }
+
+            int fd = -1;
+            if (request.contains("shm"))
+                fd = shm_open(request["shm"].toString().toLocal8Bit().constData(), O_RDONLY, 0);
+            else if (request.contains("file"))
+                fd = open(request["file"].toString().toLocal8Bit().constData(), O_RDONLY);
+            else
+            {
+                error = "The request has neither a 'shm' nor a 'file' entry for the image";
+                return false;
+            }
+            if (fd < 0)
+            {
+                error = QString("Could not open the shared image: %1").arg(strerror(errno));
+                return false;
+            }
+
+            struct stat info;
+            if (fstat(fd, &info) != 0 || info.st_size < 0 || offset > static_cast<size_t>(info.st_size)
+                    || bytesNeeded > static_cast<size_t>(info.st_size) - offset)
+            {
+                error = "The shared image is smaller than the image described in the request";
+                close(fd);
+                return false;
+            }
+
+            // The mapping has to start on a page boundary, so map from there and skip to the requested offset
+            size_t pageOffset = offset - offset % static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            m_MapSize = bytesNeeded + (offset - pageOffset);
+            m_Map = mmap(nullptr, m_MapSize, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(pageOffset));
+            // The mapping stays valid after the descriptor is closed
+            close(fd);
+            if (m_Map == MAP_FAILED)
+            {
+                error = QString("Could not map the shared image: %1").arg(strerror(errno));
+                return false;
+            }
+            m_Data = static_cast<const uint8_t *>(m_Map) + (offset - pageOffset);
+            return true;
+        }
+
+        const uint8_t *data() const
+        {
+            return m_Data;
+        }
+
+    private:
+        void *m_Map { MAP_FAILED };
+        size_t m_MapSize { 0 };
+        const uint8_t *m_Data { nullptr };
+};
+
+QJsonObject starToJson(const FITSImage::Star &star)
+{
+    QJsonObject json;
+    json["x"] = star.x;
+    json["y"] = star.y;
+    json["mag"] = star.mag;
+    json["flux"] = star.flux;
+    json["peak"] = star.peak;
+    json["HFR"] = star.HFR;
+    json["a"] = star.a;
+    json["b"] = star.b;
+    json["theta"] = star.theta;
+    json["ra"] = star.ra;
+    json["dec"] = star.dec;
+    json["numPixels"] = star.numPixels;
+    return json;
+}
+
+} // namespace
+
+SolveDaemon::SolveDaemon(QObject *parent) : QObject(parent)
+{
+    // The solvers wait for their child solvers in their own event loops, so a pool thread is busy for the whole request
+    m_Pool.setMaxThreadCount(1);
+    m_Pool.setExpiryTimeout(-1);
+    connect(&m_Server, &QLocalServer::newConnection, this, &SolveDaemon::newConnection);
+}
+
+SolveDaemon::~SolveDaemon()
+{
+    m_Server.close();
+    m_Pool.waitForDone();
+}
+
+bool SolveDaemon::isServing(const QString &socketPath)
+{
+    QLocalSocket probe;
+    probe.connectToServer(socketPath);
+    if (!probe.waitForConnected(1000))
+        return false;
+    probe.disconnectFromServer();
+    return true;
+}
+
+bool SolveDaemon::start(const QString &socketPath)
+{
+    // Only a socket that nothing answers on anymore is removed, a running daemon keeps its clients
+    if (isServing(socketPath))
+        return false;
+    QLocalServer::removeServer(socketPath);
+    m_Server.setSocketOptions(QLocalServer::UserAccessOption);
+    return m_Server.listen(socketPath);
+}
+
+void SolveDaemon::setIndexFolderPaths(const QStringList &indexFolderPaths)
+{
+    m_IndexFolderPaths = indexFolderPaths;
+    m_IndexFiles = StellarSolver::getIndexFiles(indexFolderPaths);
+}
+
+void SolveDaemon::keepIndexesWarm(qint64 lockBudget)
+{
+    // Without an image the indexes are picked for any field size, so they are all read
+    m_IndexKeeper.reset(new StellarSolver());
+    m_IndexKeeper->setIndexFolderPaths(m_IndexFolderPaths);
+    m_IndexKeeper->warmUpIndexes(lockBudget);
+}
+
+void SolveDaemon::setMaxConcurrentJobs(int jobs)
+{
+    m_Pool.setMaxThreadCount(qMax(1, jobs));
+}
+
+void SolveDaemon::newConnection()
+{
+    while (QLocalSocket *socket = m_Server.nextPendingConnection())
+    {
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]()
+        {
+            readRequests(socket);
+        });
+        connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+    }
+}
+
+void SolveDaemon::readRequests(QLocalSocket *socket)
+{
+    while (socket->canReadLine())
+    {
+        QByteArray line = socket->readLine().trimmed();
+        if (line.isEmpty())
+            continue;
+
+        QJsonParseError parseError;
+        QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+        if (!document.isObject())
+        {
+            sendReply(socket, errorReply(QJsonValue(), "Invalid request: " + parseError.errorString()));
+            continue;
+        }
+
+        // The reply is written from the daemon's thread, the socket may be gone by the time the request is done
+        QPointer<QLocalSocket> client(socket);
+        QJsonObject request = document.object();
+        QtConcurrent::run(&m_Pool, [this, client, request]()
+        {
+            QJsonObject reply = processRequest(request);
+            QMetaObject::invokeMethod(this, [this, client, reply]()
+            {
+                if (client)
+                    sendReply(client, reply);
+            });
+        });
+    }
+}
+
+void SolveDaemon::sendReply(QLocalSocket *socket, const QJsonObject &reply)
+{
+    socket->write(QJsonDocument(reply).toJson(QJsonDocument::Compact));
+    socket->write("\n");
+    socket->flush();
+}
+
+QJsonObject SolveDaemon::errorReply(const QJsonValue &id, const QString &message)
+{
+    QJsonObject reply;
+    reply["id"] = id;
+    reply["status"] = "error";
+    reply["message"] = message;
+    return reply;
+}
+
+bool SolveDaemon::statsFromRequest(const QJsonObject &request, FITSImage::Statistic &stats, QString &error)
+{
+    int width = request["width"].toInt();
+    int height = request["height"].toInt();
+    int channels = request["channels"].toInt(1);
+    if (width <= 0 || height <= 0 || width > UINT16_MAX || height > UINT16_MAX)
+    {
+        error = "The image width and height must be between 1 and 65535";
+        return false;
+    }
+    if (channels != 1 && channels != 3)
+    {
+        error = "The image must have 1 or 3 channels";
+        return false;
+    }
+
+    QString dataType = request["dataType"].toString("uint16");
+    if (dataType == "uint8")
+    {
+        stats.dataType = SEP_TBYTE;
+        stats.bytesPerPixel = sizeof(uint8_t);
+    }
+    else if (dataType == "int16")
+    {
+        stats.dataType = TSHORT;
+        stats.bytesPerPixel = sizeof(int16_t);
+    }
+    else if (dataType == "uint16")
+    {
+        stats.dataType = TUSHORT;
+        stats.bytesPerPixel = sizeof(uint16_t);
+    }
+    else if (dataType == "int32")
+    {
+        stats.dataType = TLONG;
+        stats.bytesPerPixel = sizeof(int32_t);
+    }
+    else if (dataType == "uint32")
+    {
+        stats.dataType = TULONG;
+        stats.bytesPerPixel = sizeof(uint32_t);
+    }
+    else if (dataType == "float32")
+    {
+        stats.dataType = TFLOAT;
+        stats.bytesPerPixel = sizeof(float);
+    }
+    else if (dataType == "float64")
+    {
+        stats.dataType = TDOUBLE;
+        stats.bytesPerPixel = sizeof(double);
+    }
+    else
+    {
+        error = QString("Data type %1 is not supported").arg(dataType);
+        return false;
+    }
+
+    stats.width = static_cast<uint16_t>(width);
+    stats.height = static_cast<uint16_t>(height);
+    stats.channels = static_cast<uint8_t>(channels);
+    stats.ndim = channels == 1 ? 2 : 3;
+    stats.samples_per_channel = stats.width * stats.height;
+    stats.size = stats.samples_per_channel * stats.channels * stats.bytesPerPixel;
+    return true;
+}
+
+QJsonObject SolveDaemon::processRequest(const QJsonObject &request) const
+{
+    QJsonValue id = request["id"];
+    QString command = request["command"].toString();
+    if (command != "solve" && command != "extract")
+        return errorReply(id, QString("Unknown command '%1', use 'solve' or 'extract'").arg(command));
+
+    QString error;
+    FITSImage::Statistic stats;
+    if (!statsFromRequest(request, stats, error))
+        return errorReply(id, error);
+
+    SharedImage image;
+    if (!image.map(request, static_cast<size_t>(stats.samples_per_channel) * stats.channels * stats.bytesPerPixel, error))
+        return errorReply(id, error);
+
+    StellarSolver solver(stats, image.data());
+    if (m_IndexFiles.isEmpty())
+        solver.setIndexFolderPaths(m_IndexFolderPaths);
+    else
+        solver.setIndexFilePaths(m_IndexFiles);
+
+    int profile = request["profile"].toInt(m_DefaultProfile);
+    if (profile < 0 || profile >= StellarSolver::getBuiltInProfiles().count())
+        return errorReply(id, QString("There is no built in profile %1").arg(profile));
+    solver.setParameterProfile(static_cast<SSolver::Parameters::ParametersProfile>(profile));
+    if (request.contains("channel"))
+        solver.setColorChannel(request["channel"].toInt());
+    solver.setBayerLuminance(request["bayer"].toBool());
+
+    SSolver::Parameters params = solver.getCurrentParameters();
+    if (request.contains("keepNum"))
+        params.keepNum = request["keepNum"].toInt();
+    if (request.contains("timeLimit"))
+        params.solverTimeLimit = request["timeLimit"].toInt();
+    if (request.contains("searchRadius"))
+        params.search_radius = request["searchRadius"].toDouble();
+    solver.setParameters(params);
+
+    QJsonObject reply;
+    reply["id"] = id;
+
+    if (command == "extract")
+    {
+        QRect frame;
+        if (request.contains("subframe"))
+        {
+            QJsonArray rect = request["subframe"].toArray();
+            frame = QRect(rect[0].toInt(), rect[1].toInt(), rect[2].toInt(), rect[3].toInt());
+        }
+        if (!solver.extract(request["hfr"].toBool(false), frame))
+            return errorReply(id, "Star extraction failed");
+    }
+    else
+    {
+        if (request.contains("scaleLow") && request.contains("scaleHigh"))
+            solver.setSearchScale(request["scaleLow"].toDouble(), request["scaleHigh"].toDouble(),
+                                  request["scaleUnits"].toString("dw"));
+        if (request.contains("ra") && request.contains("dec"))
+            solver.setSearchPositionInDegrees(request["ra"].toDouble(), request["dec"].toDouble());
+        if (!solver.solve())
+            return errorReply(id, "Did not solve");
+
+        const FITSImage::Solution &solution = solver.getSolution();
+        QJsonObject json;
+        json["ra"] = solution.ra;
+        json["dec"] = solution.dec;
+        json["orientation"] = solution.orientation;
+        json["pixscale"] = solution.pixscale;
+        json["fieldWidth"] = solution.fieldWidth;
+        json["fieldHeight"] = solution.fieldHeight;
+        json["parity"] = FITSImage::getShortParityText(solution.parity);
+        json["index"] = solver.getSolutionIndexNumber();
+        json["healpix"] = solver.getSolutionHealpix();
+        reply["solution"] = json;
+    }
+
+    if (request["stars"].toBool(command == "extract"))
+    {
+        QJsonArray stars;
+        const QList<FITSImage::Star> &starList = command == "extract" ? solver.getStarList() : solver.getStarListFromSolve();
+        for (const FITSImage::Star &star : starList)
+            stars.append(starToJson(star));
+        reply["stars"] = stars;
+    }
+
+    reply["status"] = "ok";
+    return reply;
+}
@@ -0,0 +1,102 @@
+/*  StellarSolver Daemon, a resident solve service for the StellarSolver Internal Library
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//Qt Includes
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QJsonObject>
+#include <QThreadPool>
+#include <QStringList>
+#include <QScopedPointer>
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "parameters.h"
+
+class StellarSolver;
+
+/**
+ * @brief The SolveDaemon class accepts solve and extract requests from local clients over a Unix domain socket.
+ * Each request is one line of JSON describing an image that the client placed in shared memory, and each answer is one line of JSON.
+ * The index files are resolved once when the daemon starts and all the requests share one pool of solver threads.
+ */
+class SolveDaemon : public QObject
+{
+        Q_OBJECT
+    public:
+        explicit SolveDaemon(QObject *parent = nullptr);
+        ~SolveDaemon();
+
+        /**
+         * @brief start begins listening on the socket, any stale socket file left by a previous daemon is removed
+         * @param socketPath The path of the Unix domain socket
+         * @return Whether the daemon is listening, false if another daemon is already serving the socket
+         */
+        bool start(const QString &socketPath);
+
+        /**
+         * @brief isServing checks whether a daemon answers on the socket
+         * @param socketPath The path of the Unix domain socket
+         * @return Whether a connection to the socket succeeds
+         */
+        static bool isServing(const QString &socketPath);
+
+        /**
+         * @brief setIndexFolderPaths sets the folders with the index files, they are searched once here and not for every request
+         * @param indexFolderPaths The folders to search for index files
+         */
+        void setIndexFolderPaths(const QStringList &indexFolderPaths);
+
+        /**
+         * @brief keepIndexesWarm reads the index files into the system's file cache once for all the requests, and locks them
+         * in memory up to the budget for as long as the daemon runs, so the solves of the requests find them there.
+         * Call it after setIndexFolderPaths.
+         * @param lockBudget How many bytes of index files may be locked in memory, 0 to only read them into the file cache
+         */
+        void keepIndexesWarm(qint64 lockBudget);
+
+        /**
+         * @brief setMaxConcurrentJobs sets how many requests are processed at the same time for all clients together
+         * @param jobs The number of requests to process at once
+         */
+        void setMaxConcurrentJobs(int jobs);
+
+        /**
+         * @brief setDefaultProfile sets the parameter profile used for requests that don't ask for one
+         * @param profile The built in profile
+         */
+        void setDefaultProfile(SSolver::Parameters::ParametersProfile profile)
+        {
+            m_DefaultProfile = profile;
+        }
+
+    private:
+        void newConnection();
+        void readRequests(QLocalSocket *socket);
+        void sendReply(QLocalSocket *socket, const QJsonObject &reply);
+
+        /**
+         * @brief processRequest runs one request on a pool thread, the image is read straight from the client's shared memory
+         * @param request The parsed JSON request
+         * @return The JSON reply to send back to the client
+         */
+        QJsonObject processRequest(const QJsonObject &request) const;
+
+        static QJsonObject errorReply(const QJsonValue &id, const QString &message);
+        static bool statsFromRequest(const QJsonObject &request, FITSImage::Statistic &stats, QString &error);
+
+        QLocalServer m_Server;
+        QThreadPool m_Pool;
+        QStringList m_IndexFolderPaths;
+        QStringList m_IndexFiles;
+        // This holds the warmed up and locked index files, see keepIndexesWarm
+        QScopedPointer<StellarSolver> m_IndexKeeper;
+        SSolver::Parameters::ParametersProfile m_DefaultProfile { SSolver::Parameters::PARALLEL_SMALLSCALE };
+};
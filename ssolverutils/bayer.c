@@ -25,6 +25,7 @@
 
 #include <limits.h>
 #include <math.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -92,6 +93,68 @@ void ClearBorders_uint16(uint16_t *rgb, int sx, int sy, int w)
     }
 }
 
+/* Same black edges as ClearBorders, with top, bottom, left and right widths, but only in the rows [first, last) */
+static void ClearBorderRows(uint8_t *rgb, int sx, int sy, int top, int bottom, int left, int right, int first,
+                            int last)
+{
+    int y;
+    for (y = first; y < last; y++)
+    {
+        uint8_t *row = rgb + (ptrdiff_t)y * sx * 3;
+        if (y < top || y >= sy - bottom)
+            memset(row, 0, sx * 3 * sizeof(uint8_t));
+        else
+        {
+            memset(row, 0, left * 3 * sizeof(uint8_t));
+            memset(row + (sx - right) * 3, 0, right * 3 * sizeof(uint8_t));
+        }
+    }
+}
+
+static void ClearBorderRows_uint16(uint16_t *rgb, int sx, int sy, int top, int bottom, int left, int right,
+                                   int first, int last)
+{
+    int y;
+    for (y = first; y < last; y++)
+    {
+        uint16_t *row = rgb + (ptrdiff_t)y * sx * 3;
+        if (y < top || y >= sy - bottom)
+            memset(row, 0, sx * 3 * sizeof(uint16_t));
+        else
+        {
+            memset(row, 0, left * 3 * sizeof(uint16_t));
+            memset(row + (sx - right) * 3, 0, right * 3 * sizeof(uint16_t));
+        }
+    }
+}
+
+/* The decoders that work row by row (nearest neighbor, bilinear and HQ linear) can decode any band of rows
+   [first, last) of the image, so that bands can be decoded on several threads at once. The image rows that
+   a decoder starts with are skipped, and since the colors swap on every row, they are swapped for every
+   skipped row. START_ROWS is used right before the row loop, with top the first image row that is decoded. */
+#define START_ROWS(top)                                       \
+    first  = first > (top) ? first - (top) : 0;               \
+    last   = last - (top) < height ? last - (top) : height;   \
+    height = last > first ? last - first : 0;                 \
+    bayer += (ptrdiff_t)first * bayerStep;                    \
+    rgb += (ptrdiff_t)first * rgbStep;                        \
+    if (first & 1)                                            \
+    {                                                         \
+        blue             = -blue;                             \
+        start_with_green = !start_with_green;                 \
+    }
+
+/* These decoders are also built for AVX2, and the loader picks the build that suits the CPU. They are plain C,
+   so this only lets the compiler vectorize them with wider registers where the processor has them. */
+#if defined(__x86_64__) && defined(__linux__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define BAYER_ROW_KERNEL __attribute__((target_clones("avx2", "default")))
+#endif
+#endif
+#ifndef BAYER_ROW_KERNEL
+#define BAYER_ROW_KERNEL
+#endif
+
 /**************************************************************
  *     Color conversion functions for cameras that can        *
  * output raw-Bayer pattern images, such as some Basler and   *
@@ -104,8 +167,8 @@ void ClearBorders_uint16(uint16_t *rgb, int sx, int sy, int w)
 /* 8-bits versions */
 /* insprired by OpenCV's Bayer decoding */
 
-dc1394error_t dc1394_bayer_NearestNeighbor(const uint8_t *bayer, uint8_t *rgb, int sx, int sy,
-                                           int tile)
+BAYER_ROW_KERNEL static dc1394error_t dc1394_bayer_NearestNeighbor_rows(const uint8_t *bayer,
+                                                                        uint8_t *rgb, int sx, int sy, int tile, int first, int last)
 {
     const int bayerStep  = sx;
     const int rgbStep    = 3 * sx;
@@ -113,29 +176,16 @@ dc1394error_t dc1394_bayer_NearestNeighbor(const uint8_t *bayer, uint8_t *rgb, i
     int height           = sy;
     int blue             = tile == DC1394_COLOR_FILTER_BGGR || tile == DC1394_COLOR_FILTER_GBRG ? -1 : 1;
     int start_with_green = tile == DC1394_COLOR_FILTER_GBRG || tile == DC1394_COLOR_FILTER_GRBG;
-    int i, imax, iinc;
 
     if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
         return DC1394_INVALID_COLOR_FILTER;
 
-    /* add black border */
-    imax = sx * sy * 3;
-    for (i = sx * (sy - 1) * 3; i < imax; i++)
-    {
-        rgb[i] = 0;
-    }
-    iinc = (sx - 1) * 3;
-    for (i = (sx - 1) * 3; i < imax; i += iinc)
-    {
-        rgb[i++] = 0;
-        rgb[i++] = 0;
-        rgb[i++] = 0;
-    }
-
     rgb += 1;
     width -= 1;
     height -= 1;
 
+    START_ROWS(0);
+
     for (; height--; bayer += bayerStep, rgb += rgbStep)
     {
         const uint8_t *bayerEnd = bayer + width;
@@ -195,8 +245,19 @@ dc1394error_t dc1394_bayer_NearestNeighbor(const uint8_t *bayer, uint8_t *rgb, i
     return DC1394_SUCCESS;
 }
 
+dc1394error_t dc1394_bayer_NearestNeighbor(const uint8_t *bayer, uint8_t *rgb, int sx, int sy,
+                                           int tile)
+{
+    if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
+        return DC1394_INVALID_COLOR_FILTER;
+
+    ClearBorderRows(rgb, sx, sy, 0, 1, 0, 1, 0, sy);
+    return dc1394_bayer_NearestNeighbor_rows(bayer, rgb, sx, sy, tile, 0, sy);
+}
+
 /* OpenCV's Bayer decoding */
-dc1394error_t dc1394_bayer_Bilinear(const uint8_t *bayer, uint8_t *rgb, int sx, int sy, int tile)
+BAYER_ROW_KERNEL static dc1394error_t dc1394_bayer_Bilinear_rows(const uint8_t *bayer,
+                                                                 uint8_t *rgb, int sx, int sy, int tile, int first, int last)
 {
     const int bayerStep = sx;
     const int rgbStep   = 3 * sx;
@@ -220,11 +281,12 @@ dc1394error_t dc1394_bayer_Bilinear(const uint8_t *bayer, uint8_t *rgb, int sx,
     if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
         return DC1394_INVALID_COLOR_FILTER;
 
-    ClearBorders(rgb, sx, sy, 1);
     rgb += rgbStep + 3 + 1;
     height -= 2;
     width -= 2;
 
+    START_ROWS(1);
+
     for (; height--; bayer += bayerStep, rgb += rgbStep)
     {
         int t0, t1;
@@ -298,10 +360,20 @@ dc1394error_t dc1394_bayer_Bilinear(const uint8_t *bayer, uint8_t *rgb, int sx,
     return DC1394_SUCCESS;
 }
 
+dc1394error_t dc1394_bayer_Bilinear(const uint8_t *bayer, uint8_t *rgb, int sx, int sy, int tile)
+{
+    if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
+        return DC1394_INVALID_COLOR_FILTER;
+
+    ClearBorders(rgb, sx, sy, 1);
+    return dc1394_bayer_Bilinear_rows(bayer, rgb, sx, sy, tile, 0, sy);
+}
+
 /* High-Quality Linear Interpolation For Demosaicing Of
    Bayer-Patterned Color Images, by Henrique S. Malvar, Li-wei He, and
    Ross Cutler, in ICASSP'04 */
-dc1394error_t dc1394_bayer_HQLinear(const uint8_t *bayer, uint8_t *rgb, int sx, int sy, int tile)
+BAYER_ROW_KERNEL static dc1394error_t dc1394_bayer_HQLinear_rows(const uint8_t *bayer,
+                                                                 uint8_t *rgb, int sx, int sy, int tile, int first, int last)
 {
     const int bayerStep  = sx;
     const int rgbStep    = 3 * sx;
@@ -313,7 +385,6 @@ dc1394error_t dc1394_bayer_HQLinear(const uint8_t *bayer, uint8_t *rgb, int sx,
     if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
         return DC1394_INVALID_COLOR_FILTER;
 
-    ClearBorders(rgb, sx, sy, 2);
     rgb += 2 * rgbStep + 6 + 1;
     height -= 4;
     width -= 4;
@@ -321,6 +392,8 @@ dc1394error_t dc1394_bayer_HQLinear(const uint8_t *bayer, uint8_t *rgb, int sx,
     /* We begin with a (+1 line,+1 column) offset with respect to bilinear decoding, so start_with_green is the same, but blue is opposite */
     blue = -blue;
 
+    START_ROWS(2);
+
     for (; height--; bayer += bayerStep, rgb += rgbStep)
     {
         int t0, t1;
@@ -445,6 +518,15 @@ dc1394error_t dc1394_bayer_HQLinear(const uint8_t *bayer, uint8_t *rgb, int sx,
     return DC1394_SUCCESS;
 }
 
+dc1394error_t dc1394_bayer_HQLinear(const uint8_t *bayer, uint8_t *rgb, int sx, int sy, int tile)
+{
+    if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
+        return DC1394_INVALID_COLOR_FILTER;
+
+    ClearBorders(rgb, sx, sy, 2);
+    return dc1394_bayer_HQLinear_rows(bayer, rgb, sx, sy, tile, 0, sy);
+}
+
 /* coriander's Bayer decoding */
 /* Edge Sensing Interpolation II from http://www-ise.stanford.edu/~tingchen/ */
 /*   (Laroche,Claude A.  "Apparatus and method for adaptively
@@ -920,8 +1002,9 @@ dc1394error_t dc1394_bayer16_RGBX_NearestNeighbor(const uint16_t *bayer, uint16_
 }
 
 /* insprired by OpenCV's Bayer decoding */
-dc1394error_t dc1394_bayer_NearestNeighbor_uint16(const uint16_t *bayer, uint16_t *rgb, int sx,
-                                                  int sy, int tile, int bits)
+BAYER_ROW_KERNEL static dc1394error_t dc1394_bayer_NearestNeighbor_rows_uint16(const uint16_t *bayer,
+                                                                               uint16_t *rgb, int sx, int sy, int tile, int bits,
+                                                                               int first, int last)
 {
     (void)bits;
     const int bayerStep  = sx;
@@ -930,29 +1013,16 @@ dc1394error_t dc1394_bayer_NearestNeighbor_uint16(const uint16_t *bayer, uint16_
     int height           = sy;
     int blue             = tile == DC1394_COLOR_FILTER_BGGR || tile == DC1394_COLOR_FILTER_GBRG ? -1 : 1;
     int start_with_green = tile == DC1394_COLOR_FILTER_GBRG || tile == DC1394_COLOR_FILTER_GRBG;
-    int i, iinc, imax;
 
     if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
         return DC1394_INVALID_COLOR_FILTER;
 
-    /* add black border */
-    imax = sx * sy * 3;
-    for (i = sx * (sy - 1) * 3; i < imax; i++)
-    {
-        rgb[i] = 0;
-    }
-    iinc = (sx - 1) * 3;
-    for (i = (sx - 1) * 3; i < imax; i += iinc)
-    {
-        rgb[i++] = 0;
-        rgb[i++] = 0;
-        rgb[i++] = 0;
-    }
-
     rgb += 1;
     height -= 1;
     width -= 1;
 
+    START_ROWS(0);
+
     for (; height--; bayer += bayerStep, rgb += rgbStep)
     {
         const uint16_t *bayerEnd = bayer + width;
@@ -1011,9 +1081,19 @@ dc1394error_t dc1394_bayer_NearestNeighbor_uint16(const uint16_t *bayer, uint16_
 
     return DC1394_SUCCESS;
 }
+
+dc1394error_t dc1394_bayer_NearestNeighbor_uint16(const uint16_t *bayer, uint16_t *rgb, int sx,
+                                                  int sy, int tile, int bits)
+{
+    if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
+        return DC1394_INVALID_COLOR_FILTER;
+
+    ClearBorderRows_uint16(rgb, sx, sy, 0, 1, 0, 1, 0, sy);
+    return dc1394_bayer_NearestNeighbor_rows_uint16(bayer, rgb, sx, sy, tile, bits, 0, sy);
+}
 /* OpenCV's Bayer decoding */
-dc1394error_t dc1394_bayer_Bilinear_uint16(const uint16_t *bayer, uint16_t *rgb, int sx, int sy,
-                                           int tile, int bits)
+BAYER_ROW_KERNEL static dc1394error_t dc1394_bayer_Bilinear_rows_uint16(const uint16_t *bayer,
+                                                                        uint16_t *rgb, int sx, int sy, int tile, int bits, int first, int last)
 {
     (void)bits;
     const int bayerStep  = sx;
@@ -1030,6 +1110,8 @@ dc1394error_t dc1394_bayer_Bilinear_uint16(const uint16_t *bayer, uint16_t *rgb,
     height -= 2;
     width -= 2;
 
+    START_ROWS(1);
+
     for (; height--; bayer += bayerStep, rgb += rgbStep)
     {
         int t0, t1;
@@ -1104,11 +1186,21 @@ dc1394error_t dc1394_bayer_Bilinear_uint16(const uint16_t *bayer, uint16_t *rgb,
     return DC1394_SUCCESS;
 }
 
+dc1394error_t dc1394_bayer_Bilinear_uint16(const uint16_t *bayer, uint16_t *rgb, int sx, int sy,
+                                           int tile, int bits)
+{
+    if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
+        return DC1394_INVALID_COLOR_FILTER;
+
+    ClearBorders_uint16(rgb, sx, sy, 1);
+    return dc1394_bayer_Bilinear_rows_uint16(bayer, rgb, sx, sy, tile, bits, 0, sy);
+}
+
 /* High-Quality Linear Interpolation For Demosaicing Of
    Bayer-Patterned Color Images, by Henrique S. Malvar, Li-wei He, and
    Ross Cutler, in ICASSP'04 */
-dc1394error_t dc1394_bayer_HQLinear_uint16(const uint16_t *bayer, uint16_t *rgb, int sx, int sy,
-                                           int tile, int bits)
+BAYER_ROW_KERNEL static dc1394error_t dc1394_bayer_HQLinear_rows_uint16(const uint16_t *bayer,
+                                                                        uint16_t *rgb, int sx, int sy, int tile, int bits, int first, int last)
 {
     const int bayerStep = sx;
     const int rgbStep   = 3 * sx;
@@ -1132,7 +1224,6 @@ dc1394error_t dc1394_bayer_HQLinear_uint16(const uint16_t *bayer, uint16_t *rgb,
     if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
         return DC1394_INVALID_COLOR_FILTER;
 
-    ClearBorders_uint16(rgb, sx, sy, 2);
     rgb += 2 * rgbStep + 6 + 1;
     height -= 4;
     width -= 4;
@@ -1140,6 +1231,8 @@ dc1394error_t dc1394_bayer_HQLinear_uint16(const uint16_t *bayer, uint16_t *rgb,
     /* We begin with a (+1 line,+1 column) offset with respect to bilinear decoding, so start_with_green is the same, but blue is opposite */
     blue = -blue;
 
+    START_ROWS(2);
+
     for (; height--; bayer += bayerStep, rgb += rgbStep)
     {
         int t0, t1;
@@ -1264,6 +1357,16 @@ dc1394error_t dc1394_bayer_HQLinear_uint16(const uint16_t *bayer, uint16_t *rgb,
     return DC1394_SUCCESS;
 }
 
+dc1394error_t dc1394_bayer_HQLinear_uint16(const uint16_t *bayer, uint16_t *rgb, int sx, int sy,
+                                           int tile, int bits)
+{
+    if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
+        return DC1394_INVALID_COLOR_FILTER;
+
+    ClearBorders_uint16(rgb, sx, sy, 2);
+    return dc1394_bayer_HQLinear_rows_uint16(bayer, rgb, sx, sy, tile, bits, 0, sy);
+}
+
 /* coriander's Bayer decoding */
 dc1394error_t dc1394_bayer_EdgeSense_uint16(const uint16_t *bayer, uint16_t *rgb, int sx, int sy,
                                             int tile, int bits)
@@ -2576,3 +2679,66 @@ dc1394error_t dc1394_bayer_decoding_16bit(const uint16_t *bayer, uint16_t *rgb,
             return DC1394_INVALID_BAYER_METHOD;
     }
 }
+
+dc1394bool_t dc1394_bayer_decodes_rows(dc1394bayer_method_t method)
+{
+    switch (method)
+    {
+        case DC1394_BAYER_METHOD_NEAREST:
+        case DC1394_BAYER_METHOD_BILINEAR:
+        case DC1394_BAYER_METHOD_HQLINEAR:
+            return DC1394_TRUE;
+        default:
+            return DC1394_FALSE;
+    }
+}
+
+dc1394error_t dc1394_bayer_decoding_8bit_rows(const uint8_t *bayer, uint8_t *rgb, uint32_t sx, uint32_t sy,
+                                              dc1394color_filter_t tile, dc1394bayer_method_t method,
+                                              uint32_t first_row, uint32_t last_row)
+{
+    if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
+        return DC1394_INVALID_COLOR_FILTER;
+    if (last_row > sy)
+        last_row = sy;
+
+    switch (method)
+    {
+        case DC1394_BAYER_METHOD_NEAREST:
+            ClearBorderRows(rgb, sx, sy, 0, 1, 0, 1, first_row, last_row);
+            return dc1394_bayer_NearestNeighbor_rows(bayer, rgb, sx, sy, tile, first_row, last_row);
+        case DC1394_BAYER_METHOD_BILINEAR:
+            ClearBorderRows(rgb, sx, sy, 1, 1, 1, 1, first_row, last_row);
+            return dc1394_bayer_Bilinear_rows(bayer, rgb, sx, sy, tile, first_row, last_row);
+        case DC1394_BAYER_METHOD_HQLINEAR:
+            ClearBorderRows(rgb, sx, sy, 2, 2, 2, 2, first_row, last_row);
+            return dc1394_bayer_HQLinear_rows(bayer, rgb, sx, sy, tile, first_row, last_row);
+        default:
+            return DC1394_INVALID_BAYER_METHOD;
+    }
+}
+
+dc1394error_t dc1394_bayer_decoding_16bit_rows(const uint16_t *bayer, uint16_t *rgb, uint32_t sx, uint32_t sy,
+                                               dc1394color_filter_t tile, dc1394bayer_method_t method,
+                                               uint32_t bits, uint32_t first_row, uint32_t last_row)
+{
+    if ((tile > DC1394_COLOR_FILTER_MAX) || (tile < DC1394_COLOR_FILTER_MIN))
+        return DC1394_INVALID_COLOR_FILTER;
+    if (last_row > sy)
+        last_row = sy;
+
+    switch (method)
+    {
+        case DC1394_BAYER_METHOD_NEAREST:
+            ClearBorderRows_uint16(rgb, sx, sy, 0, 1, 0, 1, first_row, last_row);
+            return dc1394_bayer_NearestNeighbor_rows_uint16(bayer, rgb, sx, sy, tile, bits, first_row, last_row);
+        case DC1394_BAYER_METHOD_BILINEAR:
+            ClearBorderRows_uint16(rgb, sx, sy, 1, 1, 1, 1, first_row, last_row);
+            return dc1394_bayer_Bilinear_rows_uint16(bayer, rgb, sx, sy, tile, bits, first_row, last_row);
+        case DC1394_BAYER_METHOD_HQLINEAR:
+            ClearBorderRows_uint16(rgb, sx, sy, 2, 2, 2, 2, first_row, last_row);
+            return dc1394_bayer_HQLinear_rows_uint16(bayer, rgb, sx, sy, tile, bits, first_row, last_row);
+        default:
+            return DC1394_INVALID_BAYER_METHOD;
+    }
+}
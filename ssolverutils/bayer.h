@@ -275,6 +275,26 @@ dc1394error_t dc1394_bayer_decoding_8bit(const uint8_t *bayer, uint8_t *rgb, uin
 dc1394error_t dc1394_bayer_decoding_16bit(const uint16_t *bayer, uint16_t *rgb, uint32_t width, uint32_t height,
         dc1394color_filter_t tile, dc1394bayer_method_t method, uint32_t bits);
 
+/**
+ * Whether the method decodes each row of the image on its own, which is the case of the nearest neighbor, bilinear and
+ * HQ linear methods. Their images can be decoded in bands of rows on several threads at once with the functions below.
+ */
+dc1394bool_t dc1394_bayer_decodes_rows(dc1394bayer_method_t method);
+
+/**
+ * Perform de-mosaicing of the rows [first_row, last_row) of an 8-bit image buffer, with a method for which
+ * dc1394_bayer_decodes_rows is true. Once every row is decoded, rgb is the same as with dc1394_bayer_decoding_8bit.
+ */
+dc1394error_t dc1394_bayer_decoding_8bit_rows(const uint8_t *bayer, uint8_t *rgb, uint32_t width, uint32_t height,
+        dc1394color_filter_t tile, dc1394bayer_method_t method, uint32_t first_row, uint32_t last_row);
+
+/**
+ * Perform de-mosaicing of the rows [first_row, last_row) of a 16-bit image buffer, with a method for which
+ * dc1394_bayer_decodes_rows is true. Once every row is decoded, rgb is the same as with dc1394_bayer_decoding_16bit.
+ */
+dc1394error_t dc1394_bayer_decoding_16bit_rows(const uint16_t *bayer, uint16_t *rgb, uint32_t width, uint32_t height,
+        dc1394color_filter_t tile, dc1394bayer_method_t method, uint32_t bits, uint32_t first_row, uint32_t last_row);
+
 /* Bayer to RGBX */
 dc1394error_t dc1394_bayer16_RGBX_NearestNeighbor(const uint16_t *bayer, uint16_t *rgbx, int sx, int sy, int tile);
 #ifdef __cplusplus
@@ -1,5 +1,10 @@
 //Qt Includes
 #include <QFileInfo>
+#include <QtConcurrent>
+#include <QtEndian>
+
+//System Includes
+#include <numeric>
 
 //Project Includes
 #include "fileio.h"
@@ -13,7 +18,8 @@ fileio::fileio()
 
 fileio::~fileio()
 {
-    if(m_ImageBuffer && !imageBufferTaken)
+    // A mapped buffer can't be freed by whoever took it, so it is always released here
+    if(m_ImageBuffer && (!imageBufferTaken || m_ImageBufferMapped))
         deleteImageBuffer();
 }
 
@@ -21,11 +27,234 @@ void fileio::deleteImageBuffer()
 {
     if(m_ImageBuffer)
     {
-        delete[] m_ImageBuffer;
+        if(m_ImageBufferMapped)
+        {
+            m_MappedFile.unmap(m_ImageBuffer);
+            m_MappedFile.close();
+            m_ImageBufferMapped = false;
+        }
+        else
+            delete[] m_ImageBuffer;
         m_ImageBuffer = nullptr;
     }
 }
 
+namespace
+{
+// Converts big endian FITS integers or floats in place to the native values fits_read_img would give.
+// signFlip applies a BZERO of 2^(bits-1), clampNegative mimics cfitsio clipping negative signed values to 0 for unsigned reads.
+template <typename Raw>
+void convertFromBigEndian(Raw *data, size_t count, Raw signFlip, bool clampNegative)
+{
+    const Raw signBit = Raw(1) << (sizeof(Raw) * 8 - 1);
+    // Split in blocks so that the pages are converted on several threads at once
+    const size_t blockSize = 1 << 18;
+    QVector<size_t> blockStarts;
+    for(size_t start = 0; start < count; start += blockSize)
+        blockStarts.append(start);
+    QtConcurrent::blockingMap(blockStarts, [ = ](size_t start)
+    {
+        size_t end = qMin(start + blockSize, count);
+        for(size_t i = start; i < end; i++)
+        {
+            Raw value = qFromBigEndian(data[i]);
+            if(clampNegative && (value & signBit))
+                value = 0;
+            data[i] = value ^ signFlip;
+        }
+    });
+}
+
+// Every 3x3 block of a Bayer pattern weighted 1 2 1 / 2 4 2 / 1 2 1 holds red, green and blue as (R + 2G + B) / 4,
+// whatever the filter color of the center, so this is the luminance at full resolution without debayering.
+// Beyond the edges the pattern is mirrored, which keeps the filter colors in place.
+template <typename T>
+void bayerToLuminance(const T *source, T *destination, int width, int height)
+{
+    QVector<int> rows(height);
+    std::iota(rows.begin(), rows.end(), 0);
+    QtConcurrent::blockingMap(rows, [ = ](int y)
+    {
+        auto mirror = [](int i, int size)
+        {
+            return i < 0 ? qMin(-i, size - 1) : (i >= size ? qMax(0, 2 * size - 2 - i) : i);
+        };
+        const T *above = source + static_cast<size_t>(mirror(y - 1, height)) * width;
+        const T *row = source + static_cast<size_t>(y) * width;
+        const T *below = source + static_cast<size_t>(mirror(y + 1, height)) * width;
+        T *output = destination + static_cast<size_t>(y) * width;
+        for (int x = 0; x < width; x++)
+        {
+            const int left = mirror(x - 1, width);
+            const int right = mirror(x + 1, width);
+            const uint32_t sum = above[left] + 2 * above[x] + above[right]
+                                 + 2 * (row[left] + 2 * row[x] + row[right])
+                                 + below[left] + 2 * below[x] + below[right];
+            output[x] = static_cast<T>((sum + 8) / 16);
+        }
+    });
+}
+
+// Every 2x2 block of a Bayer pattern holds one red, two green and one blue pixel, so its average is the
+// luminance of a superpixel. The image is halved in both directions.
+template <typename T>
+void bayerToSuperpixels(const T *source, T *destination, int width, int height)
+{
+    const int newWidth = width / 2;
+    QVector<int> rows(height / 2);
+    std::iota(rows.begin(), rows.end(), 0);
+    QtConcurrent::blockingMap(rows, [ = ](int y)
+    {
+        const T *top = source + static_cast<size_t>(2 * y) * width;
+        const T *bottom = top + width;
+        T *output = destination + static_cast<size_t>(y) * newWidth;
+        for (int x = 0; x < newWidth; x++)
+        {
+            const uint32_t sum = top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1];
+            output[x] = static_cast<T>((sum + 2) / 4);
+        }
+    });
+}
+
+// The nearest neighbor, bilinear and HQ linear methods decode every row on its own, so their images are decoded
+// in bands of rows on several threads at once, which gives the same image as decoding them in one go.
+template <typename DecodeRows>
+dc1394error_t decodeInBands(int height, DecodeRows decodeRows)
+{
+    const int bandHeight = 64;
+    QVector<int> bandStarts;
+    for (int first = 0; first < height; first += bandHeight)
+        bandStarts.append(first);
+    QAtomicInt error(DC1394_SUCCESS);
+    QtConcurrent::blockingMap(bandStarts, [&](int first)
+    {
+        dc1394error_t bandError = decodeRows(first, qMin(first + bandHeight, height));
+        if (bandError != DC1394_SUCCESS)
+            error.testAndSetRelaxed(DC1394_SUCCESS, bandError);
+    });
+    return static_cast<dc1394error_t>(static_cast<int>(error));
+}
+
+// The decoders give interleaved R1G1B1 pixels, this copies them into the three planes of a FITS image.
+template <typename T>
+void splitChannels(const T *rgb, T *planes, int width, int height)
+{
+    const size_t planeSize = static_cast<size_t>(width) * height;
+    QVector<int> rows(height);
+    std::iota(rows.begin(), rows.end(), 0);
+    QtConcurrent::blockingMap(rows, [ = ](int y)
+    {
+        const size_t start = static_cast<size_t>(y) * width;
+        const T *pixel = rgb + start * 3;
+        T *rBuff = planes + start;
+        T *gBuff = rBuff + planeSize;
+        T *bBuff = gBuff + planeSize;
+        for (int x = 0; x < width; x++, pixel += 3)
+        {
+            rBuff[x] = pixel[0];
+            gBuff[x] = pixel[1];
+            bBuff[x] = pixel[2];
+        }
+    });
+}
+}
+
+//This maps the data unit of an uncompressed FITS file instead of copying it with fits_read_img.
+//The mapping is private, so 8 bit images share their pages with the page cache and other readers,
+//and wider types are converted from big endian in place, only copying the pages as they are written.
+//It returns false whenever cfitsio has to do the reading, for instance for compressed or scaled data.
+bool fileio::mapFitsData(int fitsBitPix)
+{
+    int status = 0;
+    int compressed = fits_is_compressed_image(fptr, &status);
+    if(status || compressed)
+        return false;
+
+    double bscale = 1, bzero = 0;
+    status = 0;
+    if(fits_read_key(fptr, TDOUBLE, "BSCALE", &bscale, nullptr, &status))
+        bscale = 1;
+    status = 0;
+    if(fits_read_key(fptr, TDOUBLE, "BZERO", &bzero, nullptr, &status))
+        bzero = 0;
+    if(bscale != 1)
+        return false;
+
+    // Bayered images get a new buffer when they are debayered, so there is nothing to gain
+    char bayerPattern[64];
+    status = 0;
+    if(!justLoadBuffer && !fits_read_keyword(fptr, "BAYERPAT", bayerPattern, nullptr, &status))
+        return false;
+
+    LONGLONG headStart = 0, dataStart = 0, dataEnd = 0;
+    status = 0;
+    if(fits_get_hduaddrll(fptr, &headStart, &dataStart, &dataEnd, &status))
+        return false;
+
+    m_MappedFile.setFileName(file);
+    if(!m_MappedFile.open(QIODevice::ReadOnly))
+        return false;
+    // cfitsio transparently decompresses gzipped files into memory, those offsets don't point into the file on disk
+    if(m_MappedFile.read(6) != "SIMPLE" || m_MappedFile.size() < dataStart + m_ImageBufferSize)
+    {
+        m_MappedFile.close();
+        return false;
+    }
+
+    bool canMap = false;
+    switch(fitsBitPix)
+    {
+        case BYTE_IMG:
+        case FLOAT_IMG:
+        case DOUBLE_IMG:
+            canMap = (bzero == 0);
+            break;
+        case SHORT_IMG:
+            canMap = (bzero == 0 || bzero == 32768);
+            break;
+        case LONG_IMG:
+            canMap = (bzero == 0 || bzero == 2147483648.0);
+            break;
+        default:
+            break;
+    }
+    if(!canMap)
+    {
+        m_MappedFile.close();
+        return false;
+    }
+
+    uint8_t *data = m_MappedFile.map(dataStart, m_ImageBufferSize, QFileDevice::MapPrivateOption);
+    if(data == nullptr)
+    {
+        m_MappedFile.close();
+        return false;
+    }
+
+    size_t count = static_cast<size_t>(stats.samples_per_channel) * stats.channels;
+    switch(fitsBitPix)
+    {
+        case SHORT_IMG:
+            convertFromBigEndian(reinterpret_cast<uint16_t *>(data), count, static_cast<uint16_t>(bzero == 0 ? 0 : 0x8000), bzero == 0);
+            break;
+        case LONG_IMG:
+            convertFromBigEndian(reinterpret_cast<uint32_t *>(data), count, static_cast<uint32_t>(bzero == 0 ? 0 : 0x80000000), bzero == 0);
+            break;
+        case FLOAT_IMG:
+            convertFromBigEndian(reinterpret_cast<uint32_t *>(data), count, uint32_t(0), false);
+            break;
+        case DOUBLE_IMG:
+            convertFromBigEndian(reinterpret_cast<uint64_t *>(data), count, uint64_t(0), false);
+            break;
+        default:
+            break;
+    }
+
+    m_ImageBuffer = data;
+    m_ImageBufferMapped = true;
+    return true;
+}
+
 bool fileio::loadImage(QString fileName)
 {
     justLoadBuffer = false;
@@ -57,8 +286,16 @@ bool fileio::loadImageBufferOnly(QString fileName)
 //This method was copied and pasted and modified from the method privateLoad in fitsdata in KStars
 //It loads a FITS file, reads the FITS Headers, and loads the data from the image
 bool fileio::loadFits(QString fileName)
-{   
+{
+    return loadFitsSubset(fileName, QRect(), 1);
+}
+
+//This loads just a region of the FITS image, keeping every stride-th row and column, with fits_read_subset.
+//For tile compressed images cfitsio only decompresses the tiles that overlap the region.
+bool fileio::loadFitsSubset(QString fileName, QRect region, int stride)
+{
     file = fileName;
+    m_BufferIsUnmodifiedFile = false;
     int status = 0, anynullptr = 0;
     long naxes[3];
 
@@ -144,50 +381,133 @@ bool fileio::loadFits(QString fileName)
         logIssue(QString("Image has invalid dimensions %1x%2").arg(naxes[0]).arg(naxes[1]));
     }
 
-    stats.width               = static_cast<uint16_t>(naxes[0]);
-    stats.height              = static_cast<uint16_t>(naxes[1]);
+    QRect fullFrame(0, 0, naxes[0], naxes[1]);
+    if (!region.isValid())
+        region = fullFrame;
+    region = region.intersected(fullFrame);
+    stride = qMax(1, stride);
+    if (region.isEmpty())
+    {
+        logIssue(QString("The requested region is outside of the %1x%2 image").arg(naxes[0]).arg(naxes[1]));
+        fits_close_file(fptr, &status);
+        return false;
+    }
+    m_SubsetRegion = region;
+    m_SubsetStride = stride;
+    m_SuperpixelSize = 1;
+    bool isSubset = (region != fullFrame || stride > 1);
+
+    stats.width               = static_cast<uint16_t>((region.width() - 1) / stride + 1);
+    stats.height              = static_cast<uint16_t>((region.height() - 1) / stride + 1);
     stats.channels            = static_cast<uint8_t>(naxes[2]);
     stats.samples_per_channel = stats.width * stats.height;
 
     m_ImageBufferSize = stats.samples_per_channel * stats.channels * static_cast<uint16_t>(stats.bytesPerPixel);
     deleteImageBuffer();
-    m_ImageBuffer = new uint8_t[m_ImageBufferSize];
-    if (m_ImageBuffer == nullptr)
+
+    if (isSubset)
     {
-        logIssue(QString("FITSData: Not enough memory for image_buffer channel. Requested: %1 bytes ").arg(m_ImageBufferSize));
-        fits_close_file(fptr, &status);
-        return false;
+        m_ImageBuffer = new uint8_t[m_ImageBufferSize];
+        long firstPixel[3] = { region.left() + 1, region.top() + 1, 1 };
+        long lastPixel[3] = { region.right() + 1, region.bottom() + 1, naxes[2] };
+        long increment[3] = { stride, stride, 1 };
+        if (fits_read_subset(fptr, static_cast<uint16_t>(stats.dataType), firstPixel, lastPixel, increment, nullptr, m_ImageBuffer, &anynullptr, &status))
+        {
+            logIssue("Error reading image region.");
+            fits_close_file(fptr, &status);
+            return false;
+        }
     }
+    else if (!useMemoryMap || !mapFitsData(fitsBitPix))
+    {
+        m_ImageBuffer = new uint8_t[m_ImageBufferSize];
+        if (m_ImageBuffer == nullptr)
+        {
+            logIssue(QString("FITSData: Not enough memory for image_buffer channel. Requested: %1 bytes ").arg(m_ImageBufferSize));
+            fits_close_file(fptr, &status);
+            return false;
+        }
 
-    long nelements = stats.samples_per_channel * stats.channels;
+        long nelements = stats.samples_per_channel * stats.channels;
 
-    if (fits_read_img(fptr, static_cast<uint16_t>(stats.dataType), 1, nelements, nullptr, m_ImageBuffer, &anynullptr, &status))
-    {
-        logIssue("Error reading image.");
-        fits_close_file(fptr, &status);
-        return false;
+        if (fits_read_img(fptr, static_cast<uint16_t>(stats.dataType), 1, nelements, nullptr, m_ImageBuffer, &anynullptr, &status))
+        {
+            logIssue("Error reading image.");
+            fits_close_file(fptr, &status);
+            return false;
+        }
     }
 
+    bool bayerConverted = false;
     if( !justLoadBuffer )
     {
-        if(checkDebayer())
-            debayer();
+        // With an even stride every sample comes from the same filter color, so there is nothing to debayer
+        if(stride % 2 == 1 && checkDebayer())
+        {
+            bayerConverted = bayerConversion != BAYER_RAW;
+            // The pattern starts over at the corner of the region
+            debayerParams.offsetX = (debayerParams.offsetX + region.left()) % 2;
+            debayerParams.offsetY = (debayerParams.offsetY + region.top()) % 2;
+            if(bayerConversion == BAYER_LUMINANCE && !bayerLuminance())
+            {
+                logIssue("Error computing the luminance of the Bayer image.");
+                fits_close_file(fptr, &status);
+                return false;
+            }
+            else if(bayerConversion == BAYER_SUPERPIXEL)
+            {
+                if(!bayerSuperpixels())
+                {
+                    logIssue("Error making the superpixels of the Bayer image.");
+                    fits_close_file(fptr, &status);
+                    return false;
+                }
+                isSubset = true;
+            }
+            else if(bayerConversion == BAYER_DEBAYER)
+                debayer();
+        }
 
         getSolverOptionsFromFITS();
 
+        // The header describes the full frame, so the scale hints have to follow the region and stride
+        if(scale_given && isSubset)
+        {
+            if(scale_units == SSolver::ARCSEC_PER_PIX)
+            {
+                scale_low *= stride * m_SuperpixelSize;
+                scale_high *= stride * m_SuperpixelSize;
+            }
+            else
+            {
+                scale_low *= static_cast<double>(region.width()) / fullFrame.width();
+                scale_high *= static_cast<double>(region.width()) / fullFrame.width();
+            }
+        }
+
         parseHeader();
     }
 
     fits_close_file(fptr, &status);
 
+    m_BufferIsUnmodifiedFile = !isSubset && !bayerConverted;
     return true;
 }
 
+QPointF fileio::toFullFramePosition(const QPointF &position) const
+{
+    // A superpixel is centered between the pixels it was made of
+    const double offset = (m_SuperpixelSize - 1) / 2.0;
+    return QPointF(m_SubsetRegion.left() + (position.x() * m_SuperpixelSize + offset) * m_SubsetStride,
+                   m_SubsetRegion.top() + (position.y() * m_SuperpixelSize + offset) * m_SubsetStride);
+}
+
 //This method I wrote combining code from the fits loading method above, the fits debayering method below, and QT
 //I also consulted the ImageToFITS method in fitsdata in KStars
 //The goal of this method is to load the data from a file that is not FITS format
 bool fileio::loadOtherFormat(QString fileName)
 {
+    m_BufferIsUnmodifiedFile = false;
     file = fileName;
     QImageReader fileReader(file.toLocal8Bit());
     
@@ -214,6 +534,9 @@ bool fileio::loadOtherFormat(QString fileName)
 
     stats.width = static_cast<uint16_t>(imageFromFile.width());
     stats.height = static_cast<uint16_t>(imageFromFile.height());
+    m_SubsetRegion = QRect(0, 0, stats.width, stats.height);
+    m_SubsetStride = 1;
+    m_SuperpixelSize = 1;
     stats.channels = 3;
     stats.ndim = 3;
     stats.samples_per_channel = stats.width * stats.height;
@@ -337,9 +660,18 @@ bool fileio::debayer_8bit()
         dc1394_source++;
     }
 
-    error_code = dc1394_bayer_decoding_8bit(dc1394_source, bayer_destination_buffer, stats.width, ds1394_height,
-                                            debayerParams.filter,
-                                            debayerParams.method);
+    if (dc1394_bayer_decodes_rows(debayerParams.method))
+    {
+        error_code = decodeInBands(ds1394_height, [&](int first, int last)
+        {
+            return dc1394_bayer_decoding_8bit_rows(dc1394_source, bayer_destination_buffer, stats.width, ds1394_height,
+                                                   debayerParams.filter, debayerParams.method, first, last);
+        });
+    }
+    else
+        error_code = dc1394_bayer_decoding_8bit(dc1394_source, bayer_destination_buffer, stats.width, ds1394_height,
+                                                debayerParams.filter,
+                                                debayerParams.method);
 
     if (error_code != DC1394_SUCCESS)
     {
@@ -367,18 +699,7 @@ bool fileio::debayer_8bit()
     auto bayered_buffer = reinterpret_cast<uint8_t *>(m_ImageBuffer);
 
     // Data in R1G1B1, we need to copy them into 3 layers for FITS
-
-    uint8_t * rBuff = bayered_buffer;
-    uint8_t * gBuff = bayered_buffer + (stats.width * stats.height);
-    uint8_t * bBuff = bayered_buffer + (stats.width * stats.height * 2);
-
-    int imax = stats.samples_per_channel * 3 - 3;
-    for (int i = 0; i <= imax; i += 3)
-    {
-        *rBuff++ = bayer_destination_buffer[i];
-        *gBuff++ = bayer_destination_buffer[i + 1];
-        *bBuff++ = bayer_destination_buffer[i + 2];
-    }
+    splitChannels(bayer_destination_buffer, bayered_buffer, stats.width, stats.height);
 
     delete[] destinationBuffer;
     return true;
@@ -416,9 +737,18 @@ bool fileio::debayer_16bit()
         dc1394_source++;
     }
 
-    error_code = dc1394_bayer_decoding_16bit(dc1394_source, bayer_destination_buffer, stats.width, ds1394_height,
-                 debayerParams.filter,
-                 debayerParams.method, 16);
+    if (dc1394_bayer_decodes_rows(debayerParams.method))
+    {
+        error_code = decodeInBands(ds1394_height, [&](int first, int last)
+        {
+            return dc1394_bayer_decoding_16bit_rows(dc1394_source, bayer_destination_buffer, stats.width, ds1394_height,
+                                                    debayerParams.filter, debayerParams.method, 16, first, last);
+        });
+    }
+    else
+        error_code = dc1394_bayer_decoding_16bit(dc1394_source, bayer_destination_buffer, stats.width, ds1394_height,
+                     debayerParams.filter,
+                     debayerParams.method, 16);
 
     if (error_code != DC1394_SUCCESS)
     {
@@ -446,20 +776,82 @@ bool fileio::debayer_16bit()
     auto bayered_buffer = reinterpret_cast<uint16_t *>(m_ImageBuffer);
 
     // Data in R1G1B1, we need to copy them into 3 layers for FITS
+    splitChannels(bayer_destination_buffer, bayered_buffer, stats.width, stats.height);
 
-    uint16_t * rBuff = bayered_buffer;
-    uint16_t * gBuff = bayered_buffer + (stats.width * stats.height);
-    uint16_t * bBuff = bayered_buffer + (stats.width * stats.height * 2);
+    delete[] destinationBuffer;
+    return true;
+}
 
-    int imax = stats.samples_per_channel * 3 - 3;
-    for (int i = 0; i <= imax; i += 3)
+//This replaces the bayered image with its luminance, see bayerToLuminance.
+//It keeps the size and data type of the image, so it needs a quarter of the memory and a fraction of the time of debayer().
+bool fileio::bayerLuminance()
+{
+    uint8_t *luminanceBuffer = nullptr;
+    try
     {
-        *rBuff++ = bayer_destination_buffer[i];
-        *gBuff++ = bayer_destination_buffer[i + 1];
-        *bBuff++ = bayer_destination_buffer[i + 2];
+        luminanceBuffer = new uint8_t[m_ImageBufferSize];
+    }
+    catch (std::bad_alloc&)
+    {
+        logIssue("Unable to allocate memory for the luminance buffer.");
+        return false;
     }
 
-    delete[] destinationBuffer;
+    if(stats.dataType == SEP_TBYTE)
+        bayerToLuminance(m_ImageBuffer, luminanceBuffer, stats.width, stats.height);
+    else if(stats.dataType == TUSHORT)
+        bayerToLuminance(reinterpret_cast<uint16_t *>(m_ImageBuffer), reinterpret_cast<uint16_t *>(luminanceBuffer),
+                         stats.width, stats.height);
+    else
+    {
+        delete[] luminanceBuffer;
+        return false;
+    }
+
+    deleteImageBuffer();
+    m_ImageBuffer = luminanceBuffer;
+    return true;
+}
+
+//This replaces the bayered image with its 2x2 superpixels, see bayerToSuperpixels.
+//The image is halved in both directions, toFullFramePosition takes that into account.
+bool fileio::bayerSuperpixels()
+{
+    const int newWidth = stats.width / 2;
+    const int newHeight = stats.height / 2;
+    if(newWidth == 0 || newHeight == 0)
+        return false;
+
+    const uint32_t newSize = newWidth * newHeight * stats.bytesPerPixel;
+    uint8_t *superpixelBuffer = nullptr;
+    try
+    {
+        superpixelBuffer = new uint8_t[newSize];
+    }
+    catch (std::bad_alloc&)
+    {
+        logIssue("Unable to allocate memory for the superpixel buffer.");
+        return false;
+    }
+
+    if(stats.dataType == SEP_TBYTE)
+        bayerToSuperpixels(m_ImageBuffer, superpixelBuffer, stats.width, stats.height);
+    else if(stats.dataType == TUSHORT)
+        bayerToSuperpixels(reinterpret_cast<uint16_t *>(m_ImageBuffer), reinterpret_cast<uint16_t *>(superpixelBuffer),
+                           stats.width, stats.height);
+    else
+    {
+        delete[] superpixelBuffer;
+        return false;
+    }
+
+    deleteImageBuffer();
+    m_ImageBuffer = superpixelBuffer;
+    m_ImageBufferSize = newSize;
+    stats.width = newWidth;
+    stats.height = newHeight;
+    stats.samples_per_channel = newWidth * newHeight;
+    m_SuperpixelSize = 2;
     return true;
 }
 
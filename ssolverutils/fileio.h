@@ -6,6 +6,8 @@
 #include <QImageReader>
 #include <QFile>
 #include <QVariant>
+#include <QRect>
+#include <QPointF>
 
 //CFitsio Includes
 #include "fitsio.h"
@@ -42,11 +44,27 @@ public:
     bool loadImage(QString fileName);
     bool loadImageBufferOnly(QString fileName);
     bool loadFits(QString fileName);
+    /**
+     * @brief loadFitsSubset loads only a region of a FITS image, optionally keeping just every stride-th row and column
+     * @param fileName The FITS file to load
+     * @param region The region of the image to load in full frame pixels, an invalid QRect loads the whole frame
+     * @param stride Only every stride-th pixel of the region is kept in both directions, 1 keeps all of them
+     * @return Whether the region was loaded, the stats then describe the loaded subset
+     */
+    bool loadFitsSubset(QString fileName, QRect region, int stride = 1);
+    /**
+     * @brief toFullFramePosition converts a position in the loaded image, for instance of an extracted star, to the full frame
+     * @param position The position in the loaded subset
+     * @return The position in the full frame of the FITS file
+     */
+    QPointF toFullFramePosition(const QPointF &position) const;
     bool parseHeader();
     bool saveAsFITS(QString fileName, FITSImage::Statistic &imageStats, uint8_t *m_ImageBuffer, FITSImage::Solution solution, QList<Record> &records, bool hasSolution);
     bool loadOtherFormat(QString fileName);
     bool checkDebayer();
     bool debayer();
+    bool bayerLuminance();
+    bool bayerSuperpixels();
     bool debayer_8bit();
     bool debayer_16bit();
     bool getSolverOptionsFromFITS();
@@ -60,9 +78,35 @@ public:
     double scale_high;
     SSolver::ScaleUnits scale_units;
 
+    /// How a FITS image with a Bayer pattern is converted when it is loaded
+    typedef enum
+    {
+        BAYER_DEBAYER,      ///< Debayered to three channels with debayerParams
+        BAYER_LUMINANCE,    ///< Luminance of each pixel from its 3x3 neighborhood, one channel of the same size
+        BAYER_SUPERPIXEL,   ///< Luminance of each 2x2 block, one channel of half the width and height
+        BAYER_RAW           ///< Left as it is
+    } BayerConversion;
+    BayerConversion bayerConversion = BAYER_DEBAYER;
+
     bool imageBufferTaken = false;
     uint8_t *getImageBuffer();
 
+    /// When set, the data unit of uncompressed FITS files is memory mapped instead of read into a new buffer.
+    /// A mapped buffer is always owned by this fileio, even after getImageBuffer(), so it must outlive every use of the buffer.
+    bool useMemoryMap = false;
+    bool imageBufferIsMapped() const
+    {
+        return m_ImageBufferMapped;
+    }
+
+    /// Whether the image buffer holds the pixels of the loaded FITS file exactly as they are in the file, that is the whole
+    /// frame without any Bayer conversion, so that programs may read the file instead of the buffer (see StellarSolver's
+    /// FileToProcessIsUnmodified property)
+    bool bufferIsUnmodifiedFile() const
+    {
+        return m_BufferIsUnmodifiedFile;
+    }
+
     FITSImage::Statistic getStats(){
         return stats;
     }
@@ -94,6 +138,17 @@ private:
     uint8_t *m_ImageBuffer { nullptr };
     /// Above buffer size in bytes
     uint32_t m_ImageBufferSize { 0 };
+    /// Whether the buffer points into m_MappedFile instead of being allocated with new[]
+    bool m_ImageBufferMapped { false };
+    /// Region and stride of the full frame held in the buffer, see loadFitsSubset
+    QRect m_SubsetRegion;
+    int m_SubsetStride { 1 };
+    /// Size of the superpixels made by bayerSuperpixels, 1 when the pixels are not combined
+    int m_SuperpixelSize { 1 };
+    /// See bufferIsUnmodifiedFile
+    bool m_BufferIsUnmodifiedFile { false };
+    QFile m_MappedFile;
+    bool mapFitsData(int fitsBitPix);
     bool justLoadBuffer = false;
     StretchParams stretchParams;
     BayerParams debayerParams;
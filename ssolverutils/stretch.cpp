@@ -11,6 +11,8 @@
 
 //System Includes
 #include <math.h>
+#include <limits>
+#include <type_traits>
 
 //CFITSIO Includes
 #include <fitsio.h>
@@ -23,16 +25,6 @@
 
 namespace {
 
-// Returns the median value of the vector.
-// The vector is modified in an undefined way.
-template <typename T>
-T median(std::vector<T>& values)
-{
-  const int middle = values.size() / 2;
-  std::nth_element(values.begin(), values.begin() + middle, values.end());
-  return values[middle];
-}
-
 // Returns the rough max of the buffer.
 template <typename T>
 T sampledMax(T *values, int size, int sampleBy)
@@ -44,23 +36,228 @@ T sampledMax(T *values, int size, int sampleBy)
     return  maxVal;
 }
 
-// Returns the median of the sample values.
-// The values are not modified.
+// Splits count items into slices of at least minSliceSize items for the threads of the global pool
+// and runs work(slice, begin, end) for each of them. Blocks until done.
+template <typename Work>
+void runSlices(int count, int minSliceSize, Work work)
+{
+  const int numSlices = std::max(1, std::min(QThread::idealThreadCount(), count / minSliceSize));
+  QVector<QFuture<void>> futures;
+  for (int slice = 0; slice < numSlices; slice++)
+  {
+    const int begin = static_cast<int64_t>(count) * slice / numSlices;
+    const int end = static_cast<int64_t>(count) * (slice + 1) / numSlices;
+    futures.append(QtConcurrent::run([ = ]()
+    {
+      work(slice, begin, end);
+    }));
+  }
+  for(QFuture<void> future : futures)
+    future.waitForFinished();
+}
+
+// Returns the index of the bin holding the value with the given rank in the sorted values,
+// and the number of values in the bins before it.
+int binOfRank(const std::vector<uint32_t> &counts, uint32_t rank, uint32_t *before)
+{
+  uint32_t cumulative = 0;
+  for (size_t bin = 0; bin < counts.size(); bin++)
+  {
+    if (cumulative + counts[bin] > rank)
+    {
+      *before = cumulative;
+      return bin;
+    }
+    cumulative += counts[bin];
+  }
+  *before = cumulative;
+  return counts.size() - 1;
+}
+
+// Exact median and median deviation for 8 and 16 bit data.
+// Every value has its own bin, so one pass over all the pixels gives both, without copying the data.
+// Each thread counts a slice of the buffer in its own bins, which are summed at the end.
 template <typename T>
-T median(T *values, int size, int sampleBy)
+void histogramMedians(const T *buffer, int size, float *median, float *medianDeviation)
 {
-  const int downsampled_size = size / sampleBy;
-  std::vector<T> samples(downsampled_size);
-  for (int index = 0, i = 0; i < downsampled_size; ++i, index += sampleBy)
-    samples[i] = values[index];
-  return median(samples);
+  constexpr int offset = -static_cast<int>(std::numeric_limits<T>::min());
+  constexpr int numBins = 1 << (8 * sizeof(T));
+
+  std::vector<std::vector<uint32_t>> sliceCounts(QThread::idealThreadCount() + 1);
+  runSlices(size, 64 * 1024, [&](int slice, int begin, int end)
+  {
+    std::vector<uint32_t> &counts = sliceCounts[slice];
+    counts.assign(numBins, 0);
+    for (int i = begin; i < end; i++)
+      counts[buffer[i] + offset]++;
+  });
+  std::vector<uint32_t> counts(numBins, 0);
+  for (const auto &slice : sliceCounts)
+    for (size_t bin = 0; bin < slice.size(); bin++)
+      counts[bin] += slice[bin];
+
+  // The value in the middle of the sorted values, at index size / 2.
+  const uint32_t middle = size / 2;
+  uint32_t before;
+  const int medianBin = binOfRank(counts, middle, &before);
+
+  // The deviation |value - median| of the values in bins medianBin - d and medianBin + d is d.
+  std::vector<uint32_t> deviations(numBins, 0);
+  deviations[0] = counts[medianBin];
+  for (int d = 1; d < numBins; d++)
+  {
+    if (medianBin - d >= 0)
+      deviations[d] += counts[medianBin - d];
+    if (medianBin + d < numBins)
+      deviations[d] += counts[medianBin + d];
+  }
+
+  *median = medianBin - offset;
+  *medianDeviation = binOfRank(deviations, middle, &before);
 }
 
-// This stretches one channel given the input parameters.
+// Approximate median and median deviation for 32 and 64 bit data, where a bin per value is not possible.
+// Every sampleBy-th value is counted in a histogram spanning the sampled range, in parallel as above,
+// and the median is interpolated inside its bin. The deviations are counted the same way in a second pass.
+template <typename T>
+void sampledHistogramMedians(const T *buffer, int size, int sampleBy, float *median, float *medianDeviation)
+{
+  constexpr int numBins = 64 * 1024;
+  const int numSamples = size / sampleBy;
+  const int numSlices = QThread::idealThreadCount() + 1;
+
+  // Range of the sampled values. Not a number and infinite values are left out.
+  std::vector<double> sliceMin(numSlices, std::numeric_limits<double>::max());
+  std::vector<double> sliceMax(numSlices, std::numeric_limits<double>::lowest());
+  runSlices(numSamples, 64 * 1024, [&](int slice, int begin, int end)
+  {
+    double minValue = sliceMin[slice], maxValue = sliceMax[slice];
+    for (int i = begin; i < end; i++)
+    {
+      const double value = buffer[static_cast<int64_t>(i) * sampleBy];
+      if (!std::isfinite(value))
+        continue;
+      minValue = std::min(minValue, value);
+      maxValue = std::max(maxValue, value);
+    }
+    sliceMin[slice] = minValue;
+    sliceMax[slice] = maxValue;
+  });
+  const double minValue = *std::min_element(sliceMin.begin(), sliceMin.end());
+  const double maxValue = *std::max_element(sliceMax.begin(), sliceMax.end());
+  if (minValue >= maxValue)
+  {
+    *median = minValue <= maxValue ? minValue : 0;
+    *medianDeviation = 0;
+    return;
+  }
+
+  // Counts f(sample) for the samples into numBins bins covering [0, range] and returns the value with the middle rank.
+  auto histogramMedian = [&](double range, auto f) -> double
+  {
+    const double binsPerUnit = numBins / range;
+    std::vector<std::vector<uint32_t>> sliceCounts(numSlices);
+    runSlices(numSamples, 64 * 1024, [&](int slice, int begin, int end)
+    {
+      std::vector<uint32_t> &counts = sliceCounts[slice];
+      counts.assign(numBins, 0);
+      for (int i = begin; i < end; i++)
+      {
+        const double value = buffer[static_cast<int64_t>(i) * sampleBy];
+        if (!std::isfinite(value))
+          continue;
+        counts[std::min(numBins - 1, static_cast<int>(f(value) * binsPerUnit))]++;
+      }
+    });
+    std::vector<uint32_t> counts(numBins, 0);
+    for (const auto &slice : sliceCounts)
+      for (size_t bin = 0; bin < slice.size(); bin++)
+        counts[bin] += slice[bin];
+    uint32_t total = 0;
+    for (uint32_t count : counts)
+      total += count;
+
+    uint32_t before;
+    const int bin = binOfRank(counts, total / 2, &before);
+    const double fraction = (total / 2 - before + 0.5) / std::max(1u, counts[bin]);
+    return (bin + fraction) / binsPerUnit;
+  };
+
+  const double medianValue = minValue + histogramMedian(maxValue - minValue, [&](double value)
+  {
+    return value - minValue;
+  });
+  const double maxDeviation = std::max(medianValue - minValue, maxValue - medianValue);
+  *median = medianValue;
+  *medianDeviation = maxDeviation > 0 ? histogramMedian(maxDeviation, [&](double value)
+  {
+    return std::fabs(value - medianValue);
+  }) : 0;
+}
+
+// This stretches the samples of one channel given the input parameters.
 // Based on the spec in section 8.5.6
 // https://pixinsight.com/doc/docs/XISF-1.0-spec/XISF-1.0-spec.html
-// Uses multiple threads, blocks until done.
 // The extension parameters are not used.
+// For 8 and 16 bit integers, every possible input is stretched once up front into a lookup table,
+// so stretching a sample is a table lookup instead of a float divide, with the same result.
+template <typename T>
+class ChannelStretch
+{
+  public:
+    ChannelStretch(const StretchParams1Channel &params, int inputRange)
+    {
+      // Maximum possible input value (e.g. 1024*64 - 1 for a 16 bit unsigned int).
+      const float maxInput = inputRange > 1 ? inputRange - 1 : inputRange;
+
+      midtones = params.midtones;
+      // Precomputed expressions moved out of the loop.
+      // hightlights - shadows, protecting for divide-by-0, in a 0->1.0 scale.
+      const float hsRangeFactor = params.highlights == params.shadows ? 1.0f : 1.0f / (params.highlights - params.shadows);
+      // Shadow and highlight values translated to the ADU scale.
+      nativeShadows = params.shadows * maxInput;
+      nativeHighlights = params.highlights * maxInput;
+      // Constants based on above needed for the stretch calculations.
+      k1 = (midtones - 1) * hsRangeFactor * maxOutput / maxInput;
+      k2 = ((2 * midtones) - 1) * hsRangeFactor / maxInput;
+
+      if constexpr (useLookupTable)
+      {
+        lookupTable.resize(1 << (8 * sizeof(T)));
+        for (size_t i = 0; i < lookupTable.size(); i++)
+          lookupTable[i] = compute(static_cast<T>(static_cast<int>(i) - offset));
+      }
+    }
+
+    uint8_t operator()(T input) const
+    {
+      if constexpr (useLookupTable)
+        return lookupTable[input + offset];
+      else
+        return compute(input);
+    }
+
+  private:
+    static constexpr bool useLookupTable = std::is_integral<T>::value && sizeof(T) <= 2;
+    static constexpr int offset = useLookupTable ? -static_cast<int>(std::numeric_limits<T>::min()) : 0;
+    // We're outputting uint8, so the max output is 255.
+    static constexpr int maxOutput = 255;
+
+    uint8_t compute(T input) const
+    {
+      if (input < nativeShadows) return 0;
+      else if (input >= nativeHighlights) return maxOutput;
+      const T inputFloored = (input - nativeShadows);
+      return (inputFloored * k1) / (inputFloored * k2 - midtones);
+    }
+
+    T nativeShadows, nativeHighlights;
+    float k1, k2, midtones;
+    std::vector<uint8_t> lookupTable;
+};
+
+// This stretches one channel given the input parameters.
+// Uses multiple threads, each one stretching a band of output rows, blocks until done.
 // Sampling is applied to the output (that is, with sampling=2, we compute every other output
 // sample both in width and height, so the output would have about 4X fewer pixels.
 template <typename T>
@@ -68,57 +265,34 @@ void stretchOneChannel(T *input_buffer, QImage *output_image,
                        const StretchParams& stretch_params, 
                        int input_range, int image_height, int image_width, int sampling)
 {
-  QVector<QFuture<void>> futures;
+  const ChannelStretch<T> stretch(stretch_params.grey_red, input_range);
+  const int output_height = (image_height + sampling - 1) / sampling;
 
-  // We're outputting uint8, so the max output is 255.
-  constexpr int maxOutput = 255;
-
-  // Maximum possible input value (e.g. 1024*64 - 1 for a 16 bit unsigned int).
-  const float maxInput = input_range > 1 ? input_range - 1 : input_range;
-  
-  const float midtones   = stretch_params.grey_red.midtones;
-  const float highlights = stretch_params.grey_red.highlights;
-  const float shadows    = stretch_params.grey_red.shadows;
-
-  // Precomputed expressions moved out of the loop.
-  // hightlights - shadows, protecting for divide-by-0, in a 0->1.0 scale.
-  const float hsRangeFactor = highlights == shadows ? 1.0f : 1.0f / (highlights - shadows);
-  // Shadow and highlight values translated to the ADU scale.
-  const T nativeShadows = shadows * maxInput;
-  const T nativeHighlights = highlights * maxInput;
-  // Constants based on above needed for the stretch calculations.
-  const float k1 = (midtones - 1) * hsRangeFactor * maxOutput / maxInput;
-  const float k2 = ((2 * midtones) - 1) * hsRangeFactor / maxInput;
-  
-  // Increment the input index by the sampling, the output index increments by 1.
-  for (int j = 0, jout = 0; j < image_height; j+=sampling, jout++)
+  runSlices(output_height, 16, [&](int, int begin, int end)
   {
-    futures.append(QtConcurrent::run([ = ]()
+    for (int jout = begin; jout < end; jout++)
     {
-        T * inputLine  = input_buffer + j * image_width;
-        auto * scanLine = output_image->scanLine(jout);
-        
-    for (int i = 0, iout = 0; i < image_width; i+=sampling, iout++)
-        {
-          const T input = inputLine[i];
-          if (input < nativeShadows) scanLine[iout] = 0;
-          else if (input >= nativeHighlights) scanLine[iout] = maxOutput;
-          else 
-          {
-            const T inputFloored = (input - nativeShadows);
-            scanLine[iout] = (inputFloored * k1) / (inputFloored * k2 - midtones);
-	  }
-        }
-    }));
-  }
-  for(QFuture<void> future : futures)
-    future.waitForFinished();
+      // Increment the input index by the sampling, the output index increments by 1.
+      const T * inputLine  = input_buffer + static_cast<size_t>(jout) * sampling * image_width;
+      auto * scanLine = output_image->scanLine(jout);
+
+      if (sampling == 1)
+      {
+        for (int i = 0; i < image_width; i++)
+          scanLine[i] = stretch(inputLine[i]);
+      }
+      else
+      {
+        for (int i = 0, iout = 0; i < image_width; i+=sampling, iout++)
+          scanLine[iout] = stretch(inputLine[i]);
+      }
+    }
+  });
 }
 
 // This is like the above 1-channel stretch, but extended for 3 channels.
-// This could have been more modular, but the three channels are combined
-// into a single qRgb value at the end, so it seems the simplest thing is to
-// replicate the code. It is assume the colors are not interleaved--the red image
+// The three channels are combined into a single qRgb value at the end.
+// It is assume the colors are not interleaved--the red image
 // is stored fully, then the green, then the blue.
 // Sampling is applied to the output (that is, with sampling=2, we compute every other output
 // sample both in width and height, so the output would have about 4X fewer pixels.
@@ -127,94 +301,27 @@ void stretchThreeChannels(T *inputBuffer, QImage *outputImage,
                           const StretchParams& stretchParams, 
                           int inputRange, int imageHeight, int imageWidth, int sampling)
 {
-  QVector<QFuture<void>> futures;
-
-  // We're outputting uint8, so the max output is 255.
-  constexpr int maxOutput = 255;
+  const ChannelStretch<T> stretchR(stretchParams.grey_red, inputRange);
+  const ChannelStretch<T> stretchG(stretchParams.green, inputRange);
+  const ChannelStretch<T> stretchB(stretchParams.blue, inputRange);
+  const size_t size = static_cast<size_t>(imageWidth) * imageHeight;
+  const int outputHeight = (imageHeight + sampling - 1) / sampling;
 
-  // Maximum possible input value (e.g. 1024*64 - 1 for a 16 bit unsigned int).
-  const float maxInput = inputRange > 1 ? inputRange - 1 : inputRange;
-  
-  const float midtonesR   = stretchParams.grey_red.midtones;
-  const float highlightsR = stretchParams.grey_red.highlights;
-  const float shadowsR    = stretchParams.grey_red.shadows;
-  const float midtonesG   = stretchParams.green.midtones;
-  const float highlightsG = stretchParams.green.highlights;
-  const float shadowsG    = stretchParams.green.shadows;
-  const float midtonesB   = stretchParams.blue.midtones;
-  const float highlightsB = stretchParams.blue.highlights;
-  const float shadowsB    = stretchParams.blue.shadows;
-
-  // Precomputed expressions moved out of the loop.
-  // hightlights - shadows, protecting for divide-by-0, in a 0->1.0 scale.
-  const float hsRangeFactorR = highlightsR == shadowsR ? 1.0f : 1.0f / (highlightsR - shadowsR);
-  const float hsRangeFactorG = highlightsG == shadowsG ? 1.0f : 1.0f / (highlightsG - shadowsG);
-  const float hsRangeFactorB = highlightsB == shadowsB ? 1.0f : 1.0f / (highlightsB - shadowsB);
-  // Shadow and highlight values translated to the ADU scale.
-  const T nativeShadowsR = shadowsR * maxInput;
-  const T nativeShadowsG = shadowsG * maxInput;
-  const T nativeShadowsB = shadowsB * maxInput;
-  const T nativeHighlightsR = highlightsR * maxInput;
-  const T nativeHighlightsG = highlightsG * maxInput;
-  const T nativeHighlightsB = highlightsB * maxInput;
-  // Constants based on above needed for the stretch calculations.
-  const float k1R = (midtonesR - 1) * hsRangeFactorR * maxOutput / maxInput;
-  const float k1G = (midtonesG - 1) * hsRangeFactorG * maxOutput / maxInput;
-  const float k1B = (midtonesB - 1) * hsRangeFactorB * maxOutput / maxInput;
-  const float k2R = ((2 * midtonesR) - 1) * hsRangeFactorR / maxInput;
-  const float k2G = ((2 * midtonesG) - 1) * hsRangeFactorG / maxInput;
-  const float k2B = ((2 * midtonesB) - 1) * hsRangeFactorB / maxInput;
-  
-  const int size = imageWidth * imageHeight;
-  
-  for (int j = 0, jout = 0; j < imageHeight; j+=sampling, jout++)
+  runSlices(outputHeight, 16, [&](int, int begin, int end)
   {
-    futures.append(QtConcurrent::run([ = ]()
+    for (int jout = begin; jout < end; jout++)
     {
-        // R, G, B input images are stored one after another.
-        T * inputLineR  = inputBuffer + j * imageWidth;
-        T * inputLineG  = inputLineR + size;
-        T * inputLineB  = inputLineG + size;
-        
-        auto * scanLine = reinterpret_cast<QRgb*>(outputImage->scanLine(jout));
-        
-    for (int i = 0, iout = 0; i < imageWidth; i+=sampling, iout++)
-        {
-          const T inputR = inputLineR[i];
-          const T inputG = inputLineG[i];
-          const T inputB = inputLineB[i];
-
-          uint8_t red, green, blue;
-          
-          if (inputR < nativeShadowsR) red = 0;
-          else if (inputR >= nativeHighlightsR) red = maxOutput;
-          else 
-          {
-            const T inputFloored = (inputR - nativeShadowsR);
-            red = (inputFloored * k1R) / (inputFloored * k2R - midtonesR);
-	  }
-
-          if (inputG < nativeShadowsG) green = 0;
-          else if (inputG >= nativeHighlightsG) green = maxOutput;
-          else 
-          {
-            const T inputFloored = (inputG - nativeShadowsG);
-            green = (inputFloored * k1G) / (inputFloored * k2G - midtonesG);
-	  }
-
-          if (inputB < nativeShadowsB) blue = 0;
-          else if (inputB >= nativeHighlightsB) blue = maxOutput;
-          else 
-          {
-            const T inputFloored = (inputB - nativeShadowsB);
-            blue = (inputFloored * k1B) / (inputFloored * k2B - midtonesB);
-	  }
-          scanLine[iout] = qRgb(red, green, blue);
-        }
-    }));
-  }
-  for(QFuture<void> future : futures)
-    future.waitForFinished();
+      // R, G, B input images are stored one after another.
+      const T * inputLineR  = inputBuffer + static_cast<size_t>(jout) * sampling * imageWidth;
+      const T * inputLineG  = inputLineR + size;
+      const T * inputLineB  = inputLineG + size;
+
+      auto * scanLine = reinterpret_cast<QRgb*>(outputImage->scanLine(jout));
+
+      for (int i = 0, iout = 0; i < imageWidth; i+=sampling, iout++)
+        scanLine[iout] = qRgb(stretchR(inputLineR[i]), stretchG(inputLineG[i]), stretchB(inputLineB[i]));
+    }
+  });
 }
 
 template <typename T>
@@ -235,24 +342,18 @@ template <typename T>
 void computeParamsOneChannel(T *buffer, StretchParams1Channel *params, 
                              int inputRange, int height, int width)
 {
-  // Find the median sample.
+  // Find the median sample and the Median deviation: 1.4826 * median of abs(sample[i] - median).
+  // 8 and 16 bit data is counted exactly, the wider types are sampled.
   constexpr int maxSamples = 500000;
   const int sampleBy = width * height < maxSamples ? 1 : width * height / maxSamples;
 
-  T medianSample = median(buffer, width * height, sampleBy);
-  // Find the Median deviation: 1.4826 * median of abs(sample[i] - median).
-  const int numSamples = width * height / sampleBy;
-  std::vector<T> deviations(numSamples);
-  for (int index = 0, i = 0; i < numSamples; ++i, index += sampleBy)
-  {
-    if (medianSample > buffer[index])
-      deviations[i] = medianSample - buffer[index];
-    else
-      deviations[i] = buffer[index] - medianSample;
-  }
+  float medianSample, medDev;
+  if constexpr (std::is_integral<T>::value && sizeof(T) <= 2)
+    histogramMedians(buffer, width * height, &medianSample, &medDev);
+  else
+    sampledHistogramMedians(buffer, width * height, sampleBy, &medianSample, &medDev);
 
   // Shift everything to 0 -> 1.0.
-  const float medDev = median(deviations);
   const float normalizedMedian = medianSample / static_cast<float>(inputRange);
   const float MADN = 1.4826 * medDev / static_cast<float>(inputRange);
 
@@ -15,8 +15,13 @@
 #include <ctype.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #ifndef _WIN32 //# Modified by Robert Lancaster for the StellarSolver Internal Library
 #include <sys/wait.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#define getpid _getpid
 #endif
 #ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
 #include <windirent.h>
@@ -43,6 +48,7 @@
 #include "anqfits.h"
 #include "errors.h"
 #include "engine.h"
+#include "ssindex.h"
 #include "tic.h"
 #include "healpix.h"
 #include "sip-utils.h"
@@ -75,6 +81,112 @@ char* engine_find_index(engine_t* engine, const char* name) {
     return NULL;
 }
 
+// Each index directory keeps a manifest with the metadata of the files in it,
+// so that auto-indexing a directory that has not changed reads that one file
+// instead of opening every index.  Each line is
+//   "<size> <mtime> <metadata>\t<file name>"
+// where the metadata is that of index_get_meta_string(), or "-" for a file
+// that is not a usable index.  A line is only trusted while the size and
+// modification time (to the nanosecond where the system has it) of its file
+// still match.
+#define INDEX_MANIFEST_FILENAME ".astrometry-index-manifest"
+#define INDEX_MANIFEST_HEADER "# astrometry index manifest 2"
+
+// "<size> <seconds>.<nanoseconds>" of a file, so that one rewritten within
+// the same second is still seen as modified.
+static char* index_file_stamp(const char* path, const struct stat* st) {
+    char* stamp;
+    long long sec = (long long)st->st_mtime;
+    long nsec = 0;
+#if defined(_MSC_VER)
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (GetFileAttributesExA(path, GetFileExInfoStandard, &attr)) {
+        // 100 ns ticks since 1601
+        unsigned long long ticks = ((unsigned long long)attr.ftLastWriteTime.dwHighDateTime << 32) |
+            attr.ftLastWriteTime.dwLowDateTime;
+        nsec = (long)(ticks % 10000000ULL) * 100;
+    }
+#elif defined(__APPLE__)
+    nsec = st->st_mtimespec.tv_nsec;
+#elif defined(st_mtime)
+    // st_mtime is a macro for st_mtim.tv_sec where the system has st_mtim.
+    nsec = st->st_mtim.tv_nsec;
+#endif
+    (void)path;
+    asprintf_safe(&stamp, "%lld %lld.%09ld", (long long)st->st_size, sec, nsec);
+    return stamp;
+}
+
+static void read_index_manifest(const char* fn, sl* names, sl* stamps, sl* metas) {
+    sl* lines;
+    int i;
+    if (!file_exists(fn))
+        return;
+    lines = file_get_lines(fn, FALSE);
+    if (!lines)
+        return;
+    if (!sl_size(lines) || !streq(sl_get(lines, 0), INDEX_MANIFEST_HEADER)) {
+        logverb("Ignoring index manifest \"%s\" with an unknown header.\n", fn);
+        sl_free2(lines);
+        return;
+    }
+    for (i=1; i<sl_size(lines); i++) {
+        char* line = sl_get(lines, i);
+        char* name = strchr(line, '\t');
+        char* meta;
+        if (!name)
+            continue;
+        *name = '\0';
+        name++;
+        // split "<size> <mtime>" from the metadata
+        meta = strchr(line, ' ');
+        if (meta)
+            meta = strchr(meta + 1, ' ');
+        if (!meta)
+            continue;
+        *meta = '\0';
+        meta++;
+        sl_append(names, name);
+        sl_append(stamps, line);
+        sl_append(metas, meta);
+    }
+    sl_free2(lines);
+}
+
+static void write_index_manifest(const char* fn, sl* names, sl* stamps, sl* metas) {
+    char* tempfn;
+    FILE* fid;
+    int i;
+    anbool ok;
+    // Other solvers may be auto-indexing the same directory, so write to a
+    // file of our own and rename it over the manifest.
+    asprintf_safe(&tempfn, "%s.%lu.%p.tmp", fn, (unsigned long)getpid(), (void*)names);
+    fid = fopen(tempfn, "w");
+    if (!fid) {
+        logverb("Not caching the index metadata, could not write \"%s\".\n", tempfn);
+        free(tempfn);
+        return;
+    }
+    ok = (fprintf(fid, "%s\n", INDEX_MANIFEST_HEADER) > 0);
+    for (i=0; ok && i<sl_size(names); i++)
+        ok = (fprintf(fid, "%s %s\t%s\n", sl_get(stamps, i), sl_get(metas, i),
+                      sl_get(names, i)) > 0);
+    if (fclose(fid))
+        ok = FALSE;
+#ifdef _WIN32
+    // rename() does not replace an existing file on Windows.
+    if (ok)
+        remove(fn);
+#endif
+    if (!ok || rename(tempfn, fn)) {
+        logverb("Failed to write the index manifest \"%s\".\n", fn);
+        remove(tempfn);
+    }
+    free(tempfn);
+}
+
+static index_t* add_index_path(engine_t* engine, char* path, const char* meta);
+
 int engine_autoindex_search_paths(engine_t* engine) {
     int i;
     // Search the paths specified and add any indexes that are found.
@@ -82,17 +194,35 @@ int engine_autoindex_search_paths(engine_t* engine) {
         char* path = sl_get(engine->index_paths, i);
         DIR* dir = opendir(path);
         sl* tryinds;
+        // The manifest as it was read, and as it is after this scan.
+        sl *oldnames, *oldstamps, *oldmetas;
+        sl *names, *stamps, *metas;
+        char* manifestfn;
+        anbool changed = FALSE;
+        size_t dirlen = strlen(path);
         int j;
         if (!dir) {
             SYSERROR("Warning: failed to open index directory: \"%s\"\n", path);
             continue;
         }
         logverb("Auto-indexing directory \"%s\" ...\n", path);
+        asprintf_safe(&manifestfn, "%s/%s", path, INDEX_MANIFEST_FILENAME);
+        oldnames = sl_new(16);
+        oldstamps = sl_new(16);
+        oldmetas = sl_new(16);
+        names = sl_new(16);
+        stamps = sl_new(16);
+        metas = sl_new(16);
+        read_index_manifest(manifestfn, oldnames, oldstamps, oldmetas);
+
         tryinds = sl_new(16);
         while (1) {
             struct dirent* de;
+            struct stat st;
             char* name;
             char* fullpath;
+            char* stamp;
+            ptrdiff_t k;
             //char* err; //# Modified by Robert Lancaster for the StellarSolver Internal Library, this is not used
             anbool ok;
             errno = 0;
@@ -103,17 +233,36 @@ int engine_autoindex_search_paths(engine_t* engine) {
                 break;
             }
             name = de->d_name;
+            if (streq(name, INDEX_MANIFEST_FILENAME))
+                continue;
             asprintf_safe(&fullpath, "%s/%s", path, name);
-            if (path_is_dir(fullpath)) {
+            if (stat(fullpath, &st)) {
+                SYSERROR("Couldn't stat path %s", fullpath);
+                free(fullpath);
+                continue;
+            }
+            if (S_ISDIR(st.st_mode)) {
                 logverb("Skipping directory %s\n", fullpath);
                 free(fullpath);
                 continue;
             }
 
-            logverb("Checking file \"%s\"\n", fullpath);
-            //errors_start_logging_to_string();
-            ok = index_is_file_index(fullpath);
-            //err = errors_stop_logging_to_string(": ");
+            stamp = index_file_stamp(fullpath, &st);
+            k = sl_index_of(oldnames, name);
+            sl_append(names, name);
+            sl_append_nocopy(stamps, stamp);
+            if (k != BL_NOT_FOUND && streq(sl_get(oldstamps, k), stamp)) {
+                sl_append(metas, sl_get(oldmetas, k));
+                ok = !streq(sl_get(oldmetas, k), "-");
+            } else {
+                logverb("Checking file \"%s\"\n", fullpath);
+                //errors_start_logging_to_string();
+                ok = index_is_file_index(fullpath);
+                //err = errors_stop_logging_to_string(": ");
+                // The metadata of a new index is filled in once it is loaded below.
+                sl_append(metas, ok ? "" : "-");
+                changed = TRUE;
+            }
             if (!ok) {
                 logverb("File is not an index: %s\n", fullpath);
                 //free(err);
@@ -125,15 +274,61 @@ int engine_autoindex_search_paths(engine_t* engine) {
             sl_insert_sorted_nocopy(tryinds, fullpath);
         }
         closedir(dir);
+        // Entries of files that are gone.
+        if (sl_size(names) != sl_size(oldnames))
+            changed = TRUE;
+
+        // A FITS index that was converted to a native index next to it is
+        // only used through the native one.
+        for (j=sl_size(tryinds)-1; j>=0; j--) {
+            char* path = sl_get(tryinds, j);
+            char* native;
+            int extlen;
+            if (ends_with(path, ".fits"))
+                extlen = 5;
+            else if (ends_with(path, ".fit"))
+                extlen = 4;
+            else
+                continue;
+            asprintf_safe(&native, "%.*s%s", (int)(strlen(path) - extlen), path, SSINDEX_SUFFIX);
+            if (sl_index_of(tryinds, native) != BL_NOT_FOUND) {
+                logverb("Using native index \"%s\" instead of \"%s\".\n", native, path);
+                free(path);
+                sl_remove(tryinds, j);
+            }
+            free(native);
+        }
 
         // add them in reverse order... (why?)
         for (j=sl_size(tryinds)-1; j>=0; j--) {
             char* path = sl_get(tryinds, j);
+            // (the name in the directory follows "<dir>/")
+            ptrdiff_t k = sl_index_of(names, path + dirlen + 1);
+            char* meta = sl_get(metas, k);
+            index_t* ind;
             logverb("Trying to add index \"%s\".\n", path);
-            if (engine_add_index(engine, path))
+            ind = add_index_path(engine, path, strlen(meta) ? meta : NULL);
+            if (!ind) {
                 logmsg("Failed to add index \"%s\".\n", path);
+                sl_set(metas, k, "-");
+                changed = TRUE;
+            } else if (!strlen(meta)) {
+                char* newmeta = index_get_meta_string(ind);
+                sl_set(metas, k, newmeta);
+                free(newmeta);
+            }
         }
         sl_free2(tryinds);
+
+        if (changed)
+            write_index_manifest(manifestfn, names, stamps, metas);
+        free(manifestfn);
+        sl_free2(oldnames);
+        sl_free2(oldstamps);
+        sl_free2(oldmetas);
+        sl_free2(names);
+        sl_free2(stamps);
+        sl_free2(metas);
     }
     return 0;
 }
@@ -174,12 +369,16 @@ static int add_index(engine_t* engine, index_t* ind) {
     return 0;
 }
 
-int engine_add_index(engine_t* engine, char* path) {
+// Adds the index at "path".  If "meta" is given, it is the metadata of the
+// index as made by index_get_meta_string() and the index files are not read
+// for it.
+static index_t* add_index_path(engine_t* engine, char* path, const char* meta) {
     int k;
     index_t* ind = NULL;
     char* quadpath = index_get_quad_filename(path);
     char* base = basename_safe(quadpath);
     double t0;
+    int flags;
     free(quadpath);
 
     // check that an index with the same filename hasn't already been added.
@@ -197,19 +396,76 @@ int engine_add_index(engine_t* engine, char* path) {
     }
     free(base);
 
+    flags = engine->inparallel ? 0 : INDEX_ONLY_LOAD_METADATA;
+    if (engine->hugepages)
+        flags |= INDEX_USE_HUGE_PAGES;
+    if (engine->packcodetrees)
+        flags |= INDEX_PACK_CODE_TREE;
     t0 = timenow();
-    ind = index_load(path, engine->inparallel ? 0 : INDEX_ONLY_LOAD_METADATA, NULL);
+    ind = NULL;
+    if (meta) {
+        ind = index_load_from_meta_string(path, meta, flags);
+        if (!ind)
+            logverb("The cached metadata of index \"%s\" is unusable, reading the index.\n", path);
+    }
+    if (!ind)
+        ind = index_load(path, flags, NULL);
     debug("index_load(\"%s\") took %g ms\n", path, 1000 * (timenow() - t0));
     if (!ind) {
         ERROR("Failed to load index from path %s", path);
-        return -1;
+        return NULL;
     }
     if (add_index(engine, ind)) {
         ERROR("Failed to add index \"%s\"", path);
-        return -1;
+        return NULL;
     }
     pl_append(engine->free_indexes, ind);
-    return 0;
+    return ind;
+}
+
+int engine_add_index(engine_t* engine, char* path) {
+    return add_index_path(engine, path, NULL) ? 0 : -1;
+}
+
+void engine_select_indexes(engine_t* engine, double fmin, double fmax,
+                           anbool use_radec, double ra, double dec, double radius,
+                           il* indexlist) {
+    il* inscale = il_new(16);
+    int k;
+    for (k = 0; k < pl_size(engine->indexes); k++) {
+        index_t* index = pl_get(engine->indexes, k);
+        if (!index_overlaps_scale_range(index, fmin, fmax))
+            continue;
+        il_append(inscale, k);
+    }
+
+    // Use the (list of) smallest or largest indices if no other one fits.
+    if (!il_size(inscale)) {
+        il* list = NULL;
+        if (fmin > engine->sizebiggest) {
+            list = engine->ibiggest;
+        } else if (fmax < engine->sizesmallest) {
+            list = engine->ismallest;
+        } else {
+            assert(0);
+        }
+        il_append_list(inscale, list);
+    }
+
+    for (k=0; k<il_size(inscale); k++) {
+        int ii = il_get(inscale, k);
+        index_t* index = pl_get(engine->indexes, ii);
+        anbool inrange = TRUE;
+        if (use_radec)
+            inrange = index_is_within_range(index, ra, dec, radius);
+        if (!inrange) {
+            logverb("Not using index %s because it's not within %g degrees of (RA,Dec) = (%g,%g)\n",
+                    index->indexname, radius, ra, dec);
+            continue;
+        }
+        il_append(indexlist, ii);
+    }
+    il_free(inscale);
 }
 
 static void add_index_to_blind(engine_t* engine, blind_t* bp,
@@ -436,6 +692,14 @@ int engine_run_job(engine_t* engine, job_t* job) {
 
     if (engine->inparallel)
         bp->indexes_inparallel = TRUE;
+    // (indexes that are loaded one at a time are loaded by blind)
+    if (engine->hugepages)
+        bp->index_options |= INDEX_USE_HUGE_PAGES;
+    if (engine->packcodetrees)
+        bp->index_options |= INDEX_PACK_CODE_TREE;
+    // (only the indexes loaded together are searched at the same time)
+    if (engine->inparallel)
+        sp->nthreads = engine->indexthreads;
 
     if (job->use_radec_center) {
         logmsg("Only searching for solutions within %g degrees of RA,Dec (%g,%g)\n",
@@ -492,39 +756,11 @@ int engine_run_job(engine_t* engine, job_t* job) {
 
             // Select the indices that should be checked.
             indexlist = il_new(16);
-            for (k = 0; k < pl_size(engine->indexes); k++) {
-                index_t* index = pl_get(engine->indexes, k);
-                if (!index_overlaps_scale_range(index, fmin, fmax))
-                    continue;
-                il_append(indexlist, k);
-            }
-
-            // Use the (list of) smallest or largest indices if no other one fits.
-            if (!il_size(indexlist)) {
-                il* list = NULL;
-                if (fmin > engine->sizebiggest) {
-                    list = engine->ibiggest;
-                } else if (fmax < engine->sizesmallest) {
-                    list = engine->ismallest;
-                } else {
-                    assert(0);
-                }
-                il_append_list(indexlist, list);
-            }
-
-            for (k=0; k<il_size(indexlist); k++) {
-                int ii = il_get(indexlist, k);
-                index_t* index = pl_get(engine->indexes, ii);
-                anbool inrange = TRUE;
-                if (job->use_radec_center)
-                    inrange = index_is_within_range(index, job->ra_center, job->dec_center, job->search_radius);
-                if (!inrange) {
-                    logverb("Not using index %s because it's not within %g degrees of (RA,Dec) = (%g,%g)\n",
-                            index->indexname, job->search_radius, job->ra_center, job->dec_center);
-                    continue;
-                }
-                add_index_to_blind(engine, bp, ii);
-            }
+            engine_select_indexes(engine, fmin, fmax, job->use_radec_center,
+                                  job->ra_center, job->dec_center, job->search_radius,
+                                  indexlist);
+            for (k=0; k<il_size(indexlist); k++)
+                add_index_to_blind(engine, bp, il_get(indexlist, k));
 
             il_free(indexlist);
 
@@ -19,6 +19,9 @@
 #endif
 
 #include <stdarg.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "os-features.h"
 #include "ioutils.h"
@@ -350,6 +353,12 @@ static void update_timeused(solver_t* sp) {
         sp->timeused = 0.0;
 }
 
+// Has this solver, or the solver it searches an index for, been told to
+// bail out?
+static inline anbool quitting(const solver_t* sp) {
+    return sp->quit_now || (sp->parent && sp->parent->quit_now);
+}
+
 static void set_matchobj_template(solver_t* solver, MatchObj* mo) {
     if (solver->mo_template)
         memcpy(mo, solver->mo_template, sizeof(MatchObj));
@@ -555,6 +564,8 @@ static void resolve_matches(kdtree_qres_t* krez, const double *field,
 
 static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip, anbool fake_match);
 
+static anbool record_match(solver_t* sp, MatchObj* mo);
+
 static void check_scale(pquad* pq, solver_t* s) {
     double dx, dy;
     dx = field_getx(s, pq->fieldB) - field_getx(s, pq->fieldA);
@@ -710,7 +721,7 @@ static void add_stars(const pquad* pq, int* field, int fieldoffset,
     for (f[adding]=bottom; f[adding]<fieldtop; f[adding]++) {
         if (!pq->inbox[f[adding]])
             continue;
-        if (unlikely(solver->quit_now))
+        if (unlikely(quitting(solver)))
             return;
 
         // If we've hit the end of the recursion (we're adding the last star),
@@ -726,6 +737,130 @@ static void add_stars(const pquad* pq, int* field, int fieldoffset,
     }
 }
 
+/*
+ Searches the index of "worker" (a copy of the solver made by
+ solver_run(), see "nthreads") for the quads that have "newpoint" as
+ star B or star C.  This is what the loops in solver_run() do for one
+ index, except that the "pquads" have already been set up for
+ "newpoint", so they are only read here.
+ */
+static void search_index(solver_t* worker, pquad* pquads, int numxy,
+                         int newpoint, double minAB2, double maxAB2) {
+    int field[DQMAX];
+    int dimquads = index_dimquads(worker->index);
+    double tol2;
+
+    memset(field, 0, sizeof(field));
+
+    // quads with the new star on the diagonal:
+    field[B] = newpoint;
+    for (field[A] = 0; field[A] < newpoint; field[A]++) {
+        pquad* pq = pquads + field[B] * numxy + field[A];
+        if (!pq->scale_ok)
+            continue;
+        if ((pq->scale < minAB2) ||
+            (pq->scale > maxAB2))
+            continue;
+        worker->rel_field_noise2 = pq->rel_field_noise2;
+        tol2 = get_tolerance(worker);
+        add_stars(pq, field, C, dimquads-2, 0, newpoint, dimquads, worker, tol2);
+        if (quitting(worker))
+            return;
+    }
+
+    // quads with the new star not on the diagonal:
+    field[C] = newpoint;
+    for (field[A] = 0; field[A] < newpoint; field[A]++) {
+        for (field[B] = field[A] + 1; field[B] < newpoint; field[B]++) {
+            pquad* pq = pquads + field[B] * numxy + field[A];
+            if (!pq->scale_ok || !pq->inbox[field[C]])
+                continue;
+            if ((pq->scale < minAB2) ||
+                (pq->scale > maxAB2))
+                continue;
+            worker->rel_field_noise2 = pq->rel_field_noise2;
+            tol2 = get_tolerance(worker);
+            if (dimquads > 3) {
+                add_stars(pq, field, D, dimquads-3, 0, newpoint, dimquads, worker, tol2);
+            } else {
+                TRY_ALL_CODES(pq, field, dimquads, worker, tol2);
+            }
+            if (quitting(worker))
+                return;
+        }
+    }
+}
+
+/*
+ Searches all the indexes for the quads that have "newpoint" as star B
+ or star C, one index per thread; "workers" holds a copy of the solver
+ for each index.  The "pquads" with "newpoint" as star B must have been
+ set up already.
+ */
+static void search_indexes_in_parallel(solver_t* solver, solver_t* workers,
+                                       int nworkers, pquad* pquads, int numxy,
+                                       int newpoint, const double* minAB2s,
+                                       const double* maxAB2s) {
+    int i, a, b;
+    log_t logger;
+
+    // Test if the new star is in the box of each AB pair (with A, B below
+    // it) before any searching, so the searches only read the "pquads".
+    for (a = 0; a < newpoint; a++) {
+        for (b = a + 1; b < newpoint; b++) {
+            pquad* pq = pquads + b * numxy + a;
+            if (!pq->scale_ok)
+                continue;
+            pq->inbox[newpoint] = TRUE;
+            pq->ninbox = newpoint + 1;
+            check_inbox(pq, newpoint, solver);
+        }
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        solver_t* w = workers + i;
+        w->quit_now = FALSE;
+        w->numtries = 0;
+        w->nummatches = 0;
+        w->numscaleok = 0;
+        w->num_cxdx_skipped = 0;
+        w->num_meanx_skipped = 0;
+        w->num_radec_skipped = 0;
+        w->num_abscale_skipped = 0;
+        w->num_verified = 0;
+        w->best_logodds = solver->best_logodds;
+        w->last_examined_object = newpoint;
+    }
+
+    // The logger is per thread: the threads log where this one does.
+    log_get_settings(&logger);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(MIN(solver->nthreads, nworkers)) schedule(dynamic, 1)
+#endif
+    for (i = 0; i < nworkers; i++) {
+        log_set_settings(&logger);
+        search_index(workers + i, pquads, numxy, newpoint, minAB2s[i], maxAB2s[i]);
+#ifdef _OPENMP
+        // The error state is per thread too; the other threads of the team free theirs.
+        if (omp_get_thread_num() != 0)
+            errors_free();
+#endif
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        const solver_t* w = workers + i;
+        solver->numtries += w->numtries;
+        solver->nummatches += w->nummatches;
+        solver->numscaleok += w->numscaleok;
+        solver->num_cxdx_skipped += w->num_cxdx_skipped;
+        solver->num_meanx_skipped += w->num_meanx_skipped;
+        solver->num_radec_skipped += w->num_radec_skipped;
+        solver->num_abscale_skipped += w->num_abscale_skipped;
+        solver->num_verified += w->num_verified;
+        solver->best_logodds = MAX(solver->best_logodds, w->best_logodds);
+    }
+}
 
 // The real deal
 void solver_run(solver_t* solver) {
@@ -737,6 +872,8 @@ void solver_run(solver_t* solver) {
     size_t i, num_indexes;
     double tol2;
     int field[DQMAX];
+    // copies of the solver that search one index each, or NULL.
+    solver_t* workers = NULL;
 
     get_resource_stats(&usertime, &systime, NULL);
 
@@ -815,6 +952,25 @@ void solver_run(solver_t* solver) {
 
         pquads = calloc(numxy * numxy, sizeof(pquad));
 
+#ifdef _OPENMP
+        if (solver->nthreads > 1 && num_indexes > 1) {
+            logverb("Searching %zu indexes with up to %i threads\n",
+                    num_indexes, solver->nthreads);
+            workers = malloc(num_indexes * sizeof(solver_t));
+            for (i = 0; i < num_indexes; i++) {
+                solver_t* w = workers + i;
+                memcpy(w, solver, sizeof(solver_t));
+                // the parent keeps the best match.
+                memset(&(w->best_match), 0, sizeof(MatchObj));
+                w->have_best_match = FALSE;
+                w->best_match_solves = FALSE;
+                w->best_index = NULL;
+                w->parent = solver;
+                set_index(w, pl_get(solver->indexes, i));
+            }
+        }
+#endif
+
         /* We maintain an array of "potential quads" (pquad) structs, where
          * each struct corresponds to one choice of stars A and B; the struct
          * at index (B * numxy + A) holds information about quads that could be
@@ -923,6 +1079,14 @@ void solver_run(solver_t* solver) {
                 print_inbox(pq);
             }
 
+            if (workers) {
+                search_indexes_in_parallel(solver, workers, num_indexes, pquads, numxy,
+                                           newpoint, minAB2s, maxAB2s);
+                if (solver->quit_now)
+                    goto quitnow;
+                goto searched;
+            }
+
             // Now iterate through the different indices
             for (i = 0; i < num_indexes; i++) {
                 index_t* index = pl_get(solver->indexes, i);
@@ -1000,6 +1164,7 @@ void solver_run(solver_t* solver) {
                     }
                 }
             }
+        searched:
             logverb("object %u of %u: %i quads tried, %i matched.\n",
                     newpoint + 1, numxy, solver->numtries, solver->nummatches);
 
@@ -1016,6 +1181,7 @@ void solver_run(solver_t* solver) {
             free(pq->xy);
         }
         free(pquads);
+        free(workers);
 
 #ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
         free(minAB2s);
@@ -1098,7 +1264,7 @@ static void try_all_codes_2(const int* fieldstars, int dimquad,
 
     try_permutations(fieldstars, dimquad, code, solver, current_parity,
                      tol2, stars, NULL, 0, placed, &result);
-    if (unlikely(solver->quit_now))
+    if (unlikely(quitting(solver)))
         goto bailout;
 
     // Flipped:
@@ -1237,7 +1403,7 @@ static void try_permutations(const int* origstars, int dimquad,
                 resolve_matches(*presult, pixvals, stars, dimquad, solver,
                                 current_parity);
             }
-            if (unlikely(solver->quit_now))
+            if (unlikely(quitting(solver)))
                 return;
         }
     }
@@ -1336,6 +1502,12 @@ static void resolve_matches(kdtree_qres_t* krez, const double *field,
         mo.quads_scaleok = solver->numscaleok;
         mo.quad_npeers = krez->nres;
         mo.timeused = solver->timeused;
+        if (solver->parent) {
+            // this solver only counts since the last new star.
+            mo.quads_tried += solver->parent->numtries;
+            mo.quads_matched += solver->parent->nummatches;
+            mo.quads_scaleok += solver->parent->numscaleok;
+        }
         mo.quadno = thisquadno;
         mo.dimquads = dimquads;
         for (i=0; i<dimquads; i++) {
@@ -1352,7 +1524,7 @@ static void resolve_matches(kdtree_qres_t* krez, const double *field,
         if (solver_handle_hit(solver, &mo, NULL, FALSE))
             solver->quit_now = TRUE;
 
-        if (unlikely(solver->quit_now))
+        if (unlikely(quitting(solver)))
         {
             #ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
              free(starxyz);
@@ -1399,6 +1571,8 @@ static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
                sp->logratio_stoplooking,
                sp->distance_from_quad_bonus, fake_match);
     mo->nverified = sp->num_verified++;
+    if (sp->parent)
+        mo->nverified += sp->parent->num_verified;
 
     if (mo->logodds >= sp->best_logodds) {
         sp->best_logodds = mo->logodds;
@@ -1577,6 +1751,33 @@ static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
          */
     }
 
+    if (!sp->parent)
+        return record_match(sp, mo);
+
+    // A solver searching one index of its parent: the parent records the
+    // match, one at a time, and the first match that solves stops the
+    // searches of all the indexes.
+#ifdef _OPENMP
+#pragma omp critical(solver_record_match)
+#endif
+    {
+        solver_t* parent = sp->parent;
+        if (parent->best_match_solves) {
+            verify_free_matchobj(mo);
+            solved = TRUE;
+        } else {
+            parent->index = sp->index;
+            solved = record_match(parent, mo);
+            if (solved)
+                parent->quit_now = TRUE;
+        }
+    }
+    return solved;
+}
+
+static anbool record_match(solver_t* sp, MatchObj* mo) {
+    anbool solved;
+
     // If the user didn't supply a callback, or if the callback
     // returns TRUE, consider it solved.
     solved = (!sp->record_match_callback ||
@@ -33,6 +33,13 @@ struct engine {
     double sizesmallest;
     double sizebiggest;
     anbool inparallel;
+    // load the indexes with INDEX_USE_HUGE_PAGES
+    anbool hugepages;
+    // load the indexes with INDEX_PACK_CODE_TREE
+    anbool packcodetrees;
+    // with "inparallel", the number of threads that search the indexes
+    // (solver_t "nthreads")
+    int indexthreads;
     double minwidth;
     double maxwidth;
     float cpulimit;
@@ -61,6 +68,12 @@ char* engine_find_index(engine_t*, const char* name);
 int engine_add_index(engine_t* engine, char* path);
 // look in all the search path directories for index files.
 int engine_autoindex_search_paths(engine_t* engine);
+// append to "indexlist" the positions in engine->indexes of the indexes that
+// a search for quads of "fmin" to "fmax" arcsec would use, leaving out those
+// farther than "radius" degrees from (ra, dec) if "use_radec" is set.
+void engine_select_indexes(engine_t* engine, double fmin, double fmax,
+                           anbool use_radec, double ra, double dec, double radius,
+                           il* indexlist);
 int engine_parse_config_file_stream(engine_t* engine, FILE* fconf);
 int engine_parse_config_file(engine_t* engine, const char* fn);
 int engine_run_job(engine_t* engine, job_t* job);
@@ -38,6 +38,10 @@ struct errors {
 };
 
 /***    Global functions    ***/
+/*
+ These work on the error state of the calling thread; each thread has
+ its own stack of states.
+ */
 
 err_t* errors_get_state();
 
@@ -71,7 +75,7 @@ void errors_clear_stack();
 
 int errors_print_on_exit(FILE* fid);
 
-// free globals.
+// free the calling thread's error state.
 void errors_free();
 
 /*
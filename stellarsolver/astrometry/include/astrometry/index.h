@@ -73,6 +73,21 @@ typedef struct {
     int dimquads;
     int nstars;
     int nquads;
+
+    // Is this a StellarSolver native index (see ssindex.h)?  Then this is
+    // the mapping of its file while the index is loaded.
+    anbool native;
+    char* nativemap;
+    size_t nativemapsize;
+
+    // Was it loaded with INDEX_USE_HUGE_PAGES?  Then this is the huge-page
+    // memory its kd-trees were copied into, if there was any.
+    anbool hugepages;
+    char* hugemap;
+    size_t hugemapsize;
+
+    // Was it loaded with INDEX_PACK_CODE_TREE?
+    anbool packcodetree;
 } index_t;
 
 /**
@@ -105,6 +120,22 @@ anbool index_is_within_range(index_t* indx, double ra, double dec, double radius
  */
 int index_get_meta(const char* filename, index_t* indx);
 
+/**
+ Returns a newly-allocated single-line string holding the metadata of
+ the given index (id, healpix, scales, sizes, cut parameters and code
+ flags), for caching it between runs.
+ */
+char* index_get_meta_string(const index_t* meta);
+
+/**
+ Like index_load(), but takes the metadata from a string made by
+ index_get_meta_string() instead of reading it from the index files.
+ With INDEX_ONLY_LOAD_METADATA the index files are not opened at all,
+ so the caller must know that the string still describes them.
+ */
+index_t* index_load_from_meta_string(const char* indexname, const char* metastr,
+                                     int flags);
+
 anbool index_is_file_index(const char* filename);
 
 char* index_get_quad_filename(const char* indexname);
@@ -112,6 +143,10 @@ char* index_get_quad_filename(const char* indexname);
 char* index_get_qidx_filename(const char* indexname);
 
 #define INDEX_ONLY_LOAD_METADATA 2
+// Copy the kd-tree boxes, splits and data into huge pages when loading.
+#define INDEX_USE_HUGE_PAGES 4
+// Build the packed layout of the code kd-tree (see kdtree_pack()) when loading.
+#define INDEX_PACK_CODE_TREE 8
 
 int index_get_quad_dim(const index_t* index);
 
@@ -134,7 +169,9 @@ index_t* index_build_from(codetree_t* codekd, quadfile_t* quads, startree_t* sta
  *               'myindex'
  *
  *   flags - If INDEX_ONLY_LOAD_METADATA, then only metadata will be
- *               loaded.
+ *               loaded.  If INDEX_USE_HUGE_PAGES, the parts of the
+ *               kd-trees that searches walk through are copied into
+ *               memory backed by huge pages, where the system has any.
  *
  *   dest - If NULL, a new index_t will be allocated and returned;
  *               otherwise, the results will be put in this index_t
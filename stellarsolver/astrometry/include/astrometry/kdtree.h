@@ -239,6 +239,10 @@ struct kdtree {
 
     int has_linear_lr;
 
+    /* The split planes in the cache-friendly layout made by kdtree_pack(), or NULL.
+     Owned by the tree. */
+    void* packed;
+
     // For i/o: the name of this tree in the file.
     char* name;
 
@@ -332,6 +336,17 @@ int kdtree_permute(const kdtree_t* tree, int ind);
  */
 void kdtree_inverse_permutation(const kdtree_t* tree, int* invperm);
 
+/*
+ Builds a second copy of the split positions and dimensions of the
+ interior nodes, cut into blocks of a few levels that each fit in a cache
+ line.  Range searches that use the splits (KD_OPTIONS_USE_SPLIT, or
+ trees without bounding boxes) then walk the blocks instead of the heap-
+ ordered split and splitdim arrays, with the same results.
+
+ Needs a complete tree with splits.  Returns 0 on success.
+ */
+int kdtree_pack(kdtree_t* kd);
+
 /* Free results */
 void kdtree_free_query(kdtree_qres_t *res);
 
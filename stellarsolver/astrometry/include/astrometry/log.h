@@ -104,6 +104,14 @@ void log_this(const char* text, enum log_level level, va_list va);
 
 void setAstroLogger(AstrometryLogger* logger);
 
+/**
+ The logger is per thread.  These copy the calling thread's logger into
+ "dest", and replace it by "src", so that worker threads can log where
+ the thread that started them does.
+ */
+void log_get_settings(log_t* dest);
+void log_set_settings(const log_t* src);
+
 // This is the end of the added functions.
 
 int log_get_level(void);
@@ -136,6 +136,11 @@ struct solver_t {
     // calling again.  The parameter is "userdata".
     time_t (*timer_callback)(void*);
 
+    // Number of threads that search the indexes concurrently, one index
+    // per thread, when solver_run() is given several indexes and the
+    // library is built with OpenMP.  0 or 1: search the indexes in turn.
+    int nthreads;
+
     // FIELDS THAT AFFECT THE RUNNING SOLVER ON CALLBACK
     // =================================================
 
@@ -204,6 +209,11 @@ struct solver_t {
 
     // Cached data about this field, for verify_hit().
     verify_field_t* vf;
+
+    // For the copies that search one index each when "nthreads" > 1: the
+    // solver that records their matches and counts, and whose "quit_now"
+    // they obey.  NULL otherwise.
+    struct solver_t* parent;
 };
 typedef struct solver_t solver_t;
 
@@ -0,0 +1,146 @@
+/*
+ # This file is part of the Astrometry.net suite.
+ # Licensed under a 3-clause BSD style license - see LICENSE
+ */
+
+#ifndef SSINDEX_H
+#define SSINDEX_H
+
+#include <stdint.h>
+
+#include "astrometry/index.h"
+
+/*
+ * The StellarSolver native index container.
+ *
+ * It holds the same star kdtree, code kdtree and quads as a FITS index,
+ * but as raw arrays in page-aligned sections behind one fixed-size header
+ * that also carries the index metadata.  Loading it is a single mmap of
+ * the file: the trees point straight into the mapping and no FITS header
+ * is parsed.  The inverse permutations of the trees are stored too, so
+ * they don't have to be computed on every load.
+ *
+ * The converter can optionally "expand" integer (u16/u32) trees into
+ * all-double trees, with the same nodes, permutation and bounding boxes,
+ * so that queries no longer convert every coordinate they touch, at the
+ * cost of a larger file.
+ *
+ * The file is written in the byte order of the machine that converted
+ * it, and is refused on a machine with the other byte order.
+ */
+
+#define SSINDEX_SUFFIX ".ssidx"
+#define SSINDEX_MAGIC "SSINDEX"
+#define SSINDEX_VERSION 1
+#define SSINDEX_ENDIAN 0x01020304
+// Alignment of the sections in the file.
+#define SSINDEX_ALIGN 4096
+
+// The sections of each tree...
+enum ssindex_tree_sections {
+    SSINDEX_LR,
+    SSINDEX_PERM,
+    SSINDEX_INVPERM,
+    SSINDEX_BB,
+    SSINDEX_SPLIT,
+    SSINDEX_SPLITDIM,
+    SSINDEX_DATA,
+    SSINDEX_RANGE,
+    SSINDEX_N_TREE_SECTIONS
+};
+// ... the star tree's come first, then the code tree's, then these.
+#define SSINDEX_STARS 0
+#define SSINDEX_CODES 1
+#define SSINDEX_QUADS (2 * SSINDEX_N_TREE_SECTIONS)
+#define SSINDEX_SWEEP (SSINDEX_QUADS + 1)
+#define SSINDEX_N_SECTIONS (SSINDEX_SWEEP + 1)
+
+typedef struct {
+    // from the start of the file; 0 if the section is absent.
+    uint64_t offset;
+    // in bytes.
+    uint64_t size;
+} ssindex_section_t;
+
+typedef struct {
+    uint32_t treetype;
+    int32_t ndata;
+    int32_t ndim;
+    int32_t nnodes;
+    int32_t has_linear_lr;
+    int32_t n_bb;
+    uint32_t dimbits;
+    uint32_t dimmask;
+    uint32_t splitmask;
+    int32_t pad;
+    double scale;
+    double invscale;
+} ssindex_tree_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t headersize;
+    int32_t pad;
+
+    // The metadata of the index, as in index_t.
+    int32_t indexid;
+    int32_t healpix;
+    int32_t hpnside;
+    int32_t dimquads;
+    int32_t nstars;
+    int32_t nquads;
+    int32_t circle;
+    int32_t cx_less_than_dx;
+    int32_t meanx_less_than_half;
+    int32_t cutnside;
+    int32_t cutnsweep;
+    int32_t cutmargin;
+    double index_jitter;
+    double cutdedup;
+    // in arcsec
+    double index_scale_lower;
+    double index_scale_upper;
+    // empty if unknown
+    char cutband[16];
+
+    ssindex_tree_t trees[2];
+    ssindex_section_t sections[SSINDEX_N_SECTIONS];
+} ssindex_header_t;
+
+/**
+ Returns TRUE if the given file is a native index.
+ */
+anbool ssindex_is_file(const char* filename);
+
+/**
+ Writes the given index, which must be loaded (not metadata-only), to
+ "outfn" as a native index.  With "expand", integer trees are written
+ as all-double trees.
+
+ Returns 0 on success.
+ */
+int ssindex_write(const index_t* index, const char* outfn, anbool expand);
+
+/**
+ Reads the metadata of the native index "filename" into "dest", the
+ way index_load() does with INDEX_ONLY_LOAD_METADATA, by reading only
+ the header.
+ */
+int ssindex_load_meta(const char* filename, index_t* dest);
+
+/**
+ Maps the file of a native index whose metadata was loaded with
+ ssindex_load_meta() and points its trees and quads into the mapping.
+ This is what index_reload() does for native indexes.
+ */
+int ssindex_reload(index_t* index);
+
+/**
+ Closes the trees and quads of a native index and unmaps its file.
+ This is what index_unload() does for native indexes.
+ */
+void ssindex_unload(index_t* index);
+
+#endif
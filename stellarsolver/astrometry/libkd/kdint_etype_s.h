@@ -6,6 +6,7 @@
 typedef u16 etype;
 
 #define ETYPE_INTEGER 1
+#define ETYPE_DOUBLE  0
 
 #define ETYPE_MAX  0xffffu
 #define ETYPE_MIN  0
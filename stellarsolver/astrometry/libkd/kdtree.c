@@ -8,6 +8,9 @@
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#ifdef _WIN32 //# Modified by Robert Lancaster for the StellarSolver Internal Library, for _aligned_malloc
+#include <malloc.h>
+#endif
 
 #include "os-features.h"
 #include "kdtree.h"
@@ -72,6 +75,46 @@ int kdtree_has_old_bb(const kdtree_t* kd) {
 }
 
 KD_DECLARE(kdtree_update_funcs, void, (kdtree_t*));
+KD_DECLARE(kdtree_pack_nodes, int, (kdtree_t*));
+
+int kdtree_pack(kdtree_t* kd) {
+    int rtn = -1;
+    if (kd->packed)
+        return 0;
+    // The layout relies on the tree being complete.
+    if (kd->nnodes != (1 << kd->nlevels) - 1)
+        return -1;
+    KD_DISPATCH(kdtree_pack_nodes, kd->treetype, rtn =, (kd));
+    return rtn;
+}
+
+void* kdtree_packed_alloc(size_t size) {
+    void* blocks = NULL;
+#ifdef _WIN32
+    blocks = _aligned_malloc(size, KDTREE_PACKED_LINE);
+#else
+    if (posix_memalign(&blocks, KDTREE_PACKED_LINE, size))
+        blocks = NULL;
+#endif
+    return blocks;
+}
+
+void kdtree_packed_free(void* blocks) {
+#ifdef _WIN32
+    _aligned_free(blocks);
+#else
+    free(blocks);
+#endif
+}
+
+void kdtree_free_packed(kdtree_t* kd) {
+    kdtree_packed_t* tree = kd->packed;
+    if (!tree)
+        return;
+    kdtree_packed_free(tree->blocks);
+    FREE(tree);
+    kd->packed = NULL;
+}
 
 void kdtree_update_funcs(kdtree_t* kd) {
     KD_DISPATCH(kdtree_update_funcs, kd->treetype,, (kd));
@@ -542,6 +585,7 @@ void kdtree_free(kdtree_t *kd) {
         FREE(kd->data.any);
     FREE(kd->minval);
     FREE(kd->maxval);
+    kdtree_free_packed(kd);
     //FREE(kd->fun);
     FREE(kd);
 }
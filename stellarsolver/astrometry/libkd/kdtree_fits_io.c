@@ -398,6 +398,7 @@ int kdtree_fits_close(kdtree_t* kd) {
     if (kd->io)
         kdtree_fits_io_close(kd->io);
     FREE(kd->name);
+    kdtree_free_packed(kd);
     FREE(kd);
     return 0;
 }
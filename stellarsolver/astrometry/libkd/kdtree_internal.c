@@ -201,6 +201,9 @@ typedef u32 bigint;
  }
  */
 
+/* vectorised kernels for D = 2, 3, 4. */
+#include "kdtree_internal_simd.c"
+
 /* min/maxdist functions. */
 #define CAN_OVERFLOW 0
 #undef  DELTAMAX
@@ -220,20 +223,31 @@ typedef u32 bigint;
 #define DISTTYPE ttype
 #define FUNC_SUFFIX _ttype
 #define DELTAMAX TTYPE_SQRT_MAX
+#if KD_SIMD && TTYPE_INTEGER
+#define SIMD_MINDIST2_EXCEEDS DIST_FUNC_MANGLE(simd_bb_point_mindist2_exceeds_, TTYPE)
+#endif
 #include "kdtree_internal_dists.c"
 #undef PTYPE
 #undef DISTTYPE
 #undef FUNC_SUFFIX
 #undef DELTAMAX
+#undef SIMD_MINDIST2_EXCEEDS
 
 #define PTYPE ttype
 #define DISTTYPE bigttype
 #define FUNC_SUFFIX _bigttype
 #undef  DELTAMAX
+// (Not for u32 trees: their u64 distances can overflow the kernel's sum.)
+#if KD_SIMD && TTYPE_INTEGER
+#if TTYPE_MAX == UINT16_MAX
+#define SIMD_MINDIST2_EXCEEDS simd_bb_point_mindist2_exceeds_s
+#endif
+#endif
 #include "kdtree_internal_dists.c"
 #undef PTYPE
 #undef DISTTYPE
 #undef FUNC_SUFFIX
+#undef SIMD_MINDIST2_EXCEEDS
 
 #undef CAN_OVERFLOW
 
@@ -258,6 +272,12 @@ static inline double dist2(const kdtree_t* kd, const etype* q, const dtype* p, i
     double d2 = 0.0;
 #if defined(KD_DIM)
     D = KD_DIM;
+#endif
+#if defined(SIMD_POINT_DIST2)
+    if (D >= SIMD_MIN_DIM && D <= SIMD_MAX_DIM) {
+        simd_point_dist2_exceeds(kd, q, p, D, HUGE_VAL, &d2);
+        return d2;
+    }
 #endif
     for (d=0; d<D; d++) {
         etype pp = POINT_DE(kd, d, p[d]);
@@ -281,6 +301,15 @@ static inline void dist2_bailout(const kdtree_t* kd, const etype* q, const dtype
     double d2 = 0.0;
 #if defined(KD_DIM)
     D = KD_DIM;
+#endif
+#if defined(SIMD_POINT_DIST2)
+    if (D >= SIMD_MIN_DIM && D <= SIMD_MAX_DIM) {
+        if (simd_point_dist2_exceeds(kd, q, p, D, maxd2, &d2))
+            *bailedout = TRUE;
+        else
+            *d2res = d2;
+        return;
+    }
 #endif
     for (d=0; d<D; d++) {
         double delta;
@@ -337,6 +366,11 @@ static inline anbool dist2_exceeds(const kdtree_t* kd, const etype* q, const dty
     double d2 = 0.0;
 #if defined(KD_DIM)
     D = KD_DIM;
+#endif
+#if defined(SIMD_POINT_DIST2)
+    if (D >= SIMD_MIN_DIM && D <= SIMD_MAX_DIM) {
+        return simd_point_dist2_exceeds(kd, q, p, D, maxd2, &d2);
+    }
 #endif
     for (d=0; d<D; d++) {
         double delta;
@@ -1041,6 +1075,225 @@ void MANGLE(kdtree_nn)(const kdtree_t* kd, const void* vquery,
 }
 
 
+/*
+ The packed layout made by kdtree_pack(): the interior nodes are cut into
+ blocks of PACKED_LEVELS levels, small enough that a block's split
+ positions and dimensions fit in one 64-byte cache line, so a search down
+ the tree touches one line per block instead of one line per level (and
+ array) near the bottom of the heap-ordered arrays.  The blocks are in
+ breadth-first order and the child blocks of a block are consecutive.
+ The root block holds the levels left over at the top.  Each block is
+ padded to a whole line and the array of blocks starts on a line.
+ */
+#define PACKED_LEVELS (sizeof(ttype) <= 2 ? 4 : (sizeof(ttype) <= 4 ? 3 : 2))
+#define PACKED_BLOCK_NODES ((1 << PACKED_LEVELS) - 1)
+
+typedef struct {
+    // the split position, already separated from the split dimension.
+    ttype split;
+    u8 dim;
+} packed_node_t;
+
+typedef union {
+    struct {
+        // the nodes of the block's subtree in heap order.
+        packed_node_t nodes[PACKED_BLOCK_NODES];
+        // the first of the blocks below this one, or -1.
+        int32_t firstchild;
+    };
+    u8 line[KDTREE_PACKED_LINE];
+} packed_block_t;
+
+// static assert: a block is exactly one cache line.
+typedef char packed_block_fills_one_line[sizeof(packed_block_t) == KDTREE_PACKED_LINE ? 1 : -1];
+
+int MANGLE(kdtree_pack_nodes)(kdtree_t* kd) {
+    kdtree_packed_t* tree;
+    packed_block_t* blocks;
+    int* roots;
+    int ilevels = kd->nlevels - 1;
+    int rootlevels, nblocks, nlast, b, next;
+
+    if (!kd->split.any || !(kd->splitdim || TTYPE_INTEGER) || ilevels < 1)
+        return -1;
+    // The top block takes what doesn't fill whole blocks.
+    rootlevels = ilevels - ((ilevels - 1) / PACKED_LEVELS) * PACKED_LEVELS;
+    nblocks = nlast = 1;
+    for (b=rootlevels; b<ilevels; b+=PACKED_LEVELS) {
+        nlast *= (b == rootlevels ? (1 << rootlevels) : (1 << PACKED_LEVELS));
+        nblocks += nlast;
+    }
+
+    tree = MALLOC(sizeof(kdtree_packed_t));
+    blocks = kdtree_packed_alloc(sizeof(packed_block_t) * nblocks);
+    // the heap-order node at the top of each block.
+    roots = MALLOC(sizeof(int) * nblocks);
+    if (!tree || !blocks || !roots) {
+        SYSERROR("Failed to allocate the packed layout of a kd-tree with %i nodes", kd->nnodes);
+        FREE(tree);
+        kdtree_packed_free(blocks);
+        FREE(roots);
+        return -1;
+    }
+    tree->rootlevels = rootlevels;
+    tree->nblocks = nblocks;
+    tree->blocks = blocks;
+
+    roots[0] = 0;
+    next = 1;
+    for (b=0; b<nblocks; b++) {
+        packed_block_t* block = blocks + b;
+        int levels = b ? PACKED_LEVELS : rootlevels;
+        int j, level;
+        memset(block, 0, sizeof(packed_block_t));
+        for (level=0, j=0; level<levels; level++) {
+            // the first node "level" levels below the root of the block.
+            int first = ((roots[b] + 1) << level) - 1;
+            int k;
+            for (k=0; k<(1 << level); k++, j++) {
+                int nodeid = first + k;
+                packed_node_t* node = block->nodes + j;
+                node->split = *KD_SPLIT(kd, nodeid);
+                if (kd->splitdim)
+                    node->dim = kd->splitdim[nodeid];
+                else {
+                    // packed int
+                    bigint tmpsplit = node->split;
+                    node->dim = tmpsplit & kd->dimmask;
+                    node->split = tmpsplit & kd->splitmask;
+                }
+            }
+        }
+        if (KD_IS_LEAF(kd, ((roots[b] + 1) << levels) - 1)) {
+            block->firstchild = -1;
+            continue;
+        }
+        block->firstchild = next;
+        for (j=0; j<(1 << levels); j++)
+            roots[next++] = ((roots[b] + 1) << levels) - 1 + j;
+    }
+    assert(next == nblocks);
+    FREE(roots);
+    kd->packed = tree;
+    return 0;
+}
+
+/*
+ The "use_splits" part of kdtree_rangesearch_options() on the packed
+ layout.  It visits the same nodes in the same order, so the results
+ are identical.
+ */
+static anbool rangesearch_packed(const kdtree_t* kd, kdtree_qres_t* res,
+                                 const etype* query, const ttype* tquery, int D,
+                                 double maxd2, double maxdist, ttype tlinf,
+                                 anbool use_tsplit, anbool do_dists, anbool do_points) {
+    const kdtree_packed_t* tree = kd->packed;
+    const packed_block_t* blocks = tree->blocks;
+    // heap-order node, block, and position in the block
+    int nodestack[100];
+    int blockstack[100];
+    int slotstack[100];
+    int stackpos = 0;
+
+    nodestack[0] = blockstack[0] = slotstack[0] = 0;
+
+    while (stackpos >= 0) {
+        int nodeid = nodestack[stackpos];
+        int b = blockstack[stackpos];
+        int j = slotstack[stackpos];
+        const packed_block_t* block;
+        int levels, dim, i;
+        int leftblock, rightblock, leftslot, rightslot;
+        anbool goleft = FALSE, goright = FALSE, leftfirst;
+        ttype split;
+        stackpos--;
+
+        if (KD_IS_LEAF(kd, nodeid)) {
+            dtype* data;
+            int L = kdtree_leaf_left(kd, nodeid);
+            int R = kdtree_leaf_right(kd, nodeid);
+            for (i=L; i<=R; i++) {
+                data = KD_DATA(kd, D, i);
+                if (do_dists) {
+                    anbool bailedout = FALSE;
+                    double dsqd;
+                    dist2_bailout(kd, query, data, D, maxd2, &bailedout, &dsqd);
+                    if (bailedout)
+                        continue;
+                    if (!add_result(kd, res, dsqd, KD_PERM(kd, i), data,
+                                    D, do_dists, do_points))
+                        return FALSE;
+                } else {
+                    if (dist2_exceeds(kd, query, data, D, maxd2))
+                        continue;
+                    if (!add_result(kd, res, HUGE_VAL, KD_PERM(kd, i), data,
+                                    D, do_dists, do_points))
+                        return FALSE;
+                }
+            }
+            continue;
+        }
+
+        block = blocks + b;
+        dim = block->nodes[j].dim;
+        split = block->nodes[j].split;
+
+        if (TTYPE_INTEGER && use_tsplit) {
+            leftfirst = (tquery[dim] < split);
+            if (leftfirst)
+                goright = (split - tquery[dim] <= tlinf);
+            else
+                goleft = (tquery[dim] - split <= tlinf);
+        } else {
+            dtype rsplit = POINT_TE(kd, dim, split);
+            leftfirst = (query[dim] < rsplit);
+            if (leftfirst)
+                goright = (rsplit - query[dim] <= maxdist);
+            else
+                goleft = (query[dim] - rsplit <= maxdist);
+        }
+        if (leftfirst)
+            goleft = TRUE;
+        else
+            goright = TRUE;
+
+        // Where are the children?
+        levels = b ? PACKED_LEVELS : tree->rootlevels;
+        if (2*j + 2 < (1 << levels) - 1) {
+            leftblock = rightblock = b;
+            leftslot = 2*j + 1;
+            rightslot = 2*j + 2;
+        } else {
+            int edge = j - ((1 << (levels - 1)) - 1);
+            leftblock = block->firstchild + 2*edge;
+            rightblock = leftblock + 1;
+            leftslot = rightslot = 0;
+        }
+
+        // As in the heap-order search, the child on the query's side goes
+        // on the stack first.
+        if (leftfirst) {
+            stackpos++;
+            nodestack[stackpos] = KD_CHILD_LEFT(nodeid);
+            blockstack[stackpos] = leftblock;
+            slotstack[stackpos] = leftslot;
+        }
+        if (goright) {
+            stackpos++;
+            nodestack[stackpos] = KD_CHILD_RIGHT(nodeid);
+            blockstack[stackpos] = rightblock;
+            slotstack[stackpos] = rightslot;
+        }
+        if (!leftfirst && goleft) {
+            stackpos++;
+            nodestack[stackpos] = KD_CHILD_LEFT(nodeid);
+            blockstack[stackpos] = leftblock;
+            slotstack[stackpos] = leftslot;
+        }
+    }
+    return TRUE;
+}
+
 kdtree_qres_t* MANGLE(kdtree_rangesearch_options)
      (const kdtree_t* kd, kdtree_qres_t* res, const void* vquery,
       double maxd2, int options)
@@ -1196,6 +1449,14 @@ kdtree_qres_t* MANGLE(kdtree_rangesearch_options)
         resize_results(res, KDTREE_MAX_RESULTS, D, do_dists, do_points);
     }
 
+    if (use_splits && kd->packed) {
+        if (!rangesearch_packed(kd, res, query, tquery, D, maxd2, maxdist,
+                                tlinf, use_tsplit, do_dists, do_points))
+            return NULL;
+        // (skips the search below)
+        stackpos = -1;
+    }
+
     // queue root.
     nodestack[0] = 0;
 
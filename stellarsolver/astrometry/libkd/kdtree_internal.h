@@ -43,4 +43,20 @@ rtn KDMANGLE(func, d, s, s)args
 */
 int kdtree_compute_levels(int N, int Nleaf);
 
+/* The packed layout made by kdtree_pack() (see kdtree_internal.c).  The
+   blocks are allocated on their own, aligned to a cache line. */
+#define KDTREE_PACKED_LINE 64
+
+typedef struct {
+    int rootlevels;
+    int nblocks;
+    void* blocks;
+} kdtree_packed_t;
+
+void* kdtree_packed_alloc(size_t size);
+
+void kdtree_packed_free(void* blocks);
+
+void kdtree_free_packed(kdtree_t* kd);
+
 #endif
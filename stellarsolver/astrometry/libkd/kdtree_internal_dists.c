@@ -14,6 +14,10 @@ static anbool DIST_FUNC_MANGLE(bb_point_mindist2_exceeds, FUNC_SUFFIX)
     int i;
 #if defined(KD_DIM)
     dim = KD_DIM;
+#endif
+#if defined(SIMD_MINDIST2_EXCEEDS)
+    if (dim >= SIMD_MIN_DIM && dim <= SIMD_MAX_DIM)
+        return SIMD_MINDIST2_EXCEEDS(lo, hi, point, dim, maxd2);
 #endif
     for (i = 0; i < dim; i++) {
         if (point[i] < lo[i])
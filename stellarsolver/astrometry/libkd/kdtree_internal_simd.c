@@ -0,0 +1,181 @@
+/*
+ # This file is part of libkd.
+ # Licensed under a 3-clause BSD style license - see LICENSE
+ */
+
+/*
+ SSE2 kernels for the distances that range searches spend their time
+ in, for the common trees of dimension 2, 3 or 4 with an "external" type
+ of double:
+
+ - the point-to-point distances of the leaf scans (dist2, dist2_bailout
+ .  and dist2_exceeds in kdtree_internal.c), for u16 and u32 "data" types;
+
+ - the point-to-bounding-box distance of the pruning
+ .  (bb_point_mindist2_exceeds in kdtree_internal_dists.c), for u16 and
+ .  u32 "tree" types.
+
+ (For all-double trees the scalar loops, which can stop after the first
+ dimension, are as fast.)
+
+ This file is included by kdtree_internal.c for each type combination,
+ before kdtree_internal_dists.c; it defines KD_SIMD to 1 if the kernels
+ are available.  Other dimensions, and machines without SSE2, use the
+ scalar loops.
+
+ The kernels give bit-identical results to the scalar loops.  Each
+ delta is computed as in the scalar loop (a delta of zero replaces
+ "continue").  The floating-point squares are still summed one by one in
+ dimension order; the scalar loops stop as soon as a partial sum exceeds
+ the limit, so the kernels check every partial sum, which makes NaNs
+ behave the same too.  For the integer types, the sum is computed exactly
+ in 64 bits: the scalar loop says a box is too far if a delta exceeds
+ DELTAMAX, if the sum overflows, or if it exceeds the limit, and each of
+ these happens exactly when the exact sum exceeds the limit.
+ */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define KD_SIMD 1
+#else
+#define KD_SIMD 0
+#endif
+
+#if KD_SIMD
+
+#include <emmintrin.h>
+
+#define SIMD_MIN_DIM 2
+#define SIMD_MAX_DIM 4
+
+// Loads "D" doubles into two vectors holding dimensions (0,1) and (2,3);
+// missing dimensions are zero.
+static inline void simd_load_pd(const double* x, int D,
+                                __m128d* x01, __m128d* x23) {
+    *x01 = _mm_loadu_pd(x);
+    if (D == 4)
+        *x23 = _mm_loadu_pd(x + 2);
+    else if (D == 3)
+        *x23 = _mm_load_sd(x + 2);
+    else
+        *x23 = _mm_setzero_pd();
+}
+
+// Checks each partial sum of the squares in "sq01" and "sq23" against
+// "maxd2", as the scalar loops do; the sum is returned in "d2".
+static inline anbool simd_sum_exceeds(__m128d sq01, __m128d sq23, int D,
+                                      double maxd2, double* d2) {
+    double sum = _mm_cvtsd_f64(sq01);
+    anbool exceeds = (sum > maxd2);
+    sum += _mm_cvtsd_f64(_mm_unpackhi_pd(sq01, sq01));
+    exceeds |= (sum > maxd2);
+    if (D > 2) {
+        sum += _mm_cvtsd_f64(sq23);
+        exceeds |= (sum > maxd2);
+        if (D > 3) {
+            sum += _mm_cvtsd_f64(_mm_unpackhi_pd(sq23, sq23));
+            exceeds |= (sum > maxd2);
+        }
+    }
+    *d2 = sum;
+    return exceeds;
+}
+
+// Sums the four u64 lanes of "a" and "b".
+static inline u64 simd_hsum_epi64(__m128i a, __m128i b) {
+    u64 s[2];
+    _mm_storeu_si128((__m128i*)s, _mm_add_epi64(a, b));
+    return s[0] + s[1];
+}
+
+static inline __m128i simd_load_epu16(const u16* x, int D) {
+    return _mm_setr_epi16((short)x[0], (short)x[1],
+                          (short)(D > 2 ? x[2] : 0), (short)(D > 3 ? x[3] : 0),
+                          0, 0, 0, 0);
+}
+
+// For u16 trees, with both the u16 ("_ttype") and u32 ("_bigttype")
+// distances.
+static inline anbool simd_bb_point_mindist2_exceeds_s(const u16* lo, const u16* hi,
+                                                      const u16* point, int D,
+                                                      u64 maxd2) {
+    __m128i vlo = simd_load_epu16(lo, D);
+    __m128i vhi = simd_load_epu16(hi, D);
+    __m128i vpt = simd_load_epu16(point, D);
+    __m128i zero = _mm_setzero_si128();
+    // saturating: lo - point if point < lo, else 0; likewise point - hi.
+    __m128i below = _mm_subs_epu16(vlo, vpt);
+    __m128i above = _mm_subs_epu16(vpt, vhi);
+    __m128i delta = _mm_or_si128(below, _mm_and_si128(_mm_cmpeq_epi16(below, zero), above));
+    // u32 squares
+    __m128i sq = _mm_unpacklo_epi16(_mm_mullo_epi16(delta, delta),
+                                    _mm_mulhi_epu16(delta, delta));
+    return simd_hsum_epi64(_mm_unpacklo_epi32(sq, zero),
+                           _mm_unpackhi_epi32(sq, zero)) > maxd2;
+}
+
+// For u32 trees, with the u32 ("_ttype") distances only: deltas above
+// 65535 are clamped to 65536, whose square alone exceeds any u32 limit.
+static inline anbool simd_bb_point_mindist2_exceeds_u(const u32* lo, const u32* hi,
+                                                      const u32* point, int D,
+                                                      u64 maxd2) {
+    const __m128i bias = _mm_set1_epi32((int)0x80000000u);
+    __m128i vlo = _mm_setr_epi32((int)lo[0], (int)lo[1],
+                                 (int)(D > 2 ? lo[2] : 0), (int)(D > 3 ? lo[3] : 0));
+    __m128i vhi = _mm_setr_epi32((int)hi[0], (int)hi[1],
+                                 (int)(D > 2 ? hi[2] : 0), (int)(D > 3 ? hi[3] : 0));
+    __m128i vpt = _mm_setr_epi32((int)point[0], (int)point[1],
+                                 (int)(D > 2 ? point[2] : 0), (int)(D > 3 ? point[3] : 0));
+    // SSE2 only has signed compares; flipping the sign bits makes them unsigned.
+    __m128i blo = _mm_xor_si128(vlo, bias);
+    __m128i bhi = _mm_xor_si128(vhi, bias);
+    __m128i bpt = _mm_xor_si128(vpt, bias);
+    __m128i mbelow = _mm_cmpgt_epi32(blo, bpt);
+    __m128i mabove = _mm_cmpgt_epi32(bpt, bhi);
+    __m128i delta, mbig, sq02, sq13;
+    delta = _mm_or_si128(_mm_and_si128(mbelow, _mm_sub_epi32(vlo, vpt)),
+                         _mm_andnot_si128(mbelow, _mm_and_si128(mabove, _mm_sub_epi32(vpt, vhi))));
+    mbig = _mm_cmpgt_epi32(_mm_xor_si128(delta, bias),
+                           _mm_xor_si128(_mm_set1_epi32(UINT16_MAX), bias));
+    delta = _mm_or_si128(_mm_and_si128(mbig, _mm_set1_epi32(UINT16_MAX + 1)),
+                         _mm_andnot_si128(mbig, delta));
+    // u64 squares of lanes 0 and 2, then 1 and 3.
+    sq02 = _mm_mul_epu32(delta, delta);
+    delta = _mm_srli_epi64(delta, 32);
+    sq13 = _mm_mul_epu32(delta, delta);
+    return simd_hsum_epi64(sq02, sq13) > maxd2;
+}
+
+#if ETYPE_DOUBLE && DTYPE_INTEGER
+
+// Loads the "D" coordinates of data point "p", in external space.
+static inline void simd_load_point(const kdtree_t* kd, const dtype* p, int D,
+                                   __m128d* p01, __m128d* p23) {
+    __m128d invscale = _mm_set1_pd(kd->invscale);
+    __m128d min01, min23;
+    simd_load_pd(kd->minval, D, &min01, &min23);
+    // POINT_INVSCALE, without fused multiply-adds.
+    *p01 = _mm_add_pd(_mm_mul_pd(_mm_setr_pd((double)p[0], (double)p[1]), invscale),
+                      min01);
+    *p23 = _mm_add_pd(_mm_mul_pd(_mm_setr_pd(D > 2 ? (double)p[2] : 0.0,
+                                             D > 3 ? (double)p[3] : 0.0), invscale),
+                      min23);
+}
+
+// Like simd_sum_exceeds(), for the squares of (q - p).
+static inline anbool simd_point_dist2_exceeds(const kdtree_t* kd, const etype* q,
+                                              const dtype* p, int D, double maxd2,
+                                              double* d2) {
+    __m128d q01, q23, p01, p23;
+    simd_load_pd(q, D, &q01, &q23);
+    simd_load_point(kd, p, D, &p01, &p23);
+    p01 = _mm_sub_pd(q01, p01);
+    p23 = _mm_sub_pd(q23, p23);
+    return simd_sum_exceeds(_mm_mul_pd(p01, p01), _mm_mul_pd(p23, p23),
+                            D, maxd2, d2);
+}
+
+#define SIMD_POINT_DIST2 1
+
+#endif
+
+#endif
@@ -15,8 +15,12 @@
 #include "an-bool.h"
 #include "log.h" //# Modified by Robert Lancaster for the StellarSolver Internal Library for logging
 
-static pl* estack = NULL;
-static anbool atexit_registered = FALSE;
+//# Modified by Robert Lancaster for the StellarSolver Internal Library, one error stack per thread, freed with errors_free()
+#ifdef _MSC_VER
+static __declspec(thread) pl* estack = NULL;
+#else
+static _Thread_local pl* estack = NULL;
+#endif
 
 static err_t* error_copy(err_t* e) {
     int i, N;
@@ -85,14 +89,8 @@ void errors_clear_stack() {
 }
 
 err_t* errors_get_state() {
-    if (!estack) {
+    if (!estack)
         estack = pl_new(4);
-        // register an atexit() function to clean up.
-        if (!atexit_registered) {
-            if (atexit(errors_free) == 0)
-                atexit_registered = TRUE;
-        }
-    } 
     if (!pl_size(estack)) {
         err_t* e = error_new();
         e->print = stderr;
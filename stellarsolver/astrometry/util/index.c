@@ -3,7 +3,10 @@
  # Licensed under a 3-clause BSD style license - see LICENSE
  */
 
+#include <sys/mman.h>
+
 #include "index.h"
+#include "ssindex.h"
 #include "log.h"
 #include "errors.h"
 #include "ioutils.h"
@@ -141,6 +144,8 @@ anbool index_is_file_index(const char* filename) {
         ERROR("Index file %s is not readable.", quadfn);
         goto finish;
     }
+    if (singlefile && ssindex_is_file(quadfn))
+        goto finish;
     if (!singlefile) {
         if (!file_readable(ckdtfn)) {
             ERROR("Index file %s is not readable.", ckdtfn);
@@ -191,6 +196,70 @@ int index_get_meta(const char* filename, index_t* meta) {
     return 0;
 }
 
+char* index_get_meta_string(const index_t* meta) {
+    char* str;
+    asprintf_safe(&str, "%i %i %i %.17g %.17g %i %i %i %i %i %i %.17g %i %i %.17g %i %s",
+                  meta->indexid, meta->healpix, meta->hpnside,
+                  meta->index_scale_lower, meta->index_scale_upper,
+                  meta->dimquads, meta->nstars, meta->nquads,
+                  (int)meta->circle, (int)meta->cx_less_than_dx,
+                  (int)meta->meanx_less_than_half, meta->index_jitter,
+                  meta->cutnside, meta->cutnsweep, meta->cutdedup, meta->cutmargin,
+                  (meta->cutband && meta->cutband[0]) ? meta->cutband : "-");
+    return str;
+}
+
+index_t* index_load_from_meta_string(const char* indexname, const char* metastr,
+                                     int flags) {
+    index_t* dest;
+    anbool singlefile;
+    int circle, cxdx, meanx;
+    char band[64];
+
+    dest = calloc(1, sizeof(index_t));
+    if (sscanf(metastr, "%i %i %i %lg %lg %i %i %i %i %i %i %lg %i %i %lg %i %63s",
+               &dest->indexid, &dest->healpix, &dest->hpnside,
+               &dest->index_scale_lower, &dest->index_scale_upper,
+               &dest->dimquads, &dest->nstars, &dest->nquads,
+               &circle, &cxdx, &meanx, &dest->index_jitter,
+               &dest->cutnside, &dest->cutnsweep, &dest->cutdedup, &dest->cutmargin,
+               band) != 17) {
+        ERROR("Failed to parse the metadata of index %s: \"%s\"", indexname, metastr);
+        free(dest);
+        return NULL;
+    }
+    dest->circle = circle;
+    dest->cx_less_than_dx = cxdx;
+    dest->meanx_less_than_half = meanx;
+    dest->cutband = streq(band, "-") ? NULL : strdup(band);
+
+    get_filenames(indexname, &(dest->quadfn), &(dest->codefn), &(dest->starfn),
+                  &singlefile);
+    // index_load names the index after its quad file.
+    dest->indexname = strdup(dest->quadfn);
+    dest->hugepages = (flags & INDEX_USE_HUGE_PAGES) && !(flags & INDEX_ONLY_LOAD_METADATA);
+    dest->packcodetree = (flags & INDEX_PACK_CODE_TREE) && !(flags & INDEX_ONLY_LOAD_METADATA);
+
+    if (!(flags & INDEX_ONLY_LOAD_METADATA)) {
+        if (singlefile && ssindex_is_file(dest->quadfn))
+            dest->native = TRUE;
+        else if (singlefile) {
+            dest->fits = anqfits_open(dest->quadfn);
+            if (!dest->fits) {
+                ERROR("Failed to open FITS file %s", dest->quadfn);
+                goto bailout;
+            }
+        }
+        if (index_reload(dest))
+            goto bailout;
+    }
+    return dest;
+
+ bailout:
+    index_free(dest);
+    return NULL;
+}
+
 int index_get_missing_cut_params(int indexid, int* hpnside, int* nsweep,
                                  double* dedup, int* margin, char** pband) {
     // The 200-series indices use cut 100 (usnob)
@@ -347,9 +416,25 @@ index_t* index_load(const char* indexname, int flags, index_t* dest) {
         memset(dest, 0, sizeof(index_t));
 
     dest->indexname = strdup(indexname);
+    dest->hugepages = (flags & INDEX_USE_HUGE_PAGES) && !(flags & INDEX_ONLY_LOAD_METADATA);
+    dest->packcodetree = (flags & INDEX_PACK_CODE_TREE) && !(flags & INDEX_ONLY_LOAD_METADATA);
 
     get_filenames(indexname, &(dest->quadfn), &(dest->codefn), &(dest->starfn),
                   &singlefile);
+    if (singlefile && ssindex_is_file(dest->quadfn)) {
+        // A native index carries its metadata in its header.
+        if (ssindex_load_meta(dest->quadfn, dest))
+            goto bailout;
+        free(dest->indexname);
+        dest->indexname = strdup(dest->quadfn);
+        logverb("Index scale: [%g, %g] arcmin, [%g, %g] arcsec\n",
+                dest->index_scale_lower / 60.0, dest->index_scale_upper / 60.0,
+                dest->index_scale_lower, dest->index_scale_upper);
+        // index_reload() also moves it to huge pages and packs its code tree.
+        if (!(flags & INDEX_ONLY_LOAD_METADATA) && index_reload(dest))
+            goto bailout;
+        return dest;
+    }
     if (singlefile) {
         dest->fits = anqfits_open(dest->quadfn);
         if (!dest->fits) {
@@ -390,7 +475,126 @@ index_t* index_load(const char* indexname, int flags, index_t* dest) {
     return NULL;
 }
 
+static int reload_files(index_t* index);
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// kdtree_sizeof_bb() counts one corner of each node; a tree holds both
+// corners of its n_bb boxes.
+static size_t sizeof_bboxes(const kdtree_t* kd) {
+    if (!kd->bb.any || !kd->nnodes)
+        return 0;
+    return kdtree_sizeof_bb(kd) / kd->nnodes * 2 * kd->n_bb;
+}
+
+static size_t sizeof_hot_arrays(const kdtree_t* kd) {
+    return sizeof_bboxes(kd) +
+        (kd->split.any ? kdtree_sizeof_split(kd) : 0) +
+        (kd->splitdim ? kdtree_sizeof_splitdim(kd) : 0) +
+        kdtree_sizeof_data(kd);
+}
+
+// Copies "size" bytes of "array" to "*dest" and returns the copy; keeps
+// the copies 64-byte aligned.
+static void* move_array(void* array, size_t size, char** dest) {
+    void* copy = *dest;
+    if (!array || !size)
+        return array;
+    memcpy(copy, array, size);
+    *dest += (size + 63) & ~(size_t)63;
+    return copy;
+}
+
+static void move_hot_arrays(kdtree_t* kd, char** dest) {
+    kd->bb.any = move_array(kd->bb.any, sizeof_bboxes(kd), dest);
+    kd->split.any = move_array(kd->split.any, kdtree_sizeof_split(kd), dest);
+    kd->splitdim = move_array(kd->splitdim, kdtree_sizeof_splitdim(kd), dest);
+    kd->data.any = move_array(kd->data.any, kdtree_sizeof_data(kd), dest);
+}
+
+/*
+ The node bounding boxes, split values and data of the star and code trees
+ are what the quad search walks through, spread over many megabytes, which
+ makes it miss the TLB all the time when it is backed by 4 kB pages.  This
+ copies them into anonymous memory backed by huge pages: explicit ones
+ (MAP_HUGETLB) if the system has some reserved, transparent ones otherwise.
+ If neither is available the index is left where it is.
+ */
+static int move_to_huge_pages(index_t* index) {
+#if !defined(_WIN32) && (defined(MAP_HUGETLB) || defined(MADV_HUGEPAGE))
+    kdtree_t* starkd = index->starkd->tree;
+    kdtree_t* codekd = index->codekd->tree;
+    // (plus the alignment padding of the eight arrays)
+    size_t size = sizeof_hot_arrays(starkd) + sizeof_hot_arrays(codekd) + 8 * 64;
+    size_t mapsize = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    char* map = MAP_FAILED;
+    const char* kind = NULL;
+    char* dest;
+
+#ifdef MAP_HUGETLB
+    map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (map != MAP_FAILED)
+        kind = "explicit";
+#endif
+#ifdef MADV_HUGEPAGE
+    if (map == MAP_FAILED) {
+        // Transparent huge pages need a 2 MB aligned range, so over-allocate
+        // and trim the ends.
+        char* raw = mmap(NULL, mapsize + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            size_t head = (HUGE_PAGE_SIZE - ((uintptr_t)raw % HUGE_PAGE_SIZE)) % HUGE_PAGE_SIZE;
+            map = raw + head;
+            if (head)
+                munmap(raw, head);
+            munmap(map + mapsize, HUGE_PAGE_SIZE - head);
+            if (madvise(map, mapsize, MADV_HUGEPAGE) == 0)
+                kind = "transparent";
+            else {
+                munmap(map, mapsize);
+                map = MAP_FAILED;
+            }
+        }
+    }
+#endif
+    if (map == MAP_FAILED) {
+        logverb("No huge pages available for index %s; searching it in place.\n",
+                index->indexname);
+        return -1;
+    }
+
+    dest = map;
+    move_hot_arrays(starkd, &dest);
+    move_hot_arrays(codekd, &dest);
+    index->hugemap = map;
+    index->hugemapsize = mapsize;
+    logverb("Moved %.1f MB of kd-trees of index %s to %s huge pages.\n",
+            (double)(dest - map) * 1e-6, index->indexname, kind);
+    return 0;
+#else
+    logverb("Huge pages are not supported here; searching index %s in place.\n",
+            index->indexname);
+    return -1;
+#endif
+}
+
 int index_reload(index_t* index) {
+    if (index->native) {
+        if (ssindex_reload(index))
+            return -1;
+    } else if (reload_files(index))
+        return -1;
+    if (index->hugepages && !index->hugemap)
+        // If this fails the index is still usable from its files.
+        move_to_huge_pages(index);
+    // (the packed copy is freed with the tree)
+    if (index->packcodetree && kdtree_pack(index->codekd->tree))
+        logverb("Searching the code tree of index %s in heap order.\n", index->indexname);
+    return 0;
+}
+
+static int reload_files(index_t* index) {
     // Read .skdt file...
     if (!index->starkd) {
         if (index->fits)
@@ -439,6 +643,8 @@ int index_reload(index_t* index) {
 }
 
 void index_unload(index_t* index) {
+    if (index->native)
+        ssindex_unload(index);
     if (index->starkd) {
         startree_close(index->starkd);
         index->starkd = NULL;
@@ -451,10 +657,19 @@ void index_unload(index_t* index) {
         quadfile_close(index->quads);
         index->quads = NULL;
     }
+    // The trees pointed into this, so it goes after them.
+    if (index->hugemap) {
+        munmap(index->hugemap, index->hugemapsize);
+        index->hugemap = NULL;
+        index->hugemapsize = 0;
+    }
 }
 
 int index_close_fds(index_t* ind) {
     kdtree_fits_t* io;
+    // A native index keeps no files open, only its mapping.
+    if (ind->native)
+        return 0;
     if (ind->quads->fb->fid) {
         if (fclose(ind->quads->fb->fid)) {
             SYSERROR("Failed to fclose() an astrometry_net_data quadfile");
@@ -136,6 +136,14 @@ void setAstroLogger(AstrometryLogger* logger)
     get_logger()->astroLogger = logger;
 }
 
+void log_get_settings(log_t* dest) {
+    memcpy(dest, get_logger(), sizeof(log_t));
+}
+
+void log_set_settings(const log_t* src) {
+    memcpy(get_logger(), src, sizeof(log_t));
+}
+
 void logerr(const char* text, ...){
     va_list va;
     va_start(va, text);
@@ -179,17 +187,20 @@ void log_this(const char* text, enum log_level level, va_list va){
         return;
 
     if (logger->f && astrometryLogToFile == 1) {
-        if (logger->timestamp)
-            fprintf(logger->f, "[ %.3f] ", timenow() - logger->t0);
-        vfprintf(logger->f, text, va);
-        fflush(logger->f);
+        // Threads that share a logger (see log_set_settings()) take turns.
+#ifdef _OPENMP
+#pragma omp critical(log_this)
+#endif
+        {
+            if (logger->timestamp)
+                fprintf(logger->f, "[ %.3f] ", timenow() - logger->t0);
+            vfprintf(logger->f, text, va);
+            fflush(logger->f);
+        }
     }
-    else{
-        char *formatted = NULL;
-        vasprintf(&formatted, text, va);
-        if(get_logger()->astroLogger)
-            logFromAstrometry(get_logger()->astroLogger, formatted);
-        free(formatted);
+    else if(logger->astroLogger) {
+        // (formatted straight into the AstrometryLogger's buffer, without locking)
+        logFromAstrometryV(logger->astroLogger, text, va);
     }
 }
 
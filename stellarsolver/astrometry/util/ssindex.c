@@ -0,0 +1,441 @@
+/*
+ # This file is part of the Astrometry.net suite.
+ # Licensed under a 3-clause BSD style license - see LICENSE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "ssindex.h"
+#include "kdtree.h"
+#include "ioutils.h"
+#include "starutil.h"
+#include "errors.h"
+#include "log.h"
+
+static size_t tree_type_size(const ssindex_tree_t* t) {
+    switch (t->treetype & KDT_TREE_MASK) {
+    case KDT_TREE_DOUBLE: return sizeof(double);
+    case KDT_TREE_FLOAT:  return sizeof(float);
+    case KDT_TREE_U32:    return sizeof(u32);
+    case KDT_TREE_U16:    return sizeof(u16);
+    }
+    return 0;
+}
+
+static size_t data_type_size(const ssindex_tree_t* t) {
+    switch (t->treetype & KDT_DATA_MASK) {
+    case KDT_DATA_DOUBLE: return sizeof(double);
+    case KDT_DATA_FLOAT:  return sizeof(float);
+    case KDT_DATA_U32:    return sizeof(u32);
+    case KDT_DATA_U16:    return sizeof(u16);
+    }
+    return 0;
+}
+
+anbool ssindex_is_file(const char* filename) {
+    char magic[8];
+    FILE* fid = fopen(filename, "rb");
+    anbool rtn;
+    if (!fid)
+        return FALSE;
+    rtn = (fread(magic, 1, sizeof(magic), fid) == sizeof(magic) &&
+           memcmp(magic, SSINDEX_MAGIC, sizeof(magic)) == 0);
+    fclose(fid);
+    return rtn;
+}
+
+// Writing: the sections go one after the other, each padded to SSINDEX_ALIGN.
+
+typedef struct {
+    FILE* fid;
+    uint64_t pos;
+    ssindex_header_t* hdr;
+} writer_t;
+
+static int write_section(writer_t* w, int section, const void* data, size_t size) {
+    static const char zeros[SSINDEX_ALIGN];
+    uint64_t start = (w->pos + SSINDEX_ALIGN - 1) / SSINDEX_ALIGN * SSINDEX_ALIGN;
+    if (!data || !size)
+        return 0;
+    if (fwrite(zeros, 1, start - w->pos, w->fid) != start - w->pos ||
+        fwrite(data, 1, size, w->fid) != size) {
+        SYSERROR("Failed to write native index section %i", section);
+        return -1;
+    }
+    w->hdr->sections[section].offset = start;
+    w->hdr->sections[section].size = size;
+    w->pos = start + size;
+    return 0;
+}
+
+// Fills in the description of "kd" in the header and writes its arrays,
+// converted to an all-double tree with the same nodes if "expand" is set.
+static int write_tree(writer_t* w, int which, const kdtree_t* kd, anbool expand) {
+    ssindex_tree_t* t = w->hdr->trees + which;
+    int first = which * SSINDEX_N_TREE_SECTIONS;
+    int D = kd->ndim;
+    int* invperm = NULL;
+    double* range = NULL;
+    double* data = NULL;
+    double* bb = NULL;
+    double* split = NULL;
+    u8* splitdim = NULL;
+    int i, rtn = -1;
+
+    expand = expand && (kd->treetype != KDTT_DOUBLE);
+
+    t->treetype = expand ? KDTT_DOUBLE : kd->treetype;
+    t->ndata = kd->ndata;
+    t->ndim = kd->ndim;
+    t->nnodes = kd->nnodes;
+    t->has_linear_lr = kd->has_linear_lr;
+    t->n_bb = kd->bb.any ? kd->n_bb : 0;
+    t->dimbits = kd->dimbits;
+    t->dimmask = kd->dimmask;
+    t->splitmask = kd->splitmask;
+    t->scale = kd->scale;
+    t->invscale = kd->invscale;
+
+    if (write_section(w, first + SSINDEX_LR, kd->lr, sizeof(int32_t) * kd->nbottom) ||
+        write_section(w, first + SSINDEX_PERM, kd->perm, sizeof(u32) * kd->ndata))
+        goto bailout;
+    if (kd->perm) {
+        invperm = malloc(sizeof(int) * kd->ndata);
+        kdtree_inverse_permutation(kd, invperm);
+        if (write_section(w, first + SSINDEX_INVPERM, invperm, sizeof(int) * kd->ndata))
+            goto bailout;
+    }
+
+    if (!expand) {
+        size_t tsize = tree_type_size(t);
+        if (write_section(w, first + SSINDEX_BB, kd->bb.any, tsize * 2 * D * t->n_bb) ||
+            write_section(w, first + SSINDEX_SPLIT, kd->split.any, tsize * kd->ninterior) ||
+            write_section(w, first + SSINDEX_SPLITDIM, kd->splitdim, sizeof(u8) * kd->ninterior) ||
+            write_section(w, first + SSINDEX_DATA, kd->data.any, data_type_size(t) * D * kd->ndata))
+            goto bailout;
+        if (kd->minval && kd->maxval) {
+            range = malloc(sizeof(double) * (2 * D + 1));
+            memcpy(range, kd->minval, sizeof(double) * D);
+            memcpy(range + D, kd->maxval, sizeof(double) * D);
+            range[2 * D] = kd->scale;
+            if (write_section(w, first + SSINDEX_RANGE, range, sizeof(double) * (2 * D + 1)))
+                goto bailout;
+        }
+        rtn = 0;
+        goto bailout;
+    }
+
+    // The bounding boxes and split positions in external (double) units
+    // still bound the same points, which are converted the same way.
+    if (kd->bb.any) {
+        bb = malloc(sizeof(double) * 2 * D * t->n_bb);
+        for (i=0; i<t->n_bb; i++)
+            kd->fun.get_bboxes(kd, i, bb + 2 * D * i, bb + 2 * D * i + D);
+    }
+    if (kd->split.any) {
+        split = malloc(sizeof(double) * kd->ninterior);
+        splitdim = malloc(sizeof(u8) * kd->ninterior);
+        for (i=0; i<kd->ninterior; i++) {
+            split[i] = kd->fun.get_splitval(kd, i);
+            if (kd->splitdim)
+                splitdim[i] = kd->splitdim[i];
+            else if ((kd->treetype & KDT_TREE_MASK) == KDT_TREE_U16)
+                splitdim[i] = kd->split.s[i] & kd->dimmask;
+            else
+                splitdim[i] = kd->split.u[i] & kd->dimmask;
+        }
+        // A double tree always keeps the split dimension separately.
+        t->splitmask = UINT32_MAX;
+        t->dimbits = 0;
+        t->dimmask = 0;
+    }
+    data = malloc(sizeof(double) * D * kd->ndata);
+    kdtree_copy_data_double(kd, 0, kd->ndata, data);
+    t->scale = 0.0;
+    t->invscale = 0.0;
+
+    if (write_section(w, first + SSINDEX_BB, bb, sizeof(double) * 2 * D * t->n_bb) ||
+        write_section(w, first + SSINDEX_SPLIT, split, sizeof(double) * kd->ninterior) ||
+        write_section(w, first + SSINDEX_SPLITDIM, splitdim, sizeof(u8) * kd->ninterior) ||
+        write_section(w, first + SSINDEX_DATA, data, sizeof(double) * D * kd->ndata))
+        goto bailout;
+    rtn = 0;
+
+ bailout:
+    free(invperm);
+    free(range);
+    free(data);
+    free(bb);
+    free(split);
+    free(splitdim);
+    return rtn;
+}
+
+int ssindex_write(const index_t* index, const char* outfn, anbool expand) {
+    ssindex_header_t hdr;
+    writer_t w;
+    quadfile_t* quads = index->quads;
+
+    if (!index->starkd || !index->codekd || !index->quads) {
+        ERROR("Index %s must be loaded to convert it", index->indexname);
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SSINDEX_MAGIC, sizeof(hdr.magic));
+    hdr.version = SSINDEX_VERSION;
+    hdr.endian = SSINDEX_ENDIAN;
+    hdr.headersize = sizeof(hdr);
+    hdr.indexid = index->indexid;
+    hdr.healpix = index->healpix;
+    hdr.hpnside = index->hpnside;
+    hdr.dimquads = index->dimquads;
+    hdr.nstars = index->nstars;
+    hdr.nquads = index->nquads;
+    hdr.circle = index->circle;
+    hdr.cx_less_than_dx = index->cx_less_than_dx;
+    hdr.meanx_less_than_half = index->meanx_less_than_half;
+    hdr.cutnside = index->cutnside;
+    hdr.cutnsweep = index->cutnsweep;
+    hdr.cutmargin = index->cutmargin;
+    hdr.index_jitter = index->index_jitter;
+    hdr.cutdedup = index->cutdedup;
+    hdr.index_scale_lower = index->index_scale_lower;
+    hdr.index_scale_upper = index->index_scale_upper;
+    if (index->cutband)
+        strncpy(hdr.cutband, index->cutband, sizeof(hdr.cutband) - 1);
+
+    w.fid = fopen(outfn, "wb");
+    if (!w.fid) {
+        SYSERROR("Failed to open native index %s for writing", outfn);
+        return -1;
+    }
+    w.hdr = &hdr;
+    // The header is written again at the end, once the sections are known.
+    w.pos = fwrite(&hdr, 1, sizeof(hdr), w.fid);
+    if (w.pos != sizeof(hdr) ||
+        write_tree(&w, SSINDEX_STARS, index->starkd->tree, expand) ||
+        write_tree(&w, SSINDEX_CODES, index->codekd->tree, expand) ||
+        write_section(&w, SSINDEX_QUADS, quads->quadarray,
+                      sizeof(uint32_t) * quads->dimquads * (size_t)quads->numquads) ||
+        write_section(&w, SSINDEX_SWEEP, index->starkd->sweep,
+                      index->starkd->sweep ? sizeof(uint8_t) * index->starkd->tree->ndata : 0))
+        goto bailout;
+    if (fseek(w.fid, 0, SEEK_SET) ||
+        fwrite(&hdr, 1, sizeof(hdr), w.fid) != sizeof(hdr)) {
+        SYSERROR("Failed to write the header of native index %s", outfn);
+        goto bailout;
+    }
+    if (fclose(w.fid)) {
+        SYSERROR("Failed to close native index %s", outfn);
+        remove(outfn);
+        return -1;
+    }
+    return 0;
+
+ bailout:
+    fclose(w.fid);
+    remove(outfn);
+    return -1;
+}
+
+static int read_header(const char* filename, ssindex_header_t* hdr) {
+    FILE* fid = fopen(filename, "rb");
+    size_t nread;
+    if (!fid) {
+        SYSERROR("Failed to open native index %s", filename);
+        return -1;
+    }
+    nread = fread(hdr, 1, sizeof(ssindex_header_t), fid);
+    fclose(fid);
+    if (nread != sizeof(ssindex_header_t) ||
+        memcmp(hdr->magic, SSINDEX_MAGIC, sizeof(hdr->magic))) {
+        ERROR("File %s is not a native index", filename);
+        return -1;
+    }
+    if (hdr->endian != SSINDEX_ENDIAN) {
+        ERROR("Native index %s was converted on a machine with the other byte order", filename);
+        return -1;
+    }
+    if (hdr->version != SSINDEX_VERSION || hdr->headersize != sizeof(ssindex_header_t)) {
+        ERROR("Native index %s has version %u, expected %u; convert it again",
+              filename, hdr->version, SSINDEX_VERSION);
+        return -1;
+    }
+    return 0;
+}
+
+int ssindex_load_meta(const char* filename, index_t* dest) {
+    ssindex_header_t hdr;
+    if (read_header(filename, &hdr))
+        return -1;
+    dest->native = TRUE;
+    dest->indexid = hdr.indexid;
+    dest->healpix = hdr.healpix;
+    dest->hpnside = hdr.hpnside;
+    dest->dimquads = hdr.dimquads;
+    dest->nstars = hdr.nstars;
+    dest->nquads = hdr.nquads;
+    dest->circle = hdr.circle;
+    dest->cx_less_than_dx = hdr.cx_less_than_dx;
+    dest->meanx_less_than_half = hdr.meanx_less_than_half;
+    dest->cutnside = hdr.cutnside;
+    dest->cutnsweep = hdr.cutnsweep;
+    dest->cutmargin = hdr.cutmargin;
+    dest->index_jitter = hdr.index_jitter;
+    dest->cutdedup = hdr.cutdedup;
+    dest->index_scale_lower = hdr.index_scale_lower;
+    dest->index_scale_upper = hdr.index_scale_upper;
+    hdr.cutband[sizeof(hdr.cutband) - 1] = '\0';
+    free(dest->cutband);
+    dest->cutband = hdr.cutband[0] ? strdup(hdr.cutband) : NULL;
+    return 0;
+}
+
+// Returns the start of the given section in the mapping, or NULL if it is absent.
+static void* section(const index_t* index, const ssindex_header_t* hdr, int s) {
+    if (!hdr->sections[s].offset)
+        return NULL;
+    return index->nativemap + hdr->sections[s].offset;
+}
+
+static kdtree_t* map_tree(const index_t* index, const ssindex_header_t* hdr, int which) {
+    const ssindex_tree_t* t = hdr->trees + which;
+    int first = which * SSINDEX_N_TREE_SECTIONS;
+    double* range;
+    kdtree_t* kd = calloc(1, sizeof(kdtree_t));
+
+    kd->treetype = t->treetype;
+    kd->ndata = t->ndata;
+    kd->ndim = t->ndim;
+    kd->nnodes = t->nnodes;
+    kd->nbottom = (t->nnodes + 1) / 2;
+    kd->ninterior = t->nnodes - kd->nbottom;
+    kd->nlevels = kdtree_nnodes_to_nlevels(t->nnodes);
+    kd->has_linear_lr = t->has_linear_lr;
+    kd->n_bb = t->n_bb;
+    kd->dimbits = t->dimbits;
+    kd->dimmask = t->dimmask;
+    kd->splitmask = t->splitmask;
+    kd->scale = t->scale;
+    kd->invscale = t->invscale;
+
+    kd->lr = section(index, hdr, first + SSINDEX_LR);
+    kd->perm = section(index, hdr, first + SSINDEX_PERM);
+    kd->bb.any = section(index, hdr, first + SSINDEX_BB);
+    kd->split.any = section(index, hdr, first + SSINDEX_SPLIT);
+    kd->splitdim = section(index, hdr, first + SSINDEX_SPLITDIM);
+    kd->data.any = section(index, hdr, first + SSINDEX_DATA);
+    range = section(index, hdr, first + SSINDEX_RANGE);
+    if (range) {
+        kd->minval = range;
+        kd->maxval = range + kd->ndim;
+    }
+    if (!kd->data.any || !(kd->bb.any || kd->split.any)) {
+        ERROR("Native index %s has no data or structure for its %s tree",
+              index->indexname, which == SSINDEX_STARS ? "star" : "code");
+        free(kd);
+        return NULL;
+    }
+    kdtree_update_funcs(kd);
+    return kd;
+}
+
+int ssindex_reload(index_t* index) {
+    ssindex_header_t hdr;
+    struct stat st;
+    FILE* fid;
+    int i;
+
+    if (index->nativemap)
+        return 0;
+    if (read_header(index->quadfn, &hdr))
+        return -1;
+    fid = fopen(index->quadfn, "rb");
+    if (!fid || fstat(fileno(fid), &st)) {
+        SYSERROR("Failed to open native index %s", index->quadfn);
+        if (fid)
+            fclose(fid);
+        return -1;
+    }
+    for (i=0; i<SSINDEX_N_SECTIONS; i++) {
+        if (hdr.sections[i].offset &&
+            hdr.sections[i].offset + hdr.sections[i].size > (uint64_t)st.st_size) {
+            ERROR("Native index %s is truncated", index->quadfn);
+            fclose(fid);
+            return -1;
+        }
+    }
+    index->nativemapsize = st.st_size;
+#ifdef _WIN32 //# Modified by Robert Lancaster for the StellarSolver Internal Library
+    index->nativemap = mmap_file(fileno(fid), index->nativemapsize);
+#else
+    index->nativemap = mmap(0, index->nativemapsize, PROT_READ, MAP_SHARED, fileno(fid), 0);
+#endif
+    // The mapping stays valid after the file is closed.
+    fclose(fid);
+    if (index->nativemap == MAP_FAILED || index->nativemap == NULL) {
+        SYSERROR("Couldn't mmap native index %s", index->quadfn);
+        index->nativemap = NULL;
+        return -1;
+    }
+
+    index->starkd = calloc(1, sizeof(startree_t));
+    index->codekd = calloc(1, sizeof(codetree_t));
+    index->quads = calloc(1, sizeof(quadfile_t));
+    index->starkd->tree = map_tree(index, &hdr, SSINDEX_STARS);
+    index->codekd->tree = map_tree(index, &hdr, SSINDEX_CODES);
+    if (!index->starkd->tree || !index->codekd->tree) {
+        ssindex_unload(index);
+        return -1;
+    }
+    index->starkd->inverse_perm = section(index, &hdr, SSINDEX_INVPERM);
+    index->starkd->sweep = section(index, &hdr, SSINDEX_SWEEP);
+    index->codekd->inverse_perm = section(index, &hdr, SSINDEX_N_TREE_SECTIONS + SSINDEX_INVPERM);
+
+    index->quads->numquads = hdr.nquads;
+    index->quads->numstars = hdr.nstars;
+    index->quads->dimquads = hdr.dimquads;
+    // quadfile_t keeps the scales in radians.
+    index->quads->index_scale_lower = arcsec2rad(hdr.index_scale_lower);
+    index->quads->index_scale_upper = arcsec2rad(hdr.index_scale_upper);
+    index->quads->indexid = hdr.indexid;
+    index->quads->healpix = hdr.healpix;
+    index->quads->hpnside = hdr.hpnside;
+    index->quads->quadarray = section(index, &hdr, SSINDEX_QUADS);
+    return 0;
+}
+
+void ssindex_unload(index_t* index) {
+    // The inverse permutations live in the mapping, don't let the trees free them.
+    if (index->starkd) {
+        index->starkd->inverse_perm = NULL;
+        index->starkd->sweep = NULL;
+        startree_close(index->starkd);
+        index->starkd = NULL;
+    }
+    if (index->codekd) {
+        index->codekd->inverse_perm = NULL;
+        codetree_close(index->codekd);
+        index->codekd = NULL;
+    }
+    if (index->quads) {
+        quadfile_close(index->quads);
+        index->quads = NULL;
+    }
+    if (index->nativemap) {
+        if (munmap(index->nativemap, index->nativemapsize))
+            SYSERROR("Failed to munmap native index %s", index->quadfn);
+        index->nativemap = NULL;
+        index->nativemapsize = 0;
+    }
+}
@@ -9,17 +9,115 @@
 //Project Includes
 #include "astrometrylogger.h"
 
+//System Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 AstrometryLogger::AstrometryLogger()
 {
-    timeSinceLastOutput.start();
     connect(&logUpdater, &QTimer::timeout, this, &AstrometryLogger::updateLog);
     logUpdater.start(100);
 }
 
-void AstrometryLogger::logFromAstrometry(char* text)
+AstrometryLogger::~AstrometryLogger()
 {
-    logText += text;
-    updateLog();
+    Ring *r = ring.loadAcquire();
+    if(r)
+    {
+        for(quint32 i = 0; i < Ring::size; i++)
+            free(r->records[i].longText);
+        delete r;
+    }
+}
+
+void AstrometryLogger::start()
+{
+    if(ring.loadAcquire())
+        return;
+    Ring *r = new Ring;
+    r->enqueuePos.storeRelaxed(0);
+    r->dropped.storeRelaxed(0);
+    for(quint32 i = 0; i < Ring::size; i++)
+    {
+        r->records[i].sequence.storeRelaxed(i);
+        r->records[i].longText = nullptr;
+    }
+    ring.storeRelease(r);
+}
+
+// The ring is a bounded queue for several producers: the record at position pos is free for the thread that claims
+// pos when its sequence is pos, and it is ready for updateLog when its sequence is pos + 1.
+AstrometryLogger::Record *AstrometryLogger::claim(quint32 &pos)
+{
+    Ring *r = ring.loadAcquire();
+    if(!r)
+        return nullptr;
+
+    pos = r->enqueuePos.loadRelaxed();
+    for(;;)
+    {
+        Record *record = &r->records[pos & (Ring::size - 1)];
+        qint32 diff = qint32(record->sequence.loadAcquire() - pos);
+        if(diff == 0)
+        {
+            if(r->enqueuePos.testAndSetRelaxed(pos, pos + 1, pos))
+                return record;
+        }
+        else if(diff < 0)
+        {
+            r->dropped.fetchAndAddRelaxed(1);
+            return nullptr;
+        }
+        else
+            pos = r->enqueuePos.loadRelaxed();
+    }
+}
+
+void AstrometryLogger::publish(Record *record, quint32 pos)
+{
+    record->sequence.storeRelease(pos + 1);
+}
+
+void AstrometryLogger::logFromAstrometry(const char* text)
+{
+    quint32 pos;
+    Record *record = claim(pos);
+    if(!record)
+        return;
+    size_t length = strlen(text);
+    if(length < sizeof(record->text))
+    {
+        memcpy(record->text, text, length + 1);
+        record->longText = nullptr;
+    }
+    else
+    {
+        record->longText = (char*)malloc(length + 1);
+        if(record->longText)
+            memcpy(record->longText, text, length + 1);
+    }
+    publish(record, pos);
+}
+
+void AstrometryLogger::logFromAstrometry(const char* format, va_list va)
+{
+    quint32 pos;
+    Record *record = claim(pos);
+    if(!record)
+        return;
+    va_list copy;
+    va_copy(copy, va);
+    record->longText = nullptr;
+    int length = vsnprintf(record->text, sizeof(record->text), format, va);
+    if(length >= (int)sizeof(record->text))
+    {
+        record->longText = (char*)malloc(length + 1);
+        if(record->longText)
+            vsnprintf(record->longText, length + 1, format, copy);
+    }
+    va_end(copy);
+    publish(record, pos);
 }
 
 EXPORT_C void logFromAstrometry(AstrometryLogger* astroLogger, char* text)
@@ -27,17 +125,44 @@ EXPORT_C void logFromAstrometry(AstrometryLogger* astroLogger, char* text)
     return astroLogger->logFromAstrometry(text);
 }
 
+EXPORT_C void logFromAstrometryV(AstrometryLogger* astroLogger, const char* format, va_list va)
+{
+    return astroLogger->logFromAstrometry(format, va);
+}
+
 void AstrometryLogger::updateLog()
 {
-    if(readyToLog())
+    Ring *r = ring.loadAcquire();
+    if(!r)
+        return;
+
+    QMutexLocker locker(&drainMutex);
+    QString logText;
+    for(;;)
     {
-        emit logOutput(logText);
-        timeSinceLastOutput.restart();
-        logText = "";
+        Record &record = r->records[r->dequeuePos & (Ring::size - 1)];
+        if(record.sequence.loadAcquire() != r->dequeuePos + 1)
+            break;
+        if(record.longText)
+        {
+            logText += QString::fromUtf8(record.longText);
+            free(record.longText);
+            record.longText = nullptr;
+        }
+        else
+            logText += QString::fromUtf8(record.text);
+        record.sequence.storeRelease(r->dequeuePos + Ring::size);
+        r->dequeuePos++;
     }
+
+    int dropped = r->dropped.fetchAndStoreRelaxed(0);
+    if(dropped > 0)
+        logText += QString("(%1 lines of the astrometry.net log were dropped, it was logging faster than they could be shown)\n").arg(dropped);
+    if(logText.length() > 0)
+        emit logOutput(logText);
 }
 
-bool AstrometryLogger::readyToLog()
+void AstrometryLogger::flush()
 {
-    return timeSinceLastOutput.elapsed() > 100 && logText.length() > 0;
+    updateLog();
 }
@@ -8,12 +8,16 @@
 #ifndef ASTROMETRYLOGGER_H
 #define ASTROMETRYLOGGER_H
 
+#include <stdarg.h>
+
 #ifdef __cplusplus
 
 //Qt Includes
 #include <QObject>
-#include <QElapsedTimer>
 #include <QTimer>
+#include <QAtomicInteger>
+#include <QAtomicPointer>
+#include <QMutex>
 
 class AstrometryLogger: public QObject
 {
@@ -21,27 +25,69 @@ class AstrometryLogger: public QObject
 public:
 
     AstrometryLogger();
+    ~AstrometryLogger();
+
+    /**
+     * @brief start gets the logger ready to take text from astrometry.net.  It should be called by the thread that will solve, before setAstroLogger.
+     */
+    void start();
+
+    /**
+     * @brief flush logs all the text that is waiting right away, for instance when the solve is done
+     */
+    void flush();
 
     /**
      * @brief logFromAstrometry is the C++ method called by astrometry.net to get the text so that the logging can happen
      * @param text is the information to be logged when ready
      */
-    void logFromAstrometry(char* text);
+    void logFromAstrometry(const char* text);
+
+    /**
+     * @brief logFromAstrometry formats the text to log straight into the buffer, so the solving threads never wait for the logging
+     * @param format is the printf style format of the text
+     * @param va is the list of values for the format
+     */
+    void logFromAstrometry(const char* format, va_list va);
 private:
 
-    QString logText;                    // The current text waiting to be logged
-    QElapsedTimer timeSinceLastOutput;  // A record of how long ago logging last happened so we know if it is ready to log
+    // One line of text waiting to be logged.  The sequence number says whether it is free or written, see claim and publish.
+    struct Record
+    {
+        QAtomicInteger<quint32> sequence;
+        char *longText;         // The text if it doesn't fit in text, or nullptr
+        char text[240];
+    };
+
+    // The text waiting to be logged.  The solving threads (there are several when the indexes are searched
+    // by several threads) add records without locking, and updateLog takes them out in batches.
+    struct Ring
+    {
+        static const quint32 size = 4096;   // A power of 2
+        QAtomicInteger<quint32> enqueuePos;
+        quint32 dequeuePos = 0;
+        QAtomicInt dropped;                 // Lines lost because the ring was full
+        Record records[size];
+    };
+
+    QAtomicPointer<Ring> ring;          // The text waiting to be logged, nullptr until start is called
+    QMutex drainMutex;                  // Lets flush and updateLog take turns emptying the ring
     QTimer logUpdater;                  // A timer that times out periodically to log any waiting text
 
     /**
-     * @brief updateLog actually emits the signal to the logger to put the text into a file or scrolling log if it is ready.
+     * @brief updateLog actually emits the signal to the logger to put all the text waiting in the ring into a file or scrolling log.
      */
     void updateLog();
     /**
-     * @brief readyToLog keeps track of how long it has been since logging was last done so it doesn't overwhelm the logging file or scrolling log
-     * @return true if it is ready
+     * @brief claim takes the next free record in the ring for the calling thread, see publish
+     * @param pos is set to the position of the record
+     * @return The record, or nullptr if the ring is full (the line is then counted as dropped) or not started
+     */
+    Record *claim(quint32 &pos);
+    /**
+     * @brief publish hands a record that was claimed and filled in over to updateLog
      */
-    bool readyToLog();
+    void publish(Record *record, quint32 pos);
 signals:
     /**
      * @brief logOutput signals that there is infomation that should be printed to a log file or log window
@@ -60,7 +106,8 @@ typedef struct AstrometryLogger AstrometryLogger;
     #define EXPORT_C
 #endif
 
-// This provides a C interface to the C++ method above so that logging can happen from astrometry.net
+// This provides a C interface to the C++ methods above so that logging can happen from astrometry.net
 EXPORT_C void logFromAstrometry(AstrometryLogger* astroLogger, char* text);
+EXPORT_C void logFromAstrometryV(AstrometryLogger* astroLogger, const char* format, va_list va);
 
 #endif // ASTROMETRYLOGGER_H
@@ -315,6 +315,7 @@ ExtractorSolver* ExternalExtractorSolver::spawnChildSolver(int n)
     solver->starXYLSFilePath = starXYLSFilePath;
     solver->starXYLSFilePathIsTempFile = starXYLSFilePathIsTempFile;
     solver->fileToProcess = fileToProcess;
+    solver->fileToProcessIsUnmodified = fileToProcessIsUnmodified;
     solver->externalPaths = externalPaths;
     solver->cleanupTemporaryFiles = cleanupTemporaryFiles;
     solver->autoGenerateAstroConfig = autoGenerateAstroConfig;
@@ -964,6 +965,7 @@ QStringList ExternalExtractorSolver::getSolverArgsList()
     solverArgs << "--corr" << "none";
     solverArgs << "--new-fits" << "none";
     solverArgs << "--rdls" << "none";
+    solverArgs << "--index-xyls" << "none";
 
     //This parameter controls whether to resort the stars or not.
     if(m_ActiveParameters.resort)
@@ -1690,10 +1692,40 @@ exit:
     return status;
 }
 
+//A FITS file can be read by the external programs as it is only if the image buffer holds its pixels unchanged.
+//The size alone can't tell, a Bayer luminance or a calibrated frame has the same size, so the caller has to say so.
+//The size of its one image is still compared with the image being solved, in case the flag is stale.
+bool ExternalExtractorSolver::fileCanBeReadDirectly()
+{
+    if(!fileToProcessIsUnmodified || fileToProcess.isEmpty() || fileToProcessIsTempFile || m_Statistics.channels != 1)
+        return false;
+    QFileInfo file(fileToProcess);
+    const QString suffix = file.suffix().toLower();
+    if(!file.isFile() || (suffix != "fits" && suffix != "fit" && suffix != "fts"))
+        return false;
+
+    int status = 0, naxis = 0, bitpix = 0;
+    long naxes[3] = {0, 0, 0};
+    fitsfile *fptr = nullptr;
+    if(fits_open_diskfile(&fptr, fileToProcess.toLocal8Bit(), READONLY, &status))
+        return false;
+    fits_get_img_param(fptr, 3, &bitpix, &naxis, naxes, &status);
+    fits_close_file(fptr, &status);
+    return status == 0 && (naxis == 2 || (naxis == 3 && naxes[2] == 1))
+           && naxes[0] == m_Statistics.width && naxes[1] == m_Statistics.height;
+}
+
 //This is very necessary for solving non-fits images with the external Star Extractor
 //This was copied and pasted and modified from ImageToFITS in fitsdata in KStars
 int ExternalExtractorSolver::saveAsFITS()
 {
+    // Converting the image again would only write a copy of the file
+    if(fileCanBeReadDirectly())
+    {
+        emit logOutput("Using the FITS file " + fileToProcess + " without saving a copy");
+        return 0;
+    }
+
     //Only merge image channels if it is an RGB image and we are either averaging or integrating the channels
     if(m_Statistics.channels == 3 && (m_ColorChannel == FITSImage::AVERAGE_RGB || m_ColorChannel == FITSImage::INTEGRATED_RGB))
         mergeImageChannels();
@@ -1884,6 +1916,14 @@ int ExternalExtractorSolver::loadWCS()
             int after = cut.indexOf(" ");
             solutionHealpix = cut.left(after).toShort();
         }
+        searchString = "COMMENT log odds: ";
+        if(text.contains(searchString))
+        {
+            int before = text.indexOf(searchString);
+            QString cut = text.mid(before).remove(searchString);
+            int after = cut.indexOf(" ");
+            solutionLogOdds = cut.left(after).toDouble();
+        }
         solFile.close();
     }
 
@@ -33,6 +33,7 @@ class ExternalExtractorSolver : public InternalExtractorSolver
         // File Options
         QString fileToProcess;                  // This is the file that will be processed by the external SExtractor or solver
         bool fileToProcessIsTempFile = false;   // This indicates that the file is a temp file that might need to be deleted
+        bool fileToProcessIsUnmodified = false; // The caller says the image buffer holds the pixels of the file as they are
         QString solutionFile;                   // This is the path to the solution file after solving is done.
         ExternalProgramPaths externalPaths;     // File Paths for the external solvers
         QString starXYLSFilePath;               // This is the path to the generated XYLS file from SEP to solve with the local solver
@@ -121,6 +122,13 @@ class ExternalExtractorSolver : public InternalExtractorSolver
          */
         int saveAsFITS();
 
+        /**
+         * @brief fileCanBeReadDirectly checks whether the file to process is a FITS file on disk that the caller says holds
+         * the image buffer as it is, in which case the external programs read it instead of a copy made by saveAsFITS
+         * @return true if the file can be passed to the external programs
+         */
+        bool fileCanBeReadDirectly();
+
         /**
          * @brief cleanupTempFiles will clean up the temporary files
          */
@@ -62,6 +62,9 @@ class ExtractorSolver : public QThread
         // By Default we should use green since most telescopes are best color corrected for Green
         int m_ColorChannel = FITSImage::GREEN;
 
+        // Whether the 1 channel image is raw Bayer data that should be converted to luminance for SEP
+        bool m_BayerLuminance = false;
+
         // Astrometry Scale Parameters, These are not saved parameters and change for each image, use the methods to set them
         bool m_UseScale = false;            // Whether or not to use the image scale parameters
         double scalelo = 0;                 // Lower bound of image scale estimate
@@ -207,6 +210,15 @@ class ExtractorSolver : public QThread
             return solutionHealpix;
         };
 
+        /**
+         * @brief getSolutionLogOdds gets the log odds of the solution of the latest plate solve, which rank the solutions
+         * @return The log odds, or 0 if they are not known
+         */
+        double getSolutionLogOdds()
+        {
+            return solutionLogOdds;
+        };
+
         /**
          * @brief hasWCSData gets whether or not WCS Data has been retrieved for the image after plate solving
          * @return true means we have WCS data
@@ -276,6 +288,7 @@ class ExtractorSolver : public QThread
         FITSImage::Solution m_Solution;         // This is the solution that comes back from the Solver
         short solutionIndexNumber = -1;         // This is the index number of the index used to solve the image.
         short solutionHealpix = -1;             // This is the healpix of the index used to solve the image.
+        double solutionLogOdds = 0;             // This is the log odds of the solution.
 
         // This is the cancel file path that astrometry.net monitors.  If it detects this file, it aborts the solve
         QString cancelfn;           //Filename whose creation signals the process to stop
@@ -8,6 +8,7 @@
 
 //Qt Includes
 #include <QMutexLocker>
+#include <QScopeGuard>
 #include "qmath.h"
 
 //Project Includes
@@ -24,6 +25,7 @@
 #endif
 
 #include <memory>
+#include <numeric>
 
 
 //SEP Includes
@@ -33,9 +35,14 @@
 #include <fitsio.h>
 
 //Astrometry.net includes
+#ifdef _WIN32
+#undef ERROR // windows.h defines one too, errors.h has the astrometry.net one
+#endif
 extern "C" {
 #include "astrometry/log.h"
+#include "astrometry/errors.h"
 #include "astrometry/sip-utils.h"
+#include "astrometry/ssindex.h"
 }
 
 using namespace SSolver;
@@ -43,6 +50,27 @@ using namespace SEP;
 
 static int solverNum = 1;
 
+StarTable::StarTable(const QList<FITSImage::Star> &stars)
+{
+    m_X.reserve(stars.size());
+    m_Y.reserve(stars.size());
+    for(const auto &oneStar : stars)
+    {
+        m_X.append(oneStar.x);
+        m_Y.append(oneStar.y);
+    }
+}
+
+void StarTable::fillField(starxy_t *field) const
+{
+    // astrometry.net only reads the field, the const_cast is needed because starxy_t also owns fields read from files
+    field->x = const_cast<double *>(m_X.constData());
+    field->y = const_cast<double *>(m_Y.constData());
+    field->N = size();
+    field->flux = nullptr;
+    field->background = nullptr;
+}
+
 InternalExtractorSolver::InternalExtractorSolver(ProcessType pType, ExtractorType eType, SolverType sType,
         const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer, QObject *parent) : ExtractorSolver(pType, eType, sType,
                     imagestats, imageBuffer, parent)
@@ -55,10 +83,10 @@ InternalExtractorSolver::InternalExtractorSolver(ProcessType pType, ExtractorTyp
 InternalExtractorSolver::~InternalExtractorSolver()
 {
     waitSEP(); // Just in case it has not shut down
-    if(downSampledBuffer)
+    if(fusedFloatBuffer)
     {
-        delete [] downSampledBuffer;
-        downSampledBuffer = nullptr;
+        delete [] fusedFloatBuffer;
+        fusedFloatBuffer = nullptr;
     }
     if(mergedChannelBuffer)
     {
@@ -109,6 +137,7 @@ ExtractorSolver* InternalExtractorSolver::spawnChildSolver(int n)
             m_ImageBuffer, nullptr);
     solver->setParent(this->parent());  //This makes the parent the StellarSolver
     solver->m_ExtractedStars = m_ExtractedStars;
+    solver->m_StarTable = starTable();
     solver->m_BasePath = m_BasePath;
     //They will all share the same basename
     solver->m_HasExtracted = true;
@@ -129,6 +158,7 @@ ExtractorSolver* InternalExtractorSolver::spawnChildSolver(int n)
         connect(solver, &ExtractorSolver::logOutput, this,  &ExtractorSolver::logOutput);
     solver->usingDownsampledImage = usingDownsampledImage;
     solver->m_ColorChannel = m_ColorChannel;
+    solver->m_BayerLuminance = m_BayerLuminance;
     return solver;
 }
 
@@ -286,20 +316,17 @@ int InternalExtractorSolver::runSEPExtractor()
     emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
     emit logOutput("Starting Internal StellarSolver Star Extractor with the " + m_ActiveParameters.listName + " profile . . .");
     //Only merge image channels if it is an RGB image and we are either averaging or integrating the channels
-    if(m_Statistics.channels == 3 && (m_ColorChannel == FITSImage::AVERAGE_RGB || m_ColorChannel == FITSImage::INTEGRATED_RGB))
-    {
-        if (mergeImageChannels() == false)
-        {
-            emit logOutput("Merging image channels failed.");
-            return -1;
-        }
-    }
+    bool mergeChannels = m_Statistics.channels == 3 && (m_ColorChannel == FITSImage::AVERAGE_RGB || m_ColorChannel == FITSImage::INTEGRATED_RGB);
     //Only downsample images before SEP if the Star extraction is being used for plate solving
-    if(m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER && m_ActiveParameters.downsample != 1)
+    int downsample = (m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER) ? m_ActiveParameters.downsample : 1;
+    //Raw Bayer data is converted to luminance, instead of being debayered and merged
+    bool bayerLuminance = m_BayerLuminance && m_Statistics.channels == 1;
+    //Merging, luminance and downsampling are done in the same pass that converts the image to floats for SEP
+    if(mergeChannels || bayerLuminance || downsample > 1)
     {
-        if (downsampleImage(m_ActiveParameters.downsample) == false)
+        if (convertToFloatImage(downsample) == false)
         {
-            emit logOutput("Downsampling failed.");
+            emit logOutput("Merging, downsampling or computing the luminance of the image failed.");
             return -1;
         }
     }
@@ -360,7 +387,10 @@ int InternalExtractorSolver::runSEPExtractor()
         computeMargin(x, y, x + w - 1, y + h - 1, m_Statistics.width, m_Statistics.height, DEFAULT_MARGIN,
                       &startX, &startY, &subWidth, &subHeight);
 
-        auto* data = allocateDataBuffer(startX, startY, subWidth, subHeight);
+        // The float image made above can be handed to SEP as it is when the whole of it is extracted
+        bool useFusedBuffer = fusedFloatBuffer && startX == 0 && startY == 0
+                              && subWidth == m_Statistics.width && subHeight == m_Statistics.height;
+        auto* data = useFusedBuffer ? fusedFloatBuffer : allocateDataBuffer(startX, startY, subWidth, subHeight);
         if(data == nullptr)
         {
             for (auto *buffer : dataBuffers)
@@ -373,7 +403,7 @@ int InternalExtractorSolver::runSEPExtractor()
             emit logOutput("Failed to allocate memory.");
             return -1;
         }
-        if(data)
+        if(data && !useFusedBuffer)
             dataBuffers.append(data);
         startupOffsets.append(StartupOffset(startX, startY, subWidth, subHeight, x, y, x + w - 1, y + h - 1));
         FITSImage::Background tempBackground;
@@ -390,14 +420,14 @@ int InternalExtractorSolver::runSEPExtractor()
     for (auto &oneFuture : futures)
     {
         oneFuture.waitForFinished();
-        QList<FITSImage::Star> partitionStars = oneFuture.result();
-        QList<FITSImage::Star> acceptedStars;
+        const QList<FITSImage::Star> partitionStars = oneFuture.result();
         if (!startupOffsets.empty())
         {
             const StartupOffset oneOffset = startupOffsets.takeFirst();
             const int startX = oneOffset.startX;
             const int startY = oneOffset.startY;
-            for (auto &oneStar : partitionStars)
+            m_ExtractedStars.reserve(m_ExtractedStars.size() + partitionStars.size());
+            for (const auto &oneStar : partitionStars)
             {
                 // Don't use stars from the margins (they're detected in other partitions).
                 if (oneStar.x < (oneOffset.innerStartX - startX) ||
@@ -405,12 +435,11 @@ int InternalExtractorSolver::runSEPExtractor()
                         oneStar.x > (oneOffset.innerEndX   - startX) ||
                         oneStar.y > (oneOffset.innerEndY   - startY))
                     continue;
-                oneStar.x += startX;
-                oneStar.y += startY;
-                acceptedStars.append(oneStar);
+                m_ExtractedStars.append(oneStar);
+                m_ExtractedStars.last().x += startX;
+                m_ExtractedStars.last().y += startY;
             }
         }
-        m_ExtractedStars.append(acceptedStars);
     }
 
     double sumGlobal = 0, sumRmsSq = 0;
@@ -439,6 +468,7 @@ int InternalExtractorSolver::runSEPExtractor()
     dataBuffers.clear();
     futures.clear();
 
+    m_StarTable.reset();
     m_HasExtracted = true;
 
     return 0;
@@ -478,10 +508,6 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
         }
     };
 
-    //These are for the HFR
-    double requested_frac[2] = { 0.5, 0.99 };
-    double flux_fractions[2] = {0};
-    short flux_flag = 0;
     std::vector<std::pair<int, double>> ovals;
     int numToProcess = 0;
 
@@ -535,8 +561,8 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
         return partitionStars;
     }
 
-    std::unique_ptr<Extract> extractor;
-    extractor.reset(new Extract());
+    // Extraction contexts come from a pool and keep their buffers, so repeated extractions of similar frames don't allocate them again.
+    PooledExtract extractor = Extract::acquire();
     // #4 Source Extraction
     // Note that we set deblend_cont = 1.0 to turn off deblending.
     const double extractionThreshold = m_ActiveParameters.threshold_bg_multiple * bkg->globalrms +
@@ -567,7 +593,10 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
         std::sort(ovals.begin(), ovals.end(), [](const std::pair<int, double> &o1, const std::pair<int, double> &o2) -> bool { return o1.second > o2.second;});
 
     numToProcess = std::min(static_cast<uint32_t>(catalog->nobj), parameters.keep);
-    for (int index = 0; index < numToProcess; index++)
+
+    // The photometry of one detection only reads the image and the catalog, so detections can be measured on several threads.
+    // It returns false for detections that are not accepted.
+    auto measureStar = [&](int index, FITSImage::Star &oneStar) -> bool
     {
         // Processing detections in the order of the sort above.
         int i = ovals[index].first;
@@ -575,7 +604,7 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
         if (catalog->flag[i] & SEP_OBJ_TRUNC)
         {
             // Don't accept detections that go over the boundary.
-            continue;
+            return false;
         }
 
         //Variables that are obtained from the catalog
@@ -646,6 +675,11 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
 
         if(m_ProcessType == EXTRACT_WITH_HFR)
         {
+            //These are for the HFR
+            double requested_frac[2] = { 0.5, 0.99 };
+            double flux_fractions[2] = {0};
+            short flux_flag = 0;
+
             //Get HFR
             sep_flux_radius(&im, catalog->x[i], catalog->y[i], maxRadius, 0, m_ActiveParameters.subpix, 0, &flux, requested_frac, 2,
                             flux_fractions,
@@ -653,22 +687,47 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
             HFR = flux_fractions[0];
         }
 
-        FITSImage::Star oneStar = {xPos,
-                                   yPos,
-                                   mag,
-                                   static_cast<float>(sum),
-                                   static_cast<float>(peak),
-                                   HFR,
-                                   a,
-                                   b,
-                                   qRadiansToDegrees(theta),
-                                   0,
-                                   0,
-                                   numPixels
-                                  };
-        // Make a copy and add it to QList
-        partitionStars.append(oneStar);
-    }
+        oneStar = {xPos,
+                   yPos,
+                   mag,
+                   static_cast<float>(sum),
+                   static_cast<float>(peak),
+                   HFR,
+                   a,
+                   b,
+                   qRadiansToDegrees(theta),
+                   0,
+                   0,
+                   numPixels
+                  };
+        return true;
+    };
+
+    // Each chunk of consecutive detections fills its own list, and the lists are joined in chunk order,
+    // so the stars come out in exactly the same order as when they are measured one after the other.
+    const int chunkSize = std::max(64, numToProcess / static_cast<int>(m_PartitionThreads * 4 + 1));
+    QVector<QPair<int, QList<FITSImage::Star>>> chunks;
+    for (int start = 0; start < numToProcess; start += chunkSize)
+        chunks.append(qMakePair(start, QList<FITSImage::Star>()));
+
+    auto measureChunk = [&](QPair<int, QList<FITSImage::Star>> &chunk)
+    {
+        const int end = std::min(chunk.first + chunkSize, numToProcess);
+        FITSImage::Star oneStar;
+        for (int index = chunk.first; index < end; index++)
+        {
+            if (measureStar(index, oneStar))
+                chunk.second.append(oneStar);
+        }
+    };
+
+    if (chunks.size() > 1)
+        QtConcurrent::blockingMap(chunks, measureChunk);
+    else if (chunks.size() == 1)
+        measureChunk(chunks[0]);
+
+    for (const auto &chunk : std::as_const(chunks))
+        partitionStars.append(chunk.second);
 
     cleanup();
 
@@ -690,62 +749,60 @@ void InternalExtractorSolver::applyStarFilters(QList<FITSImage::Star> &starList)
             });
         }
 
-        if(m_ActiveParameters.maxSize > 0.0)
+        //The filters are applied in the order below, but the stars are only moved once, in a single pass over the list.
+        //The brightest and dimmest stars are counted among the stars of the right size, so those are counted first.
+        const bool filterMaxSize = m_ActiveParameters.maxSize > 0.0;
+        const bool filterMinSize = m_ActiveParameters.minSize > 0.0;
+        auto hasRightSize = [&](const FITSImage::Star & oneStar)
         {
+            if(filterMaxSize && (oneStar.a > m_ActiveParameters.maxSize || oneStar.b > m_ActiveParameters.maxSize))
+                return false;
+            if(filterMinSize && (oneStar.a < m_ActiveParameters.minSize || oneStar.b < m_ActiveParameters.minSize))
+                return false;
+            return true;
+        };
+        if(filterMaxSize)
             emit logOutput(QString("Removing stars wider than %1 pixels").arg(m_ActiveParameters.maxSize));
-            starList.erase(std::remove_if(starList.begin(), starList.end(), [&](FITSImage::Star & oneStar)
-            {
-                return (oneStar.a > m_ActiveParameters.maxSize || oneStar.b > m_ActiveParameters.maxSize);
-            }), starList.end());
-        }
-
-        if(m_ActiveParameters.minSize > 0.0)
-        {
+        if(filterMinSize)
             emit logOutput(QString("Removing stars smaller than %1 pixels").arg(m_ActiveParameters.minSize));
-            starList.erase(std::remove_if(starList.begin(), starList.end(), [&](FITSImage::Star & oneStar)
-            {
-                return ((oneStar.a < m_ActiveParameters.minSize || oneStar.b < m_ActiveParameters.minSize));
-            }), starList.end());
-        }
+        int rightSizeCount = starList.size();
+        if(filterMaxSize || filterMinSize)
+            rightSizeCount = std::count_if(starList.cbegin(), starList.cend(), hasRightSize);
 
+        int brightestToRemove = 0;
         if(m_ActiveParameters.resort && m_ActiveParameters.removeBrightest > 0.0 && m_ActiveParameters.removeBrightest < 100.0)
         {
-            int numToRemove = starList.count() * (m_ActiveParameters.removeBrightest / 100.0);
+            int numToRemove = rightSizeCount * (m_ActiveParameters.removeBrightest / 100.0);
             emit logOutput(QString("Removing the %1 brightest stars").arg(numToRemove));
             if(numToRemove > 1)
-            {
-                for(int i = 0; i < numToRemove; i++)
-                    starList.removeFirst();
-            }
+                brightestToRemove = numToRemove;
         }
 
+        int dimmestToRemove = 0;
         if(m_ActiveParameters.resort && m_ActiveParameters.removeDimmest > 0.0 && m_ActiveParameters.removeDimmest < 100.0)
         {
-            int numToRemove = starList.count() * (m_ActiveParameters.removeDimmest / 100.0);
+            int numToRemove = (rightSizeCount - brightestToRemove) * (m_ActiveParameters.removeDimmest / 100.0);
             emit logOutput(QString("Removing the %1 dimmest stars").arg(numToRemove));
             if(numToRemove > 1)
-            {
-                for(int i = 0; i < numToRemove; i++)
-                    starList.removeLast();
-            }
+                dimmestToRemove = numToRemove;
         }
 
-        if(m_ActiveParameters.maxEllipse > 1)
-        {
+        const bool filterEllipse = m_ActiveParameters.maxEllipse > 1;
+        if(filterEllipse)
             emit logOutput(QString("Removing the stars with a/b ratios greater than %1").arg(m_ActiveParameters.maxEllipse));
-            starList.erase(std::remove_if(starList.begin(), starList.end(), [&](FITSImage::Star & oneStar)
-            {
-                return (oneStar.b != 0 && oneStar.a / oneStar.b > m_ActiveParameters.maxEllipse);
-            }), starList.end());
-        }
 
+        double saturationLevel = -1;
         if(m_ActiveParameters.saturationLimit > 0.0 && m_ActiveParameters.saturationLimit < 100.0)
         {
+            //The saturation level is that of the original data, even if SEP got it converted to floats
+            const bool converted = fusedFloatBuffer != nullptr;
+            const int dataType = converted ? sourceDataType : m_Statistics.dataType;
+            const int bytesPerPixel = converted ? sourceBytesPerPixel : m_Statistics.bytesPerPixel;
             double maxSizeofDataType;
-            if(m_Statistics.dataType == TSHORT || m_Statistics.dataType == TLONG || m_Statistics.dataType == TLONGLONG)
-                maxSizeofDataType = pow(2, m_Statistics.bytesPerPixel * 8) / 2 - 1;
-            else if(m_Statistics.dataType == TUSHORT || m_Statistics.dataType == TULONG)
-                maxSizeofDataType = pow(2, m_Statistics.bytesPerPixel * 8) - 1;
+            if(dataType == TSHORT || dataType == TLONG || dataType == TLONGLONG)
+                maxSizeofDataType = pow(2, bytesPerPixel * 8) / 2 - 1;
+            else if(dataType == TUSHORT || dataType == TULONG)
+                maxSizeofDataType = pow(2, bytesPerPixel * 8) - 1;
             else // Float and Double Images saturation level is not so easy to determine, especially since they were probably processed by another program and the saturation level is now changed.
                 maxSizeofDataType = -1;
 
@@ -757,22 +814,37 @@ void InternalExtractorSolver::applyStarFilters(QList<FITSImage::Star> &starList)
             {
                 emit logOutput(QString("Removing the saturated stars with peak values greater than %1 Percent of %2").arg(
                                    m_ActiveParameters.saturationLimit).arg(maxSizeofDataType));
-                starList.erase(std::remove_if(starList.begin(), starList.end(), [&](FITSImage::Star & oneStar)
-                {
-                    return (oneStar.peak > (m_ActiveParameters.saturationLimit / 100.0) * maxSizeofDataType);
-                }), starList.end());
+                saturationLevel = (m_ActiveParameters.saturationLimit / 100.0) * maxSizeofDataType;
             }
         }
 
+        //The stars that are kept are moved to the front of the list, in order
+        const int keptRange = rightSizeCount - dimmestToRemove;
+        int rank = 0;
+        auto kept = starList.begin();
+        for(auto oneStar = starList.begin(); oneStar != starList.end(); ++oneStar)
+        {
+            if(!hasRightSize(*oneStar))
+                continue;
+            const int starRank = rank++;
+            if(starRank < brightestToRemove || starRank >= keptRange)
+                continue;
+            if(filterEllipse && oneStar->b != 0 && oneStar->a / oneStar->b > m_ActiveParameters.maxEllipse)
+                continue;
+            if(saturationLevel != -1 && oneStar->peak > saturationLevel)
+                continue;
+            if(kept != oneStar)
+                *kept = *oneStar;
+            ++kept;
+        }
+        starList.erase(kept, starList.end());
+
         if(m_ActiveParameters.resort && m_ActiveParameters.keepNum > 0)
         {
             emit logOutput(QString("Keeping just the %1 brightest stars").arg(m_ActiveParameters.keepNum));
             int numToRemove = starList.size() - m_ActiveParameters.keepNum;
             if(numToRemove > 1)
-            {
-                for(int i = 0; i < numToRemove; i++)
-                    starList.removeLast();
-            }
+                starList.erase(starList.end() - numToRemove, starList.end());
         }
         emit logOutput(QString("Stars Found after Filtering: %1").arg(starList.size()));
     }
@@ -812,92 +884,139 @@ float* InternalExtractorSolver::getFloatBuffer(int x, int y, int w, int h)
     return buffer;
 }
 
-bool InternalExtractorSolver::downsampleImage(int d)
+bool InternalExtractorSolver::convertToFloatImage(int d)
 {
     switch (m_Statistics.dataType)
     {
         case SEP_TBYTE:
-            return downSampleImageType<uint8_t>(d);
+            return convertToFloatImageType<uint8_t>(d);
         case TSHORT:
-            return downSampleImageType<int16_t>(d);
+            return convertToFloatImageType<int16_t>(d);
         case TUSHORT:
-            return downSampleImageType<uint16_t>(d);
+            return convertToFloatImageType<uint16_t>(d);
         case TLONG:
-            return downSampleImageType<int32_t>(d);
+            return convertToFloatImageType<int32_t>(d);
         case TULONG:
-            return downSampleImageType<uint32_t>(d);
+            return convertToFloatImageType<uint32_t>(d);
         case TFLOAT:
-            return downSampleImageType<float>(d);
+            return convertToFloatImageType<float>(d);
         case TDOUBLE:
-            return downSampleImageType<double>(d);
+            return convertToFloatImageType<double>(d);
         default:
             return false;
     }
 }
 
+//This reads the raw image once, merging the RGB channels or computing the luminance of raw Bayer data if requested,
+//averaging each d x d block and writing floats.
+//It replaces the separate merge, downsample and float conversion passes and their intermediate buffers.
+//The luminance of a Bayer pixel is its 3x3 neighborhood weighted 1 2 1 / 2 4 2 / 1 2 1, which holds (R + 2G + B) / 4
+//whatever the color of the center pixel. Beyond the edges the pattern is mirrored, which keeps the colors in place.
 template <typename T>
-bool InternalExtractorSolver::downSampleImageType(int d)
+bool InternalExtractorSolver::convertToFloatImageType(int d)
 {
-    int w = m_Statistics.width;
-    int h = m_Statistics.height;
-    int oldBufferSize = m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel;
-    //It is d times smaller in width and height
-    int newBufferSize = oldBufferSize / (d * d);
-    if(downSampledBuffer)
-        delete [] downSampledBuffer;   
-    downSampledBuffer = nullptr;
+    d = qMax(1, d);
+    const int w = m_Statistics.width;
+    const int h = m_Statistics.height;
+    const int newW = w / d;
+    const int newH = h / d;
+    const bool merge = m_Statistics.channels == 3 && (m_ColorChannel == FITSImage::AVERAGE_RGB
+                       || m_ColorChannel == FITSImage::INTEGRATED_RGB);
+    //Only the merge sums three samples, the average of them is a third of that
+    const double channelWeight = merge && m_ColorChannel == FITSImage::AVERAGE_RGB ? 1.0 / 3.0 : 1.0;
+    const bool bayer = m_BayerLuminance && m_Statistics.channels == 1;
+    if(newW == 0 || newH == 0)
+        return false;
+
+    if(fusedFloatBuffer)
+        delete [] fusedFloatBuffer;
+    fusedFloatBuffer = nullptr;
     try
     {
-        downSampledBuffer = new uint8_t[newBufferSize];
+        fusedFloatBuffer = new float[newW * newH];
     }
     catch (std::bad_alloc&)
     {
-        downSampledBuffer = nullptr;
+        fusedFloatBuffer = nullptr;
         emit logOutput("Failed to allocate memory.");
         return false;
     }
-    int channelShift = ( m_Statistics.channels < 3
-                         || usingMergedChannelImage) ? 0 : ( m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel * m_ColorChannel );
-    auto * sourceBuffer = reinterpret_cast<T const *>(m_ImageBuffer + channelShift);
-    auto * destinationBuffer = reinterpret_cast<T *>(downSampledBuffer);
 
-    for(int y = 0; y < h - d; y += d)
+    const int nextChannel = m_Statistics.samples_per_channel;
+    const int channelShift = (m_Statistics.channels < 3 || merge) ? 0 : nextChannel * m_ColorChannel;
+    auto * sourceBuffer = reinterpret_cast<T const *>(m_ImageBuffer) + channelShift;
+    float * destinationBuffer = fusedFloatBuffer;
+    const double blockScale = 1.0 / (d * d);
+
+    // Every output row only depends on its own d input rows, so the rows are converted in parallel
+    QVector<int> rows(newH);
+    std::iota(rows.begin(), rows.end(), 0);
+    QtConcurrent::blockingMap(rows, [ = ](int outY)
     {
-        for (int x = 0; x < w - d; x += d)
+        float * destination = destinationBuffer + outY * newW;
+        auto mirror = [](int i, int size)
+        {
+            return i < 0 ? qMin(-i, size - 1) : (i >= size ? qMax(0, 2 * size - 2 - i) : i);
+        };
+        for (int outX = 0; outX < newW; outX++)
         {
             //The sum of all the pixels in the sample
             double total = 0;
-
             for(int y2 = 0; y2 < d; y2++)
             {
-                //The offset for the current line of the sample to take, since we have to sample different rows
-                int currentLine = w * y2;
-
-                auto *sample = sourceBuffer + currentLine + x;
-                for(int x2 = 0; x2 < d; x2++)
+                const int y = outY * d + y2;
+                auto * sample = sourceBuffer + y * w + outX * d;
+                if(bayer)
+                {
+                    auto * above = sourceBuffer + mirror(y - 1, h) * w;
+                    auto * row = sourceBuffer + y * w;
+                    auto * below = sourceBuffer + mirror(y + 1, h) * w;
+                    for(int x2 = 0; x2 < d; x2++)
+                    {
+                        const int x = outX * d + x2;
+                        const int left = mirror(x - 1, w);
+                        const int right = mirror(x + 1, w);
+                        total += (static_cast<double>(above[left]) + 2.0 * above[x] + above[right]
+                                  + 2.0 * row[left] + 4.0 * row[x] + 2.0 * row[right]
+                                  + below[left] + 2.0 * below[x] + below[right]) / 16.0;
+                    }
+                }
+                else if(merge)
+                {
+                    for(int x2 = 0; x2 < d; x2++)
+                        total += static_cast<double>(sample[x2]) + sample[x2 + nextChannel] + sample[x2 + 2 * nextChannel];
+                }
+                else
                 {
-                    //This iterates the sample x2 spots to the right,
-                    total += *sample++;
+                    for(int x2 = 0; x2 < d; x2++)
+                        total += sample[x2];
                 }
             }
-            //This calculates the average pixel value and puts it in the new downsampled image.
-            int pixel = (x / d) + (y / d) * (w / d);
-            destinationBuffer[pixel] = total / (d * d);
+            destination[outX] = static_cast<float>(total * channelWeight * blockScale);
         }
-        //Shifts the pointer by a whole line, d times
-        sourceBuffer += w * d;
-    }
-
-    m_ImageBuffer = downSampledBuffer;
-    m_Statistics.samples_per_channel /= (d * d);
-    m_Statistics.width /= d;
-    m_Statistics.height /= d;
-    if(scaleunit == ARCSEC_PER_PIX)
+    });
+
+    m_ImageBuffer = reinterpret_cast<uint8_t *>(fusedFloatBuffer);
+    sourceDataType = m_Statistics.dataType;
+    sourceBytesPerPixel = m_Statistics.bytesPerPixel;
+    m_Statistics.dataType = TFLOAT;
+    m_Statistics.bytesPerPixel = sizeof(float);
+    m_Statistics.channels = 1;
+    m_Statistics.ndim = 2;
+    m_Statistics.width = newW;
+    m_Statistics.height = newH;
+    m_Statistics.samples_per_channel = newW * newH;
+    if(merge)
+        usingMergedChannelImage = true;
+    if(d > 1)
     {
-        scalelo *= d;
-        scalehi *= d;
+        if(scaleunit == ARCSEC_PER_PIX)
+        {
+            scalelo *= d;
+            scalehi *= d;
+        }
+        usingDownsampledImage = true;
     }
-    usingDownsampledImage = true;
     return true;
 }
 
@@ -948,7 +1067,7 @@ bool InternalExtractorSolver::mergeImageChannelsType()
     }
     catch (std::bad_alloc&)
     {
-        downSampledBuffer = nullptr;
+        mergedChannelBuffer = nullptr;
         emit logOutput("Failed to allocate memory.");
         return false;
     }
@@ -1079,9 +1198,63 @@ bool InternalExtractorSolver::prepare_job()
     return true;
 }
 
+QStringList InternalExtractorSolver::selectIndexFiles(const QStringList &indexFolders, const QStringList &indexFiles,
+        double quadLow, double quadHigh, bool usePosition, double ra, double dec, double radius)
+{
+    //This picks the indexes to warm up outside of any solve, so it frees the error state it made on the calling thread
+    auto freeErrors = qScopeGuard([] { errors_free(); });
+
+    engine_t* engine = engine_new();
+    for(const auto &onePath : indexFiles)
+        engine_add_index(engine, onePath.toUtf8().data());
+    for(const auto &onePath : indexFolders)
+        engine_add_search_path(engine, onePath.toLatin1().constData());
+    if(indexFolders.count() > 0)
+        engine_autoindex_search_paths(engine);
+
+    il* indexList = il_new(16);
+    engine_select_indexes(engine, quadLow, quadHigh, usePosition ? TRUE : FALSE, ra, dec, radius, indexList);
+    QStringList selected;
+    for(size_t i = 0; i < il_size(indexList); i++)
+    {
+        index_t* index = (index_t*)pl_get(engine->indexes, il_get(indexList, i));
+        // Indexes in a single file have the same name for all three parts
+        for(const char *fileName : {index->quadfn, index->codefn, index->starfn})
+        {
+            const QString path = QString::fromUtf8(fileName);
+            if(!selected.contains(path))
+                selected.append(path);
+        }
+    }
+    il_free(indexList);
+    engine_free(engine);
+    return selected;
+}
+
+bool InternalExtractorSolver::convertIndexFile(const QString &indexFile, const QString &outputFile, bool expand)
+{
+    index_t* index = index_load(indexFile.toUtf8().constData(), 0, NULL);
+    if(!index)
+        return false;
+    const bool success = ssindex_write(index, outputFile.toUtf8().constData(), expand ? TRUE : FALSE) == 0;
+    index_free(index);
+    return success;
+}
+
+//The star table of the extracted stars is built on the first call and shared after that
+QSharedPointer<const StarTable> InternalExtractorSolver::starTable()
+{
+    if(m_StarTable.isNull())
+        m_StarTable = QSharedPointer<const StarTable>(new StarTable(m_ExtractedStars));
+    return m_StarTable;
+}
+
 //This method was adapted from the main method in engine-main.c in astrometry.net
 int InternalExtractorSolver::runInternalSolver()
 {
+    //The astrometry.net error state belongs to the thread, it is freed however the solve ends
+    auto freeErrors = qScopeGuard([] { errors_free(); });
+
     if(!isChildSolver)
     {
         emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
@@ -1093,6 +1266,9 @@ int InternalExtractorSolver::runInternalSolver()
 
     //This sets some basic engine settings
     engine->inparallel = m_ActiveParameters.inParallel ? TRUE : FALSE;
+    engine->hugepages = m_ActiveParameters.useHugePages ? TRUE : FALSE;
+    engine->packcodetrees = m_ActiveParameters.packCodeTrees ? TRUE : FALSE;
+    engine->indexthreads = m_ActiveParameters.indexThreads;
     engine->minwidth = m_ActiveParameters.minwidth;
     engine->maxwidth = m_ActiveParameters.maxwidth;
 
@@ -1107,6 +1283,7 @@ int InternalExtractorSolver::runInternalSolver()
             if(!this->isChildSolver)
             {
                 connect(&astroLogger, &AstrometryLogger::logOutput, this, &ExtractorSolver::logOutput);
+                astroLogger.start();
                 setAstroLogger(&astroLogger);
             }
         }
@@ -1145,38 +1322,20 @@ int InternalExtractorSolver::runInternalSolver()
 
     blind_t* bp = &(job->bp);
 
-    //This will set up the field file to solve as an xylist
-    double *xArray = nullptr;
-    double *yArray = nullptr;
+    //This will set up the field to solve from the star table, which is shared with the other child solvers
+    QSharedPointer<const StarTable> stars;
     try
     {
-        xArray = new double[m_ExtractedStars.size()];
-        yArray = new double[m_ExtractedStars.size()];
+        stars = starTable();
     }
     catch (std::bad_alloc&)
     {
-        if(xArray)
-            delete [] xArray;
-        if(yArray)
-            delete [] yArray;
         emit logOutput("Failed to allocate memory.");
         return -1;
     }
 
-    int i = 0;
-    for(const auto &oneStar : m_ExtractedStars)
-    {
-        xArray[i] = oneStar.x;
-        yArray[i] = oneStar.y;
-        i++;
-    }
-
     starxy_t* fieldToSolve = (starxy_t*)calloc(1, sizeof(starxy_t));
-    fieldToSolve->x = xArray;
-    fieldToSolve->y = yArray;
-    fieldToSolve->N = m_ExtractedStars.size();
-    fieldToSolve->flux = nullptr;
-    fieldToSolve->background = nullptr;
+    stars->fillField(fieldToSolve);
     bp->solver.fieldxy = fieldToSolve;
 
     if(depthlo != -1 && depthhi != -1)
@@ -1245,7 +1404,10 @@ int InternalExtractorSolver::runInternalSolver()
     if(m_AstrometryLogLevel != SSolver::LOG_NONE && logFile)
         fclose(logFile);
     if(m_AstrometryLogLevel != SSolver::LOG_NONE && !this->isChildSolver)
+    {
+        astroLogger.flush();
         disconnect(&astroLogger, &AstrometryLogger::logOutput, this, &ExtractorSolver::logOutput);
+    }
 
     //This deletes or frees the items that are no longer needed.
     engine_free(engine);
@@ -1256,12 +1418,6 @@ int InternalExtractorSolver::runInternalSolver()
     job->depths = nullptr;
     free(fieldToSolve);
     fieldToSolve = nullptr;
-    if(xArray)
-        delete[] xArray;
-    xArray = nullptr;
-    if(yArray)
-        delete[] yArray;
-    yArray = nullptr;
 
     //Note: I can only get these items after the solve because I made a couple of small changes to the Astrometry.net Code.
     //I made it return in solve_fields in blind.c before it ran "cleanup".  I also had it wait to clean up solutions, blind and solver in engine.c.  We will do that after we get the solution information.
@@ -1328,6 +1484,7 @@ int InternalExtractorSolver::runInternalSolver()
         m_Solution = {fieldw, fieldh, ra, dec, orient, pixscale, parity, raErr, decErr};
         solutionIndexNumber = match.indexid;
         solutionHealpix = match.healpix;
+        solutionLogOdds = match.logodds;
         m_HasSolved = true;
         returnCode = 0;
     }
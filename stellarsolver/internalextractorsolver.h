@@ -10,6 +10,7 @@
 //Qt Includes
 #include <QtConcurrent>
 #include "qmutex.h"
+#include <QSharedPointer>
 
 //SEP Includes
 #include "sep/sep.h"
@@ -27,6 +28,31 @@ extern "C" {
 
 using namespace SSolver;
 
+// The extracted stars as a struct of arrays, with one contiguous column for each value that the solver reads.
+// It is built once from the filtered star list and never changes afterwards, so all the child solvers share
+// one table and its columns are handed to astrometry.net without copying them.
+class StarTable
+{
+    public:
+        explicit StarTable(const QList<FITSImage::Star> &stars);
+
+        int size() const
+        {
+            return m_X.size();
+        }
+
+        /**
+         * @brief fillField points a starxy_t at the columns of the table. The field only borrows them,
+         * so it must not be freed with starxy_free or outlive the table.
+         * @param field The field to fill
+         */
+        void fillField(starxy_t *field) const;
+
+    private:
+        QVector<double> m_X;
+        QVector<double> m_Y;
+};
+
 class InternalExtractorSolver: public ExtractorSolver
 {
     public:
@@ -77,6 +103,32 @@ class InternalExtractorSolver: public ExtractorSolver
          */
         WCSData getWCSData() override;
 
+        /**
+         * @brief selectIndexFiles finds the index files that a solve looking for quads of the given sizes would search,
+         * picked the same way as the solver picks them.  The index metadata comes from the manifests of the index folders
+         * where those are up to date, so the index files themselves are rarely opened.
+         * @param indexFolders The folders to search for index files
+         * @param indexFiles Additional index files to consider
+         * @param quadLow The size of the smallest quad that can be found in the field in arcseconds
+         * @param quadHigh The size of the largest quad that can be found in the field in arcseconds
+         * @param usePosition Whether to leave out the index files that don't cover the search position
+         * @param ra The RA of the search position in degrees
+         * @param dec The DEC of the search position in degrees
+         * @param radius The search radius in degrees
+         * @return The paths of all the files of the selected indexes
+         */
+        static QStringList selectIndexFiles(const QStringList &indexFolders, const QStringList &indexFiles, double quadLow,
+                                            double quadHigh, bool usePosition, double ra, double dec, double radius);
+
+        /**
+         * @brief convertIndexFile writes an index file as a StellarSolver native index (see astrometry/ssindex.h),
+         * which is loaded by mapping it in one piece instead of parsing its FITS headers and tables.
+         * @param indexFile The index file to convert
+         * @param outputFile The native index file to write
+         * @param expand Whether to store integer trees as double trees, which are faster to search but larger
+         * @return Whether the native index was written
+         */
+        static bool convertIndexFile(const QString &indexFile, const QString &outputFile, bool expand);
 
 
     protected:
@@ -87,6 +139,10 @@ class InternalExtractorSolver: public ExtractorSolver
         //This boolean gets set internally if we are using a Merged Channel image buffer
         bool usingMergedChannelImage = false;
 
+        //The data type and sample size of the image before convertToFloatImage, which the saturation filter still needs
+        int sourceDataType = 0;
+        int sourceBytesPerPixel = 0;
+
         /**
          * @brief runSEPExtractor is the method that actually runs internal SEP
          * @return
@@ -128,14 +184,36 @@ class InternalExtractorSolver: public ExtractorSolver
          */
         template <typename T> bool mergeImageChannelsType();
 
+        /**
+         * @brief convertToFloatImage merges the RGB channels if requested and downsamples the image in one pass straight to floats.
+         * Afterwards the image buffer and statistics describe a single channel float image.
+         * @param d The factor to downsample by in both dimensions, 1 to only merge the channels
+         */
+        bool convertToFloatImage(int d);
+
+        /**
+         * @brief convertToFloatImageType allows the convertToFloatImage method to handle different data types
+         * @param d The factor to downsample by in both dimensions
+         */
+        template <typename T> bool convertToFloatImageType(int d);
+
     private:
 
-        // The generic data buffer containing the downsampled image data
-        uint8_t *downSampledBuffer { nullptr };
+        // The float image for SEP with the channels merged and/or downsampled, see convertToFloatImage
+        float *fusedFloatBuffer { nullptr };
 
         // The generic data buffer containing an RGB image's merged channels data
         uint8_t *mergedChannelBuffer { nullptr };
 
+        // The extracted stars for the solver, built from m_ExtractedStars when it is first needed and shared with the child solvers
+        QSharedPointer<const StarTable> m_StarTable;
+
+        /**
+         * @brief starTable gets the table of the extracted stars, building it on the first call after an extraction
+         * @return The shared table
+         */
+        QSharedPointer<const StarTable> starTable();
+
         // This is the number of threads used for star extraction with SEP
         uint32_t m_PartitionThreads = {16};
 
@@ -190,18 +268,6 @@ class InternalExtractorSolver: public ExtractorSolver
          */
         template <typename T> float* getFloatBuffer(int x, int y, int w, int h);
 
-        /**
-         * @brief downsampleImage downsamples the image by the requested factor
-         * @param d The factor to downsample by in both dimensions
-         */
-        bool downsampleImage(int d);
-
-        /**
-         * @brief downSampleImageType allows the downsampling code to handle various data types
-         * @param d The factor to downsample by in both dimensions
-         */
-        template <typename T> bool downSampleImageType(int d);
-
 
 };
 
@@ -41,9 +41,13 @@ bool SSolver::Parameters::operator==(const Parameters& o)
 
             //The setting for parallel thread solving
             multiAlgorithm == o.multiAlgorithm &&
+            bestSolutionTime == o.bestSolutionTime &&
 
             //Settings from the Astrometry Config file
             inParallel == o.inParallel &&
+            useHugePages == o.useHugePages &&
+            packCodeTrees == o.packCodeTrees &&
+            indexThreads == o.indexThreads &&
             solverTimeLimit == o.solverTimeLimit &&
             minwidth == o.minwidth &&
             maxwidth == o.maxwidth &&
@@ -59,7 +63,8 @@ bool SSolver::Parameters::operator==(const Parameters& o)
             //They need to be turned into a qstring because they are sometimes very close but not exactly the same
             QString::number(logratio_tosolve) == QString::number(o.logratio_tosolve) &&
             QString::number(logratio_tokeep) == QString::number(o.logratio_tokeep) &&
-            QString::number(logratio_totune) == QString::number(o.logratio_totune);
+            QString::number(logratio_totune) == QString::number(o.logratio_totune) &&
+            QString::number(logratio_tostopsearching) == QString::number(o.logratio_tostopsearching);
 }
 
 QMap<QString, QVariant> SSolver::Parameters::convertToMap(const Parameters &params)
@@ -103,11 +108,15 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(const Parameters &para
 
     //A setting specifig to StellarSovler for choosing the algorithm to use to solve with parallel threads.
     settingsMap.insert("multiAlgo", QVariant(params.multiAlgorithm)) ;
+    settingsMap.insert("bestSolutionTime", QVariant(params.bestSolutionTime));
 
     //Settings that usually get set by the Astrometry config file
     settingsMap.insert("maxwidth", QVariant(params.maxwidth)) ;
     settingsMap.insert("minwidth", QVariant(params.minwidth)) ;
     settingsMap.insert("inParallel", QVariant(params.inParallel)) ;
+    settingsMap.insert("useHugePages", QVariant(params.useHugePages));
+    settingsMap.insert("packCodeTrees", QVariant(params.packCodeTrees));
+    settingsMap.insert("indexThreads", QVariant(params.indexThreads));
     settingsMap.insert("solverTimeLimit", QVariant(params.solverTimeLimit));
 
     //Astrometry Basic Parameters
@@ -120,6 +129,7 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(const Parameters &para
     settingsMap.insert("logratio_tokeep", QVariant(params.logratio_tokeep)) ;
     settingsMap.insert("logratio_totune", QVariant(params.logratio_totune)) ;
     settingsMap.insert("logratio_tosolve", QVariant(params.logratio_tosolve)) ;
+    settingsMap.insert("logratio_tostopsearching", QVariant(params.logratio_tostopsearching));
 
     return settingsMap;
 
@@ -167,11 +177,15 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(const QMap<QString, QVar
 
     //This is a parameter specific to StellarSolver.  It determines the algorithm to use to run parallel threads for solving
     params.multiAlgorithm = (MultiAlgo)(settingsMap.value("multiAlgo", params.multiAlgorithm)).toInt();
+    params.bestSolutionTime = settingsMap.value("bestSolutionTime", params.bestSolutionTime).toInt();
 
     //Settings that usually get set by the Astrometry config file
     params.maxwidth = settingsMap.value("maxwidth", params.maxwidth).toDouble() ;
     params.minwidth = settingsMap.value("minwidth", params.minwidth).toDouble() ;
     params.inParallel = settingsMap.value("inParallel", params.inParallel).toBool() ;
+    params.useHugePages = settingsMap.value("useHugePages", params.useHugePages).toBool();
+    params.packCodeTrees = settingsMap.value("packCodeTrees", params.packCodeTrees).toBool();
+    params.indexThreads = settingsMap.value("indexThreads", params.indexThreads).toInt();
     params.solverTimeLimit = settingsMap.value("solverTimeLimit", params.solverTimeLimit).toInt();
 
     //Astrometry Basic Parameters
@@ -184,6 +198,7 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(const QMap<QString, QVar
     params.logratio_tokeep = settingsMap.value("logratio_tokeep", params.logratio_tokeep).toDouble() ;
     params.logratio_totune = settingsMap.value("logratio_totune", params.logratio_totune).toDouble() ;
     params.logratio_tosolve = settingsMap.value("logratio_tosolve", params.logratio_tosolve).toDouble();
+    params.logratio_tostopsearching = settingsMap.value("logratio_tostopsearching", params.logratio_tostopsearching).toDouble();
 
     return params;
 
@@ -369,8 +369,16 @@ class Parameters
         //Astrometry Config/Engine Parameters
             // Algorithm for running multiple threads on possibly multiple cores to solve faster
         MultiAlgo multiAlgorithm = MULTI_AUTO;
+            // Note: A solution is only as good as its log odds, and with MULTI_DEPTHS or MULTI_SCALES the first child solver to solve may not have the best one.
+        int bestSolutionTime = 0;   // Keep the other child solvers searching for up to this many seconds after the first solution, then use the solution with the best log odds.  0 uses the first solution.
             // Note: If the indices you are using take less than 2 GB of space, and you have at least as much physical memory as indices, you want inParallel enabled for sure.
         bool inParallel = true;     // Check the indices in parallel? This loads them in memory at the same time.
+            // Note: This helps most with big index series loaded inParallel.  It needs huge pages reserved by the system or transparent huge pages enabled (Linux), otherwise the indices are searched as usual.
+        bool useHugePages = false;  // Copy the kd-trees of the indices into huge pages when loading them, so searching them misses the TLB less often.
+            // Note: This costs a few bytes of memory per code tree node and only pays off when the code trees are much larger than the CPU cache.
+        bool packCodeTrees = false; // Lay out the code kd-trees of the indices in cache line sized blocks when loading them, for the quad searches.
+            // Note: This needs inParallel, and a library built with OpenMP.  The threads compete with the child solvers of the multiAlgorithm, so it is best used with NOT_MULTI.
+        int indexThreads = 1;       // The number of threads that search the indices of a solve at the same time, one index per thread.  1 searches them in turn.
         int solverTimeLimit = 600;  // Give up solving after the specified number of seconds of CPU time
         double minwidth = 0.1;      // If no scale estimate is given, this is the limit on the minimum field width in degrees.
         double maxwidth = 180;      // If no scale estimate is given, this is the limit on the maximum field width in degrees.
@@ -390,6 +398,7 @@ class Parameters
         double logratio_tosolve = log(1e9); // Odds ratio at which to consider a field solved (default: 1e9)
         double logratio_tokeep  = log(1e9); // Odds ratio at which to keep a solution (default: 1e9)
         double logratio_totune  = log(1e6); // Odds ratio at which to try tuning up a match that isn't good enough to solve (default: 1e6)
+        double logratio_tostopsearching = log(1e100); // Odds ratio at which to stop searching for a better solution during the bestSolutionTime (default: 1e100)
 
         bool operator==(const Parameters &o);
 
@@ -28,9 +28,6 @@
 
 #include <cmath>
 
-#ifndef	RAND_MAX
-#define	RAND_MAX 2147483647
-#endif
 #define	NSONMAX	1024  /* max. number per level */
 #define NSONMAX_STR "1024" /* just for error message */
 #define	NBRANCH	16    /* starting number per branch */
@@ -38,7 +35,7 @@
 namespace SEP
 {
 
-Deblend::Deblend(int deblend_nthresh, const plistvalues &values)
+Deblend::Deblend(int deblend_nthresh, const plistvalues &values, unsigned int seed) : random_generator(seed)
 {
     allocdeblend(deblend_nthresh);
     plistsize = values.plistsize;
@@ -349,7 +346,7 @@ int Deblend::gatherup(objliststruct *objlistin, objliststruct *objlistout)
             }
             if (p[nobj - 1] > 1.0e-31)
             {
-                drand = p[nobj - 1] * rand() / RAND_MAX;
+                drand = p[nobj - 1] * random_generator() / random_generator.max();
                 for (i = 1; i < nobj && p[i] < drand; i++);
                 if (i == nobj)
                     i = iclst;
@@ -25,6 +25,8 @@
 #include "sep.h"
 #include "sepcore.h"
 
+#include <random>
+
 
 namespace SEP
 {
@@ -35,12 +37,18 @@ class Analyze;
 class Deblend
 {
     public:
-        Deblend(int deblend_nthresh, const plistvalues &values);
+        Deblend(int deblend_nthresh, const plistvalues &values, unsigned int seed = 1);
         ~Deblend();
 
         int deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
                     int deblend_nthresh, double deblend_mincont, int minarea, SEP::Lutz *lutz);
 
+        /* Restarts the random generator, so that a reused deblender gives the same results as a new one */
+        void reseed(unsigned int seed)
+        {
+            random_generator.seed(seed);
+        }
+
     protected:
 
         int belong(int, objliststruct *, int, objliststruct *);
@@ -59,6 +67,10 @@ class Deblend
         objliststruct	debobjlist, debobjlist2;
         plistvalues plist_values;
         int plistsize;
+
+        /* Each instance has its own generator, so concurrent extractions neither share nor lock libc's rand() state.
+         * minstd_rand is fully specified by the standard, so the same seed gives the same pixels on every platform. */
+        std::minstd_rand random_generator;
 };
 
 }
@@ -27,10 +27,44 @@
 #include <cstdio>
 
 #include <cmath>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Starting size of the pixel list, in pixels, when the pixstack limit is larger */
+#define	PIXSTACK_INITIAL	65536
 
 namespace SEP
 {
 
+namespace
+{
+std::mutex extractPoolMutex;
+std::vector<Extract *> extractPool;
+
+/* The most idle contexts the pool keeps, enough for a few extractions to run at once on every core */
+size_t extract_pool_limit()
+{
+    static const size_t limit = std::max(4u, 2 * std::thread::hardware_concurrency());
+    return limit;
+}
+
+/* Grows a scratch buffer so that it holds at least `count` elements, its content is not kept */
+template <typename T>
+int reserve_buffer(T **buffer, size_t *capacity, size_t count)
+{
+    if (count <= *capacity)
+        return RETURN_OK;
+    free(*buffer);
+    *capacity = 0;
+    if (!(*buffer = (T *)malloc(count * sizeof(T))))
+        return MEMORY_ALLOC_ERROR;
+    *capacity = count;
+    return RETURN_OK;
+}
+}
+
 Extract::Extract()
 {
 
@@ -38,7 +72,108 @@ Extract::Extract()
 
 Extract::~Extract()
 {
+    free_scratch();
+}
+
+PooledExtract Extract::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(extractPoolMutex);
+        if (!extractPool.empty())
+        {
+            Extract *extract = extractPool.back();
+            extractPool.pop_back();
+            return PooledExtract(extract);
+        }
+    }
+    return PooledExtract(new Extract());
+}
+
+void Extract::clear_pool()
+{
+    std::vector<Extract *> idle;
+    {
+        std::lock_guard<std::mutex> lock(extractPoolMutex);
+        idle.swap(extractPool);
+    }
+    for (Extract *extract : idle)
+        delete extract;
+}
 
+void ExtractRelease::operator()(Extract *extract) const
+{
+    if (!extract)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(extractPoolMutex);
+        if (extractPool.size() < extract_pool_limit())
+        {
+            extractPool.push_back(extract);
+            return;
+        }
+    }
+    delete extract;
+}
+
+/* Grows the per column scratch arrays to `columns` elements */
+int Extract::reserve_columns(size_t columns)
+{
+    int status = RETURN_OK;
+
+    if (columns <= scratch.columns)
+        return status;
+
+    free(scratch.info);
+    free(scratch.store);
+    free(scratch.marker);
+    free(scratch.psstack);
+    free(scratch.start);
+    free(scratch.end);
+    free(scratch.dummyscan);
+    free(scratch.cdscan);
+    free(scratch.sigscan);
+    free(scratch.workscan);
+    scratch.info = scratch.store = NULL;
+    scratch.marker = NULL;
+    scratch.psstack = NULL;
+    scratch.start = scratch.end = NULL;
+    scratch.dummyscan = scratch.cdscan = scratch.sigscan = scratch.workscan = NULL;
+    scratch.columns = 0;
+
+    QMALLOC(scratch.info, infostruct, columns, status);
+    QMALLOC(scratch.store, infostruct, columns, status);
+    QMALLOC(scratch.marker, char, columns, status);
+    QMALLOC(scratch.psstack, pixstatus, columns, status);
+    QMALLOC(scratch.start, int, columns, status);
+    QMALLOC(scratch.end, int, columns, status);
+    QMALLOC(scratch.dummyscan, PIXTYPE, columns, status);
+    QMALLOC(scratch.cdscan, PIXTYPE, columns, status);
+    QMALLOC(scratch.sigscan, PIXTYPE, columns, status);
+    QMALLOC(scratch.workscan, PIXTYPE, columns, status);
+    scratch.columns = columns;
+
+exit:
+    return status;
+}
+
+void Extract::free_scratch()
+{
+    free(scratch.info);
+    free(scratch.store);
+    free(scratch.marker);
+    free(scratch.psstack);
+    free(scratch.start);
+    free(scratch.end);
+    free(scratch.dummyscan);
+    free(scratch.cdscan);
+    free(scratch.sigscan);
+    free(scratch.workscan);
+    free(scratch.convnorm);
+    for (int i = 0; i < 3; i++)
+        free(scratch.lines[i]);
+    free(scratch.survives);
+    free(scratch.pixel);
+    scratch = ScratchBuffers();
 }
 
 
@@ -46,8 +181,9 @@ Extract::~Extract()
 
 /* initialize buffer */
 /* bufw must be less than or equal to w */
+/* the lines are kept in `storage`, which is grown when it holds less than bufw * bufh pixels */
 int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int h,
-                              int bufw, int bufh)
+                              int bufw, int bufh, PIXTYPE **storage, size_t *capacity)
 {
     int status, yl;
     //status = RETURN_OK; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
@@ -59,7 +195,10 @@ int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int
 
     /* buffer array info */
     buf->bptr = NULL;
-    QMALLOC(buf->bptr, PIXTYPE, bufw * bufh, status);
+    status = reserve_buffer(storage, capacity, (size_t)bufw * bufh);
+    if (status != RETURN_OK)
+        return status;
+    buf->bptr = *storage;
     buf->bw = bufw;
     buf->bh = bufh;
 
@@ -81,7 +220,6 @@ int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int
     return status;
 
 exit:
-    free(buf->bptr);
     buf->bptr = NULL;
     return status;
 }
@@ -111,14 +249,6 @@ void Extract::arraybuffer_readline(arraybuffer *buf)
     return;
 }
 
-void Extract::arraybuffer_free(arraybuffer *buf)
-{
-    if(buf && buf->bptr){    //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
-        free(buf->bptr);
-        buf->bptr = NULL;
-    }
-}
-
 /* apply_mask_line: Apply the mask to the image and noise buffers.
  *
  * If convolution is off, masked values should simply be not
@@ -163,7 +293,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     infostruct        curpixinfo, initinfo, freeinfo;
     objliststruct     objlist;
     char              newmarker;
-    size_t            mem_pixstack;
+    size_t            mem_pixstack, max_pixstack;
     int               nposize, oldnposize;
     int               w, h;
     int               co, i, luflag, pstop, xl, xl2, yl, cn;
@@ -210,11 +340,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     pixsig = 0.0;
     isvarnoise = 0;
 
-    mem_pixstack = sep_get_extract_pixstack();
-
-    /* seed the random number generator consistently on each call to get
-     * consistent results. rand() is used in deblending. */
-    srand(1);
+    max_pixstack = sep_get_extract_pixstack();
 
     /* Noise characteristics of the image: None, scalar or variable? */
     if (image->noise_type == SEP_NOISE_NONE) { } /* nothing to do */
@@ -267,15 +393,19 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     /* this is input `thresh` regardless of thresh_type. */
     objlist.thresh = thresh;
 
-    /*Allocate memory for buffers */
+    /* Get the buffers, they are kept from the previous call when it was at least as wide */
     stacksize = w + 1;
-    QMALLOC(info, infostruct, stacksize, status);
-    QCALLOC(store, infostruct, stacksize, status);
-    QMALLOC(marker, char, stacksize, status);
-    QMALLOC(dummyscan, PIXTYPE, stacksize, status);
-    QMALLOC(psstack, pixstatus, stacksize, status);
-    QCALLOC(start, int, stacksize, status);
-    QMALLOC(end, int, stacksize, status);
+    status = reserve_columns(stacksize);
+    if (status != RETURN_OK) goto exit;
+    info = scratch.info;
+    store = scratch.store;
+    marker = scratch.marker;
+    dummyscan = scratch.dummyscan;
+    psstack = scratch.psstack;
+    start = scratch.start;
+    end = scratch.end;
+    memset(store, 0, stacksize * sizeof(infostruct));
+    memset(start, 0, stacksize * sizeof(int));
 
     //    if ((status = lutzalloc(w, h)) != RETURN_OK)
     //        goto exit;
@@ -289,18 +419,18 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
      */
     bufh = conv ? convh : 1;
     status = arraybuffer_init(&dbuf, image->data, image->dtype, image->raw_w, h, stacksize,
-                              bufh);
+                              bufh, &scratch.lines[0], &scratch.lineSizes[0]);
     if (status != RETURN_OK) goto exit;
     if (isvarnoise)
     {
         status = arraybuffer_init(&nbuf, image->noise, image->ndtype, image->raw_w, h,
-                                  stacksize, bufh);
+                                  stacksize, bufh, &scratch.lines[1], &scratch.lineSizes[1]);
         if (status != RETURN_OK) goto exit;
     }
     if (image->mask)
     {
         status = arraybuffer_init(&mbuf, image->mask, image->mdtype, image->raw_w, h,
-                                  stacksize, bufh);
+                                  stacksize, bufh, &scratch.lines[2], &scratch.lineSizes[2]);
         if (status != RETURN_OK) goto exit;
     }
 
@@ -333,13 +463,18 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     finalobjlist->nobj = finalobjlist->npix = 0;
 
 
-    /* Allocate memory for the pixel list */
+    /* Get the pixel list. It starts with the size that was needed so far, or a modest
+     * size for the first frame, and grows below up to `max_pixstack` pixels. */
     plistinit((conv != NULL), (image->noise_type != SEP_NOISE_NONE));
-    if (!(pixel = objlist.plist = (pliststruct *)malloc(nposize = mem_pixstack * plistsize)))
-    {
-        status = MEMORY_ALLOC_ERROR;
-        goto exit;
-    }
+    mem_pixstack = scratch.pixelSize / plistsize;
+    if (mem_pixstack < 2)
+        mem_pixstack = max_pixstack < PIXSTACK_INITIAL ? max_pixstack : PIXSTACK_INITIAL;
+    else if (mem_pixstack > max_pixstack)
+        mem_pixstack = max_pixstack;
+    status = reserve_buffer(&scratch.pixel, &scratch.pixelSize, mem_pixstack * plistsize);
+    if (status != RETURN_OK) goto exit;
+    pixel = objlist.plist = scratch.pixel;
+    nposize = mem_pixstack * plistsize;
 
     /*----- at the beginning, "free" object fills the whole pixel list */
     freeinfo.firstpix = 0;
@@ -356,17 +491,19 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
 
     if (conv)
     {
-        /* allocate memory for convolved buffers */
-        QMALLOC(cdscan, PIXTYPE, stacksize, status);
+        /* the convolved buffers are kept with the other per column arrays */
+        cdscan = scratch.cdscan;
         if (filter_type == SEP_FILTER_MATCHED)
         {
-            QMALLOC(sigscan, PIXTYPE, stacksize, status);
-            QMALLOC(workscan, PIXTYPE, stacksize, status);
+            sigscan = scratch.sigscan;
+            workscan = scratch.workscan;
         }
 
         /* normalize the filter */
         convn = convw * convh;
-        QMALLOC(convnorm, PIXTYPE, convn, status);
+        status = reserve_buffer(&scratch.convnorm, &scratch.convnormSize, convn);
+        if (status != RETURN_OK) goto exit;
+        convnorm = scratch.convnorm;
         for (i = 0; i < convn; i++)
             sum += fabs(conv[i]);
         for (i = 0; i < convn; i++)
@@ -382,9 +519,30 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     plist_values.plistoff_var = plistoff_var;
     plist_values.plistsize = plistsize;
 
-    analyze.reset(new Analyze(plist_values));
-    lutz.reset(new Lutz(image->w, image->h, analyze.get(), plist_values));
-    deblend.reset(new Deblend(deblend_nthresh, plist_values));
+    /* the analyzer, lutz and the deblender only depend on the pixel list layout, the width
+     * and the number of thresholds, so they are kept while these stay the same. */
+    if (!analyze || memcmp(&plist_values, &analyze_plist_values, sizeof(plistvalues)) != 0)
+    {
+        analyze.reset(new Analyze(plist_values));
+        analyze_plist_values = plist_values;
+        lutz.reset();
+        deblend.reset();
+    }
+    if (!lutz || lutz_width != image->w || lutz_height != image->h)
+    {
+        lutz.reset(new Lutz(image->w, image->h, analyze.get(), plist_values));
+        lutz_width = image->w;
+        lutz_height = image->h;
+    }
+    /* the deblender is seeded the same way on each call to get consistent
+     * results. Its random generator is used to assign the faint pixels. */
+    if (!deblend || deblend_nthresh_used != deblend_nthresh)
+    {
+        deblend.reset(new Deblend(deblend_nthresh, plist_values, 1));
+        deblend_nthresh_used = deblend_nthresh;
+    }
+    else
+        deblend->reseed(1);
 
 
     /*----- MAIN LOOP ------ */
@@ -399,7 +557,6 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
         {
             if (conv)
             {
-                free(cdscan);  // cdscan set to dummyscan below
                 if (filter_type == SEP_FILTER_MATCHED)
                 {
                     for (xl = 0; xl < stacksize; xl++)
@@ -520,37 +677,39 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
                 /* Check if we have run out of free pixels in objlist.plist */
                 if (freeinfo.firstpix == freeinfo.lastpix)
                 {
-                    status = PIXSTACK_FULL;
-                    snprintf(errtext, 240,
-                            "The limit of %d active object pixels over the "
-                            "detection threshold was reached. Check that "
-                            "the image is background subtracted and the "
-                            "detection threshold is not too low. If you "
-                            "need to increase the limit, use "
-                            "set_extract_pixstack.",
-                            (int)mem_pixstack); //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
-                    // TODO report error
-                    //put_errdetail(errtext);
-                    goto exit;
-
-                    /* The code in the rest of this block increases the
-                     * stack size as needed. Currently, it is never
-                     * executed. This is because it isn't clear that
-                     * this is a good idea: most times when the stack
-                     * overflows it is due to user error: too-low
-                     * threshold or image not background subtracted. */
+                    /* Most times when the stack overflows at the limit it
+                     * is due to user error: too-low threshold or image not
+                     * background subtracted. So it only grows up to the
+                     * limit, which is the size the stack used to start with. */
+                    if (mem_pixstack >= max_pixstack)
+                    {
+                        status = PIXSTACK_FULL;
+                        snprintf(errtext, 240,
+                                "The limit of %d active object pixels over the "
+                                "detection threshold was reached. Check that "
+                                "the image is background subtracted and the "
+                                "detection threshold is not too low. If you "
+                                "need to increase the limit, use "
+                                "set_extract_pixstack.",
+                                (int)mem_pixstack); //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
+                        // TODO report error
+                        //put_errdetail(errtext);
+                        goto exit;
+                    }
 
-                    /* increase the stack size */
+                    /* increase the stack size, the larger stack is kept for the next frames */
                     oldnposize = nposize;
-                    mem_pixstack = (int)(mem_pixstack * 2);
+                    mem_pixstack = mem_pixstack * 2 < max_pixstack ? mem_pixstack * 2 : max_pixstack;
                     nposize = mem_pixstack * plistsize;
-                    pixel = (pliststruct *)realloc(pixel, nposize);
-                    objlist.plist = pixel;
+                    pixel = (pliststruct *)realloc(scratch.pixel, nposize);
                     if (!pixel)
                     {
+                        pixel = objlist.plist = scratch.pixel;
                         status = MEMORY_ALLOC_ERROR;
                         goto exit;
                     }
+                    scratch.pixel = objlist.plist = pixel;
+                    scratch.pixelSize = nposize;
 
                     /* set next free pixel to the start of the new block
                      * and link up all the pixels in the new block */
@@ -704,7 +863,12 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
                 goto exit;
         }
         if(finalobjlist->nobj > 0) //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning, in case nobj is 0 or less.
-            QMALLOC(survives, int, finalobjlist->nobj, status);
+        {
+            status = reserve_buffer(&scratch.survives, &scratch.survivesSize, finalobjlist->nobj);
+            if (status != RETURN_OK)
+                goto exit;
+            survives = scratch.survives;
+        }
         clean(finalobjlist, clean_param, survives);
     }
 
@@ -725,49 +889,7 @@ exit:
         free(finalobjlist);
         finalobjlist = 0;        //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     }
-    free(pixel);
-    pixel = 0;                   //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(info);
-    info = 0;                    //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(store);
-    store = 0;                   //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(marker);
-    marker = 0;                  //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(psstack);
-    psstack = 0;                 //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(start);
-    start = 0;                   //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(end);
-    end = 0;                     //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    free(survives);
-    survives = 0;                //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    arraybuffer_free(&dbuf);
-    if (image->noise)
-        arraybuffer_free(&nbuf);
-    if (image->mask)
-        arraybuffer_free(&mbuf);
-    if (conv){
-        free(convnorm);
-        convnorm = 0;            //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    }
-    if (filter_type == SEP_FILTER_MATCHED)
-    {
-        free(sigscan);
-        sigscan = 0;             //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-        free(workscan);
-        workscan = 0;            //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    }
-
-    /* free cdscan if we didn't do it on the last `yl` line */
-    if (conv && (cdscan != dummyscan))
-    {
-        free(cdscan);
-        cdscan = 0;              //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
-    }
-
-    //# Modified by Hy Murveit for the StellarSolver Internal Library, possible bug. Moved free(dummyscan) to here from earlier since it was referenced in the if above.
-    free(dummyscan);
-    dummyscan = 0;
+    /* the other buffers belong to the scratch buffers of this context and are kept for the next call */
 
     if (status != RETURN_OK)
     {
@@ -27,6 +27,7 @@
 
 #include <stdint.h>
 #include <cstring>
+#include <memory>
 
 namespace SEP
 {
@@ -34,6 +35,14 @@ namespace SEP
 class Lutz;
 class Deblend;
 class Analyze;
+class Extract;
+
+/* Hands an extraction context back to the pool instead of deleting it, see Extract::acquire() */
+struct ExtractRelease
+{
+    void operator()(Extract *extract) const;
+};
+typedef std::unique_ptr<Extract, ExtractRelease> PooledExtract;
 
 class Extract
 {
@@ -42,6 +51,14 @@ class Extract
         Extract();
         ~Extract();
 
+        /* Takes an idle extraction context from a process wide pool, or creates one if none is idle.
+         * The context keeps its scratch buffers between calls to sep_extract, so a stream of frames
+         * of the same size only allocates them for the first frame. It goes back to the pool when
+         * the returned pointer is destroyed, or is deleted if the pool is full. */
+        static PooledExtract acquire();
+        /* Deletes the idle contexts in the pool and the buffers they hold, see StellarSolver::clearExtractionPool() */
+        static void clear_pool();
+
         int sep_extract(sep_image *image, float thresh, int thresh_type,
                         int minarea, float *conv, int convw, int convh,
                         int filter_type, int deblend_nthresh, double deblend_cont,
@@ -72,9 +89,8 @@ class Extract
 
 
         int arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int h,
-                             int bufw, int bufh);
+                             int bufw, int bufh, PIXTYPE **storage, size_t *capacity);
         void arraybuffer_readline(arraybuffer *buf);
-        void arraybuffer_free(arraybuffer *buf);
 
     private:
 
@@ -82,6 +98,36 @@ class Extract
         std::unique_ptr<Lutz> lutz;
         std::unique_ptr<Analyze> analyze;
 
+        /* Buffers kept from one call of sep_extract to the next, they only grow.
+         * The per column arrays all hold `columns` elements. */
+        struct ScratchBuffers
+        {
+            size_t columns = 0;
+            infostruct *info = nullptr, *store = nullptr;
+            char *marker = nullptr;
+            pixstatus *psstack = nullptr;
+            int *start = nullptr, *end = nullptr;
+            PIXTYPE *dummyscan = nullptr, *cdscan = nullptr, *sigscan = nullptr, *workscan = nullptr;
+            PIXTYPE *convnorm = nullptr;
+            size_t convnormSize = 0;
+            PIXTYPE *lines[3] = {nullptr, nullptr, nullptr};
+            size_t lineSizes[3] = {0, 0, 0};
+            int *survives = nullptr;
+            size_t survivesSize = 0;
+            /* The pixel list in bytes. It starts small and doubles up to extract_pixstack pixels when
+             * a frame needs more, later frames then start with the size the busiest frame needed. */
+            pliststruct *pixel = nullptr;
+            size_t pixelSize = 0;
+        } scratch;
+
+        /* Settings the deblender, lutz and analyzer were created with, they are reused while these match */
+        plistvalues analyze_plist_values;
+        int deblend_nthresh_used = 0;
+        int lutz_width = 0, lutz_height = 0;
+
+        int reserve_columns(size_t columns);
+        void free_scratch();
+
         int convert_to_catalog(objliststruct *objlist, int *survives, sep_catalog *cat, int w, int include_pixels);
         void apply_mask_line(arraybuffer *mbuf, arraybuffer *imbuf, arraybuffer *nbuf);
 
@@ -13,7 +13,13 @@
 #else //Linux
 #include <QProcess>
 #endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include <QtConcurrent>
+#include <QSet>
 #include "internalextractorsolver.h"
+#include "sep/extract.h"
 
 #include "stellarsolver.h"
 #include "extractorsolver.h"
@@ -46,6 +52,10 @@ StellarSolver::~StellarSolver()
     // These lines make sure that before the StellarSolver is deleted, all parallel threads (if any) are shut down
 
     abortAndWait();
+
+    m_AbortIndexWarmUp = 1;
+    m_IndexWarmUp.waitForFinished();
+    qDeleteAll(m_LockedIndexFiles);
 }
 
 void StellarSolver::registerMetaTypes()
@@ -88,6 +98,7 @@ bool StellarSolver::loadNewImageBuffer(const FITSImage::Statistic &imagestats, u
     solution = {};
     solutionIndexNumber = -1;
     solutionHealpix = -1;
+    solutionLogOdds = 0;
 
     return true;
 }
@@ -109,11 +120,20 @@ ExtractorSolver* StellarSolver::createExtractorSolver()
     if(useSubframe)
         solver->setUseSubframe(m_Subframe);
     solver->m_ColorChannel = m_ColorChannel;
+    solver->m_BayerLuminance = m_BayerLuminance;
     solver->m_LogToFile = m_LogToFile;
     solver->m_LogFileName = m_LogFileName;
     solver->m_AstrometryLogLevel = m_AstrometryLogLevel;
     solver->m_SSLogLevel = m_SSLogLevel;
     solver->m_BasePath = m_BasePath;
+    if(m_UseMemoryTempFiles)
+    {
+        const QString memoryTempPath = getMemoryTempPath();
+        if(memoryTempPath.isEmpty())
+            emit logOutput("There is no memory backed directory for the temporary files, using " + m_BasePath);
+        else
+            solver->m_BasePath = memoryTempPath;
+    }
     solver->m_ActiveParameters = params;
     solver->convFilter = convFilter;
     solver->indexFolderPaths = indexFolderPaths;
@@ -144,6 +164,21 @@ ExternalProgramPaths StellarSolver::getDefaultExternalPaths()
 #endif
 }
 
+QString StellarSolver::getMemoryTempPath()
+{
+#if defined(Q_OS_LINUX)
+    // /dev/shm is a tmpfs on just about every distribution, the runtime directory of the user is one where systemd manages it
+    const QStringList candidates = {"/dev/shm", QString::fromLocal8Bit(qgetenv("XDG_RUNTIME_DIR"))};
+    for(const QString &path : candidates)
+    {
+        QFileInfo directory(path);
+        if(!path.isEmpty() && directory.isDir() && directory.isWritable())
+            return directory.absoluteFilePath();
+    }
+#endif
+    return QString();
+}
+
 QStringList StellarSolver::getIndexFiles(const QStringList &directoryList, int indexToUse, int healpixToUse)
 {
     QStringList indexFileList;
@@ -151,43 +186,198 @@ QStringList StellarSolver::getIndexFiles(const QStringList &directoryList, int i
     {
         const QString &currentPath = directoryList[i];
         QDir dir(currentPath);
-        QStringList dirIndexFiles;
+        QFileInfoList dirIndexFiles;
         if(dir.exists())
         {
             if(indexToUse < 0)
             {
-                // Find all fits files in the folder.
-                dir.setNameFilters(QStringList() << "*.fits" << "*.fit");
-                dirIndexFiles << dir.entryList();
+                // Find all fits files and native index files in the folder.
+                dirIndexFiles << indexFilesInFolder(dir, QStringList() << "*.fits" << "*.fit" << "*.ssidx");
             }
             else
             {
-                QString name1, name2;
+                QString name1, name2, name3;
                 if (healpixToUse >= 0)
                 {
                     // Find all the fits files in the folder associated with the index and healpix.
                     QString hStr = QString("%1").arg(healpixToUse, 2, 10, (QChar) '0');
                     name1 = "index-" + QString::number(indexToUse) + "-" + hStr + ".fits";
                     name2 = "index-" + QString::number(indexToUse) + "-" + hStr + ".fit";
+                    name3 = "index-" + QString::number(indexToUse) + "-" + hStr + ".ssidx";
                 }
                 else
                 {
                     // Find all the fits files in the folder associated with the index number.
                     name1 = "index-" + QString::number(indexToUse) + "*.fits";
                     name2 = "index-" + QString::number(indexToUse) + "*.fit";
+                    name3 = "index-" + QString::number(indexToUse) + "*.ssidx";
                 }
-                dir.setNameFilters(QStringList() << name1 << name2);
-                dirIndexFiles << dir.entryList();
+                dirIndexFiles << indexFilesInFolder(dir, QStringList() << name1 << name2 << name3);
             }
             for(int i = 0; i < dirIndexFiles.count(); i++)
             {
-               indexFileList.append(dir.absolutePath() + QDir::separator() + dirIndexFiles.at(i));
+               indexFileList.append(dir.absolutePath() + QDir::separator() + dirIndexFiles.at(i).fileName());
             }
         }
     }
     return indexFileList;
 }
 
+QFileInfoList StellarSolver::indexFilesInFolder(const QDir &dir, const QStringList &nameFilters)
+{
+    const QFileInfoList found = dir.entryInfoList(nameFilters, QDir::Files);
+    QSet<QString> names;
+    foreach(const QFileInfo &info, found)
+        names.insert(info.fileName());
+
+    // Like the solver's index search, a converted index is only used through its native index (see convertIndexFile)
+    QFileInfoList indexFiles;
+    foreach(const QFileInfo &info, found)
+    {
+        const QString suffix = info.suffix().toLower();
+        if((suffix == "fits" || suffix == "fit") && names.contains(info.completeBaseName() + ".ssidx"))
+            continue;
+        indexFiles.append(info);
+    }
+    return indexFiles;
+}
+
+void StellarSolver::clearExtractionPool()
+{
+    SEP::Extract::clear_pool();
+}
+
+bool StellarSolver::convertIndexFile(const QString &indexFile, const QString &outputFile, bool expand)
+{
+    QString nativeFile = outputFile;
+    if(nativeFile.isEmpty())
+    {
+        const QFileInfo info(indexFile);
+        nativeFile = info.absolutePath() + QDir::separator() + info.completeBaseName() + ".ssidx";
+    }
+    return InternalExtractorSolver::convertIndexFile(indexFile, nativeFile, expand);
+}
+
+bool StellarSolver::warmUpIndexes(qint64 lockBudget)
+{
+    if(m_IndexWarmUp.isRunning())
+        return false;
+
+    // The range of quad sizes the solver will look for in arcseconds, worked out the same way as for the solve
+    const double width = m_Statistics.width > 0 ? m_Statistics.width : 1000;
+    const double height = m_Statistics.height > 0 ? m_Statistics.height : width;
+    double scaleLow = params.minwidth * 3600.0 / width;    // arcsec per pixel
+    double scaleHigh = params.maxwidth * 3600.0 / height;
+    if(m_UseScale)
+    {
+        switch(m_ScaleUnit)
+        {
+            case DEG_WIDTH:
+                scaleLow = m_ScaleLow * 3600.0 / width;
+                scaleHigh = m_ScaleHigh * 3600.0 / width;
+                break;
+            case ARCMIN_WIDTH:
+                scaleLow = m_ScaleLow * 60.0 / width;
+                scaleHigh = m_ScaleHigh * 60.0 / width;
+                break;
+            case ARCSEC_PER_PIX:
+                scaleLow = m_ScaleLow;
+                scaleHigh = m_ScaleHigh;
+                break;
+            case FOCAL_MM:
+                // "35 mm" film is 36 mm wide.
+                scaleLow = qRadiansToDegrees(atan(36. / (2. * m_ScaleHigh))) * 3600.0 / width;
+                scaleHigh = qRadiansToDegrees(atan(36. / (2. * m_ScaleLow))) * 3600.0 / width;
+                break;
+        }
+    }
+    const double quadLow = DEFAULT_QSF_LO * qMin(width, height) * scaleLow;
+    const double quadHigh = DEFAULT_QSF_HI * hypot(width, height) * scaleHigh;
+
+    const QStringList files = InternalExtractorSolver::selectIndexFiles(indexFolderPaths, m_IndexFilePaths, quadLow, quadHigh,
+                              m_UsePosition, m_SearchRA, m_SearchDE, params.search_radius);
+    if(files.isEmpty())
+    {
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("There are no index files to warm up.");
+        return false;
+    }
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Warming up %1 index files.").arg(files.count()));
+
+    m_AbortIndexWarmUp = 0;
+    m_IndexWarmUp = QtConcurrent::run([this, files, lockBudget]()
+    {
+        warmUpIndexFiles(files, lockBudget);
+    });
+    return true;
+}
+
+void StellarSolver::warmUpIndexFiles(const QStringList &files, qint64 lockBudget)
+{
+    // Pages are touched one by one so that they are really read, progress is reported after every block
+    const qint64 pageSize = 4096;
+    const qint64 blockSize = 4 * 1024 * 1024;
+
+    qint64 bytesTotal = 0;
+    for(const QString &fileName : files)
+        bytesTotal += QFileInfo(fileName).size();
+    qint64 bytesDone = 0;
+    emit indexWarmUpProgress(bytesDone, bytesTotal);
+
+    for(const QString &fileName : files)
+    {
+        if(m_AbortIndexWarmUp)
+            return;
+        QScopedPointer<QFile> file(new QFile(fileName));
+        const qint64 size = file->size();
+        uchar *data = nullptr;
+        if(file->open(QIODevice::ReadOnly))
+            data = file->map(0, size);
+        if(!data)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("Could not map the index file " + fileName + " to warm it up.");
+            bytesDone += size;
+            emit indexWarmUpProgress(bytesDone, bytesTotal);
+            continue;
+        }
+#ifndef _WIN32
+        // This lets the system read the whole file ahead, touching the pages below then mostly waits for that
+        madvise(data, size, MADV_WILLNEED);
+#endif
+        for(qint64 block = 0; block < size; block += blockSize)
+        {
+            if(m_AbortIndexWarmUp)
+                return;
+            const qint64 blockEnd = qMin(size, block + blockSize);
+            volatile uchar touched = 0;
+            for(qint64 i = block; i < blockEnd; i += pageSize)
+                touched = data[i];
+            Q_UNUSED(touched);
+            bytesDone += blockEnd - block;
+            emit indexWarmUpProgress(bytesDone, bytesTotal);
+        }
+
+        // Files are locked whole, as long as they fit in what is left of the budget
+        if(size > lockBudget)
+            continue;
+#ifndef _WIN32
+        if(mlock(data, size) == 0)
+        {
+            lockBudget -= size;
+            m_LockedIndexFiles.append(file.take());
+        }
+        else if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("Could not lock the index file " + fileName + " in memory: " + QString::fromLocal8Bit(strerror(errno)));
+#else
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("Locking index files in memory is not supported on this system.");
+        lockBudget = 0;
+#endif
+    }
+}
+
 bool StellarSolver::extract(bool calculateHFR, QRect frame)
 {
     m_ProcessType = calculateHFR ? EXTRACT_WITH_HFR : EXTRACT;
@@ -217,6 +407,149 @@ bool StellarSolver::solve()
     return m_HasSolved;
 }
 
+bool StellarSolver::startStripExtraction(const FITSImage::Statistic &stripStats, bool calculateHFR)
+{
+    if(isRunning())
+        return false;
+    if(stripStats.channels != 1 || stripStats.width == 0)
+    {
+        emit logOutput("Strip extraction needs an image with one channel.");
+        return false;
+    }
+    if(m_ExtractorType == EXTRACTOR_EXTERNAL)
+    {
+        emit logOutput("Strip extraction needs the internal star extractor.");
+        return false;
+    }
+
+    m_ProcessType = calculateHFR ? EXTRACT_WITH_HFR : EXTRACT;
+    m_CalculateHFR = calculateHFR;
+    useSubframe = false;
+    m_StripStats = stripStats;
+    m_StripWindow.clear();
+    m_StripWindowTop = 0;
+    m_StripDoneRows = 0;
+    m_ExtractingStrips = true;
+    m_HasExtracted = false;
+    m_HasFailed = false;
+    m_ExtractorStars.clear();
+    numStars = 0;
+    background = {};
+
+    //This is necessary before extracting so that the correct convolution filter gets passed to the ExtractorSolvers
+    updateConvolutionFilter();
+    return true;
+}
+
+QList<FITSImage::Star> StellarSolver::addImageStrip(uint8_t const *rows, int rowCount)
+{
+    QList<FITSImage::Star> stars;
+    if(!m_ExtractingStrips || rows == nullptr || rowCount <= 0)
+        return stars;
+
+    // Tall strips are added in parts, so that the window never gets taller than an image can be
+    const int maxPartRows = 8192;
+    const int rowSize = m_StripStats.width * m_StripStats.bytesPerPixel;
+    for(int added = 0; added < rowCount; added += maxPartRows)
+    {
+        const int partRows = qMin(maxPartRows, rowCount - added);
+        m_StripWindow.append(reinterpret_cast<const char *>(rows) + static_cast<size_t>(added) * rowSize, partRows * rowSize);
+        // The stars in the last rows of the window could go on in the next strip, so they wait for it.
+        // The window is only extracted once enough new rows are pending, or thin strips would extract each row many times.
+        const int windowBottom = m_StripWindowTop + m_StripWindow.size() / rowSize;
+        const int endRow = windowBottom - stripMargin();
+        if(endRow - m_StripDoneRows >= stripBatchRows())
+            stars.append(extractStripWindow(endRow));
+    }
+    return stars;
+}
+
+QList<FITSImage::Star> StellarSolver::finishStripExtraction()
+{
+    QList<FITSImage::Star> stars;
+    if(!m_ExtractingStrips)
+        return stars;
+
+    const int rowSize = m_StripStats.width * m_StripStats.bytesPerPixel;
+    const int windowBottom = m_StripWindowTop + m_StripWindow.size() / rowSize;
+    if(windowBottom > m_StripDoneRows)
+        stars = extractStripWindow(windowBottom);
+
+    m_StripWindow.clear();
+    m_ExtractingStrips = false;
+    m_HasExtracted = !m_HasFailed;
+    return stars;
+}
+
+QList<FITSImage::Star> StellarSolver::extractStripWindow(int endRow)
+{
+    QList<FITSImage::Star> stars;
+    const int rowSize = m_StripStats.width * m_StripStats.bytesPerPixel;
+    const int windowRows = m_StripWindow.size() / rowSize;
+    FITSImage::Statistic windowStats = m_StripStats;
+    windowStats.height = windowRows;
+    windowStats.samples_per_channel = m_StripStats.width * windowRows;
+
+    // The window is extracted like a whole image, but the filters that count stars would only count the ones in the window
+    Parameters windowParams = params;
+    windowParams.removeBrightest = 0;
+    windowParams.removeDimmest = 0;
+    windowParams.keepNum = 0;
+
+    QScopedPointer<ExtractorSolver> solver(new InternalExtractorSolver(m_ProcessType, EXTRACTOR_INTERNAL, m_SolverType, windowStats,
+                                           reinterpret_cast<const uint8_t *>(m_StripWindow.constData()), nullptr));
+    solver->m_BayerLuminance = m_BayerLuminance;
+    solver->m_SSLogLevel = m_SSLogLevel;
+    solver->m_ActiveParameters = windowParams;
+    solver->convFilter = convFilter;
+    if(m_SSLogLevel != LOG_OFF)
+        connect(solver.data(), &ExtractorSolver::logOutput, this, &StellarSolver::logOutput);
+
+    if(solver->extract() != 0)
+    {
+        emit logOutput("Star extraction failed on the image strips.");
+        m_HasFailed = true;
+    }
+    else
+    {
+        // Only the stars between the rows that were done before and endRow are new, the others belong to other windows
+        for(const auto &oneStar : solver->getStarList())
+        {
+            const float y = oneStar.y + m_StripWindowTop;
+            if(y < m_StripDoneRows || y >= endRow)
+                continue;
+            stars.append(oneStar);
+            stars.last().y = y;
+        }
+        background = solver->getBackground();
+        m_ExtractorStars.append(stars);
+        numStars = m_ExtractorStars.size();
+    }
+
+    // The next window only needs the rows of its margin above endRow
+    m_StripDoneRows = endRow;
+    const int firstKeptRow = qMax(m_StripWindowTop, endRow - stripMargin());
+    m_StripWindow.remove(0, (firstKeptRow - m_StripWindowTop) * rowSize);
+    m_StripWindowTop = firstKeptRow;
+    return stars;
+}
+
+int StellarSolver::stripMargin() const
+{
+    int margin = params.maxSize / 2;
+    if (margin <= 20)
+        margin = 20;
+    else if (margin > 50)
+        margin = 50;
+    return margin;
+}
+
+int StellarSolver::stripBatchRows() const
+{
+    // The internal extractor estimates the background in meshes of 64 rows
+    return qMax(stripMargin(), 64);
+}
+
 void StellarSolver::start()
 {
     if(checkParameters() == false)
@@ -353,7 +686,7 @@ bool StellarSolver::checkParameters()
 
         if(params.inParallel)
         {
-            if(enoughRAMisAvailableFor(indexFolderPaths))
+            if(enoughRAMisAvailableFor(indexFolderPaths, m_IndexFilePaths))
             {
                 if(m_SSLogLevel != LOG_OFF)
                     emit logOutput("There should be enough RAM to load the indexes in parallel.");
@@ -382,6 +715,9 @@ void StellarSolver::parallelSolve()
     qDeleteAll(parallelSolvers);
     parallelSolvers.clear();
     m_ParallelSolversFinishedCount = 0;
+    m_BestSolutionSolver = 0;
+    m_BestSolutionTimer.setSingleShot(true);
+    connect(&m_BestSolutionTimer, &QTimer::timeout, this, &StellarSolver::stopSearchingForBestSolution, Qt::UniqueConnection);
     int threads = QThread::idealThreadCount();
 
     if(params.multiAlgorithm == MULTI_SCALES)
@@ -491,6 +827,7 @@ void StellarSolver::processFinished(int code)
             solution = m_ExtractorSolver->getSolution();
             solutionIndexNumber = m_ExtractorSolver->getSolutionIndexNumber();
             solutionHealpix = m_ExtractorSolver->getSolutionHealpix();
+            solutionLogOdds = m_ExtractorSolver->getSolutionLogOdds();
             m_SolverStars = m_ExtractorSolver->getStarList();
             if(m_ExtractorSolver->hasWCSData())
             {
@@ -541,7 +878,38 @@ void StellarSolver::finishParallelSolve(ExtractorSolver *reportingSolver, int su
     if(!reportingSolver)
         return;
 
-    if(success == 0 && !m_HasSolved)
+    // Without an event loop the child solvers report from their own threads and the timer can't end the search
+    if(success == 0 && !m_HasSolved && params.bestSolutionTime > 0 && QCoreApplication::instance())
+    {
+        double logOdds = reportingSolver->getSolutionLogOdds();
+        bool first = (m_BestSolutionSolver == 0);
+        if(first || logOdds > solutionLogOdds)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput(QString("Child solver: %1 has the best solution so far, log odds %2").arg(whichSolver(reportingSolver)).arg(logOdds));
+            m_BestSolutionSolver = whichSolver(reportingSolver);
+            takeSolutionFrom(reportingSolver);
+        }
+        if(logOdds >= params.logratio_tostopsearching)
+        {
+            m_BestSolutionTimer.stop();
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("That solution is good enough, shutting down other child solvers");
+            for(auto &solver : parallelSolvers)
+            {
+                disconnect(solver, &ExtractorSolver::logOutput, this, &StellarSolver::logOutput);
+                if(solver->isRunning())
+                    solver->abort();
+            }
+        }
+        else if(first)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput(QString("Searching up to %1 more seconds for a better solution").arg(params.bestSolutionTime));
+            m_BestSolutionTimer.start(params.bestSolutionTime * 1000);
+        }
+    }
+    else if(success == 0 && !m_HasSolved)
     {
         for(auto &solver : parallelSolvers)
         {
@@ -555,20 +923,9 @@ void StellarSolver::finishParallelSolve(ExtractorSolver *reportingSolver, int su
             emit logOutput("Shutting down other child solvers");
         }
 
-        numStars = reportingSolver->getNumStarsFound();
-        solution = reportingSolver->getSolution();
-        solutionIndexNumber = reportingSolver->getSolutionIndexNumber();
-        solutionHealpix = reportingSolver->getSolutionHealpix();
-        m_SolverStars = reportingSolver->getStarList();
-
+        takeSolutionFrom(reportingSolver);
         if(reportingSolver->hasWCSData())
-        {
-            wcsData = reportingSolver->getWCSData();
-            hasWCS = true;
-            if(m_ExtractorStars.count() > 0)
-                wcsData.appendStarsRAandDEC(m_ExtractorStars);
             m_isRunning = false;
-        }
         m_HasSolved = true;
         m_ExtractorSolver->cleanupTempFiles();
         emitReady = true;
@@ -581,7 +938,15 @@ void StellarSolver::finishParallelSolve(ExtractorSolver *reportingSolver, int su
 
     if(m_ParallelSolversFinishedCount == parallelSolvers.count())
     {
+        m_BestSolutionTimer.stop();
         m_isRunning = false;
+        if(!m_HasSolved && m_BestSolutionSolver != 0)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput(QString("Using the solution of child solver: %1, log odds %2").arg(m_BestSolutionSolver).arg(solutionLogOdds));
+            m_HasSolved = true;
+            emitReady = true;
+        }
         if(!m_HasSolved){
             m_HasFailed = true;
             emitReady = true; //Since this was emitted earlier if it had been solved
@@ -596,6 +961,36 @@ void StellarSolver::finishParallelSolve(ExtractorSolver *reportingSolver, int su
     if (emitFinished) emit finished();
 }
 
+void StellarSolver::takeSolutionFrom(ExtractorSolver *solver)
+{
+    numStars = solver->getNumStarsFound();
+    solution = solver->getSolution();
+    solutionIndexNumber = solver->getSolutionIndexNumber();
+    solutionHealpix = solver->getSolutionHealpix();
+    solutionLogOdds = solver->getSolutionLogOdds();
+    m_SolverStars = solver->getStarList();
+
+    if(solver->hasWCSData())
+    {
+        wcsData = solver->getWCSData();
+        hasWCS = true;
+        if(m_ExtractorStars.count() > 0)
+            wcsData.appendStarsRAandDEC(m_ExtractorStars);
+    }
+}
+
+void StellarSolver::stopSearchingForBestSolution()
+{
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("No better solution after %1 seconds, shutting down other child solvers").arg(params.bestSolutionTime));
+    for(auto &solver : parallelSolvers)
+    {
+        disconnect(solver, &ExtractorSolver::logOutput, this, &StellarSolver::logOutput);
+        if(solver->isRunning())
+            solver->abort();
+    }
+}
+
 QString StellarSolver::raString(double ra)
 {
     char rastr[32];
@@ -1025,17 +1420,19 @@ bool StellarSolver::getAvailableRAM(double &availableRAM, double &totalRAM)
 }
 
 //This should determine if enough RAM is available to load all the index files in parallel
-bool StellarSolver::enoughRAMisAvailableFor(const QStringList &indexFolders)
+bool StellarSolver::enoughRAMisAvailableFor(const QStringList &indexFolders, const QStringList &indexFiles)
 {
     double totalSize = 0;
 
+    foreach(const QString &indexFile, indexFiles)
+        totalSize += QFileInfo(indexFile).size();
+
     foreach(const QString &folder, indexFolders)
     {
         QDir dir(folder);
         if(dir.exists())
         {
-            dir.setNameFilters(QStringList() << "*.fits" << "*.fit");
-            QFileInfoList indexInfoList = dir.entryInfoList();
+            QFileInfoList indexInfoList = indexFilesInFolder(dir, QStringList() << "*.fits" << "*.fit" << "*.ssidx");
             foreach(const QFileInfo &indexInfo, indexInfoList)
                 totalSize += indexInfo.size();
         }
@@ -23,6 +23,10 @@
 #include <QVector>
 #include <QRect>
 #include <QPointer>
+#include <QFuture>
+#include <QAtomicInt>
+#include <QFile>
+#include <QTimer>
 
 using namespace SSolver;
 
@@ -31,6 +35,7 @@ class StellarSolver : public QObject
         Q_OBJECT
         Q_PROPERTY(QString BasePath MEMBER m_BasePath)
         Q_PROPERTY(QString FileToProcess MEMBER m_FileToProcess)
+        Q_PROPERTY(bool FileToProcessIsUnmodified MEMBER m_FileToProcessIsUnmodified)
         Q_PROPERTY(QString AstrometryAPIKey MEMBER m_AstrometryAPIKey)
         Q_PROPERTY(QString AstrometryAPIURL MEMBER m_AstrometryAPIURL)
         Q_PROPERTY(QString LogFileName MEMBER m_LogFileName)
@@ -38,6 +43,7 @@ class StellarSolver : public QObject
         Q_PROPERTY(bool UseScale MEMBER m_UseScale)
         Q_PROPERTY(bool AutoGenerateAstroConfig MEMBER m_AutoGenerateAstroConfig)
         Q_PROPERTY(bool CleanupTemporaryFiles MEMBER m_CleanupTemporaryFiles)
+        Q_PROPERTY(bool UseMemoryTempFiles MEMBER m_UseMemoryTempFiles)
         Q_PROPERTY(bool OnlySendFITSFiles MEMBER m_OnlySendFITSFiles)
         Q_PROPERTY(bool LogToFile MEMBER m_LogToFile)
         Q_PROPERTY(SolverType SolverType MEMBER m_SolverType)
@@ -93,6 +99,13 @@ class StellarSolver : public QObject
          */
         static ExternalProgramPaths getDefaultExternalPaths();
 
+        /**
+         * @brief getMemoryTempPath gets a directory backed by memory, like /dev/shm on Linux, where the temporary files for the
+         * external programs can go instead of the BasePath when UseMemoryTempFiles is set, so they are not written to a disk or memory card
+         * @return The directory, or an empty string if the system doesn't have one
+         */
+        static QString getMemoryTempPath();
+
 
         // Notes for the function below:
         // Return the full path to index files to use when solving.
@@ -112,6 +125,34 @@ class StellarSolver : public QObject
          * @return The list of index files to use
          */
         static QStringList getIndexFiles(const QStringList &directoryList, int indexToUse = -1, int healpixToUse = -1);
+
+        /**
+         * @brief convertIndexFile converts an index file to the StellarSolver native index format (.ssidx), which loads
+         * with a single memory map of the file.  A native index placed next to the index it was made from is used in its place.
+         * @param indexFile The index file to convert
+         * @param outputFile The native index file to write, by default the index file with its extension replaced by .ssidx
+         * @param expand Whether to store the star and code trees as doubles, which makes the file larger but the searches cheaper
+         * @return Whether the index file was converted
+         */
+        static bool convertIndexFile(const QString &indexFile, const QString &outputFile = QString(), bool expand = false);
+
+        /**
+         * @brief clearExtractionPool frees the star extraction scratch buffers that are kept between extractions, so that
+         * extracting a stream of frames doesn't allocate them again for each frame.  Call it to get that memory back
+         * when no more extractions are coming for a while.
+         */
+        static void clearExtractionPool();
+
+        /**
+         * @brief warmUpIndexes reads the index files that a solve with the current scale and position settings would search
+         * into the system's file cache in a background thread, so that the first solve doesn't wait for them to come off the disk.
+         * The indexes are picked for the loaded image, or for a square field if there is no image yet.
+         * Progress is reported with the indexWarmUpProgress signal.
+         * @param lockBudget If not 0, whole index files up to this many bytes are also locked in memory, so they are not paged
+         * out again while this StellarSolver exists.  The system limit on locked memory still applies.
+         * @return false if a warm up is still running or no index files were selected
+         */
+        bool warmUpIndexes(qint64 lockBudget = 0);
   
         /**
          * @brief getCommandString gets the processType as a string explaining the command StellarSolver is Running
@@ -207,6 +248,32 @@ class StellarSolver : public QObject
          */
         bool extract(bool calculateHFR = false, QRect frame = QRect());
 
+        /**
+         * @brief startStripExtraction starts a Star Extraction on an image that arrives in strips of rows, like the images of drift-scan and line-scan cameras.
+         * The strips are passed to addImageStrip as they arrive, and finishStripExtraction ends the image. Only a window of rows around the last strip is kept,
+         * so the stars come out with a delay of up to about 120 rows and the image can be as long as needed. The stars are in the coordinates of the whole image.
+         * @param stripStats The statistics of the strips. The height is ignored, the image must have one channel.
+         * @param calculateHFR If true, it will also calculated Half-Flux Radius for each detected star.
+         * @return A boolean that reports whether the strips can be extracted, true means success.
+         * @note The removeBrightest, removeDimmest and keepNum filters are not applied, since they would apply to each window of rows.
+         */
+        bool startStripExtraction(const FITSImage::Statistic &stripStats, bool calculateHFR = false);
+
+        /**
+         * @brief addImageStrip adds the next rows of the image of startStripExtraction and extracts the stars that the rows complete.
+         * This is performed synchronously, the data is copied so it can be reused as soon as it returns.
+         * @param rows The data of the rows, in the format given to startStripExtraction
+         * @param rowCount The number of rows
+         * @return The stars that are complete now that these rows are in, they are also appended to getStarList()
+         */
+        QList<FITSImage::Star> addImageStrip(uint8_t const *rows, int rowCount);
+
+        /**
+         * @brief finishStripExtraction ends the image of startStripExtraction, extracting the stars left in its last rows.
+         * @return The stars that were left, they are also appended to getStarList()
+         */
+        QList<FITSImage::Star> finishStripExtraction();
+
         /**
          * @brief solve Plate Solves the image.  This is performed synchronously and blocks the calling thread until the finished signal is emitted.
          * @return A boolean that reports whether it was successful, true means success.
@@ -444,6 +511,15 @@ class StellarSolver : public QObject
             return solutionHealpix;
         };
 
+        /**
+         * @brief getSolutionLogOdds gets the log odds of the latest plate solve, how much more likely the solution is than a chance match
+         * @return The log odds, or 0 if they are not known
+         */
+        double getSolutionLogOdds()
+        {
+            return solutionLogOdds;
+        };
+
         /**
          * @brief extractionDone Whether or not star extraction has been completed
          * @return true means the star extraction is done
@@ -549,6 +625,26 @@ class StellarSolver : public QObject
             m_ColorChannel = (FITSImage::ColorChannel) channel;
         };
 
+        /**
+         * @brief setBayerLuminance tells StellarSolver that the 1 channel image is the raw data of a color camera, still in its Bayer pattern.
+         * Star Extraction then uses the luminance computed directly from the Bayer pattern, so the image does not need to be debayered first.
+         * @param enabled Whether the image buffer holds raw Bayer data
+         * @note This is only used by the internal star extractor, the pattern itself does not matter.
+         */
+        void setBayerLuminance(bool enabled)
+        {
+            m_BayerLuminance = enabled;
+        };
+
+        /**
+         * @brief getBayerLuminance Returns whether the image is treated as raw Bayer data, see setBayerLuminance
+         * @return true means the luminance is computed from the Bayer pattern
+         */
+        bool getBayerLuminance() const
+        {
+            return m_BayerLuminance;
+        }
+
         /**
          * @brief isRunning returns whether or not a process is currently running
          * @return true means it is running
@@ -617,7 +713,9 @@ class StellarSolver : public QObject
 
         // External Process Options
         QString m_FileToProcess;                // The file that is being processed.
+        bool m_FileToProcessIsUnmodified {false}; // Set by the caller when the image buffer holds the file's pixels as they are, see fileio::bufferIsUnmodifiedFile
         bool m_CleanupTemporaryFiles {true};    // Whether or not to delete the temp files when finished
+        bool m_UseMemoryTempFiles {false};      // Whether or not to put the temp files in the directory of getMemoryTempPath instead of the BasePath
         bool m_AutoGenerateAstroConfig {true};  // Whether or not to generate the astrometry.cfg file. This is preferred so that it sends all the options requested.
         bool m_OnlySendFITSFiles {true};        // This is sometimes needed if the external solvers can't handle other file types
         ExternalProgramPaths m_ExternalPaths;   // System File Paths to external programs and files
@@ -626,6 +724,18 @@ class StellarSolver : public QObject
         QStringList indexFolderPaths;           // This is the list of folder paths that the solver will use to search for index files
         QStringList m_IndexFilePaths;           // This is an alternative to the indexFolderPaths variable.  We can just load individual index files instead of searching for them
 
+        // Index warm up, see warmUpIndexes
+        QFuture<void> m_IndexWarmUp;
+        QAtomicInt m_AbortIndexWarmUp {0};
+        QList<QFile *> m_LockedIndexFiles;      // The mapped index files that are locked in memory, they are unlocked when deleted
+
+        /**
+         * @brief warmUpIndexFiles does the work of warmUpIndexes in the background thread
+         * @param files The index files to read
+         * @param lockBudget How many bytes of them may be locked in memory
+         */
+        void warmUpIndexFiles(const QStringList &files, qint64 lockBudget);
+
         // Online Options
         QString m_AstrometryAPIKey;
         QString m_AstrometryAPIURL;
@@ -641,6 +751,9 @@ class StellarSolver : public QObject
         // By Default we should use green since most telescopes are best color corrected for Green
         int m_ColorChannel = FITSImage::GREEN;
 
+        // Whether the 1 channel image is raw Bayer data that should be converted to luminance for SEP
+        bool m_BayerLuminance = false;
+
         // The currently set parameters for StellarSolver
         Parameters params;
 
@@ -669,6 +782,16 @@ class StellarSolver : public QObject
         QScopedPointer<ExtractorSolver> m_ExtractorSolver;  // This is the single ExtractorSolver used when not working in parallel
         WCSData wcsData;                    // This is the WCS information from the last solve.
         int m_ParallelSolversFinishedCount {0};             // This is the number of parallel solvers that are done.
+        int m_BestSolutionSolver {0};                       // With a bestSolutionTime, the number of the child solver with the best solution so far, 0 if none
+        QTimer m_BestSolutionTimer;                         // This ends the bestSolutionTime
+
+    // Strip Extraction Variables, see startStripExtraction
+
+        bool m_ExtractingStrips {false};    // Whether startStripExtraction was called and the image is not finished
+        FITSImage::Statistic m_StripStats;  // The statistics of the strips
+        QByteArray m_StripWindow;           // The rows that are kept for the next extraction
+        int m_StripWindowTop {0};           // The image row of the first row in the window
+        int m_StripDoneRows {0};            // The stars above this image row were already extracted
 
     // StellarSolver Results Information
 
@@ -679,6 +802,7 @@ class StellarSolver : public QObject
         FITSImage::Solution solution;               // This is the solution that comes back from the Solver
         short solutionIndexNumber = -1;             // This is the index number of the index used to solve the image.
         short solutionHealpix = -1;                 // This is the healpix of the index used to solve the image.
+        double solutionLogOdds = 0;                 // This is the log odds of the solution.
 
     // Logging Settings for Astrometry
         bool m_LogToFile {false};                       //This determines whether or not to save the output from Astrometry.net to a file
@@ -750,6 +874,36 @@ class StellarSolver : public QObject
          */
         ExtractorSolver* createExtractorSolver();
 
+        /**
+         * @brief takeSolutionFrom copies the solution of a child solver into the results of the StellarSolver
+         * @param solver The child solver that solved
+         */
+        void takeSolutionFrom(ExtractorSolver *solver);
+
+        /**
+         * @brief stopSearchingForBestSolution aborts the child solvers that are still searching for a better solution, see Parameters::bestSolutionTime
+         */
+        void stopSearchingForBestSolution();
+
+        /**
+         * @brief extractStripWindow extracts the stars in the window of strips, see startStripExtraction
+         * @param endRow The image row where the extracted stars end, the stars below it are left for the next window
+         * @return The stars between m_StripDoneRows and endRow
+         */
+        QList<FITSImage::Star> extractStripWindow(int endRow);
+
+        /**
+         * @brief stripMargin is the number of rows around the stars of a window that are extracted along with them,
+         * so that the stars near its edges are whole. It is the same margin as between the partitions of the internal extractor.
+         */
+        int stripMargin() const;
+
+        /**
+         * @brief stripBatchRows is the number of new rows that addImageStrip waits for before it extracts the window,
+         * so that each row is extracted a few times at most however thin the strips are.
+         */
+        int stripBatchRows() const;
+
         /**
          * @brief getAvailableRAM finds out the amount of available RAM on the system
          * @param availableRAM is the variable that will be set to the available RAM found
@@ -761,9 +915,19 @@ class StellarSolver : public QObject
         /**
          * @brief enoughRAMisAvailableFor determines if there is enough RAM for the selected index files so that we don't try to load indexes inParallel unless it can handle it.
          * @param indexFolders is the list of index folders we will be searching for index files
+         * @param indexFiles is the list of index files that will be loaded besides those in the folders
          * @return true if it is successful
          */
-        bool enoughRAMisAvailableFor(const QStringList &indexFolders);
+        bool enoughRAMisAvailableFor(const QStringList &indexFolders, const QStringList &indexFiles);
+
+        /**
+         * @brief indexFilesInFolder lists the index files in a folder. A FITS index that was converted to a native index next to it
+         * is left out, since the solver only uses it through the native one.
+         * @param dir is the folder to search
+         * @param nameFilters are the patterns of the index file names to look for
+         * @return The index files found
+         */
+        static QFileInfoList indexFilesInFolder(const QDir &dir, const QStringList &nameFilters);
 
     signals:
         /**
@@ -785,5 +949,13 @@ class StellarSolver : public QObject
          */
         void finished();
 
+        /**
+         * @brief indexWarmUpProgress reports the progress of warmUpIndexes, which is done when bytesDone reaches bytesTotal.
+         * It is emitted from the thread doing the warm up.
+         * @param bytesDone How much of the selected index files has been read so far
+         * @param bytesTotal The size of all the selected index files
+         */
+        void indexWarmUpProgress(qint64 bytesDone, qint64 bytesTotal);
+
 };
 
@@ -961,6 +961,7 @@ void MainWindow::setupExternalExtractorSolverIfNeeded()
 {
     // External options
     stellarSolver.setProperty("FileToProcess", fileToProcess);
+    stellarSolver.setProperty("FileToProcessIsUnmodified", fileToProcessIsUnmodified);
     stellarSolver.setProperty("BasePath", ui->basePath->text());
     stellarSolver.setProperty("CleanupTemporaryFiles", ui->cleanupTemp->isChecked());
     stellarSolver.setProperty("AutoGenerateAstroConfig", ui->generateAstrometryConfig->isChecked());
@@ -1310,6 +1311,7 @@ bool MainWindow::imageLoad()
 
     dirPath = fileInfo.absolutePath();
     fileToProcess = fileURL;
+    fileToProcessIsUnmodified = false;
 
     clearAstrometrySettings();
 
@@ -1320,6 +1322,7 @@ bool MainWindow::imageLoad()
     if(imageLoader.loadImage(fileToProcess))
     {
         imageLoaded = true;
+        fileToProcessIsUnmodified = imageLoader.bufferIsUnmodifiedFile();
         clearImageBuffers();
         lastIndexNumber = "4"; //This will reset the filtering for index files
         lastHealpix = "";
@@ -70,6 +70,7 @@ private:
 
     StellarSolver stellarSolver;
     QString fileToProcess;
+    bool fileToProcessIsUnmodified = false;
     QList<FITSImage::Star> stars;
     int selectedStar;
 
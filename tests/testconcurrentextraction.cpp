@@ -0,0 +1,88 @@
+#include "testconcurrentextraction.h"
+
+TestConcurrentExtraction::TestConcurrentExtraction()
+{
+    int extractionsToRun = 32;
+    bool passed = runConcurrentExtractions("randomsky.fits", extractionsToRun);
+    passed = runConcurrentExtractions("pleiades.jpg", extractionsToRun) && passed;
+    if(passed)
+        printf("All concurrent catalogs are identical.\n");
+    fflush( stdout );
+    exit(passed ? 0 : 1);
+}
+
+bool TestConcurrentExtraction::runConcurrentExtractions(QString fileName, int extractionsToRun)
+{
+    fileio imageLoader;
+    if(!imageLoader.loadImage(fileName))
+    {
+        printf("Error in loading file");
+        exit(1);
+    }
+    FITSImage::Statistic stats = imageLoader.getStats();
+    const uint8_t *imageBuffer = imageLoader.getImageBuffer();
+
+    // The reference catalog is made while nothing else is extracting
+    QList<FITSImage::Star> reference = runExtraction(stats, imageBuffer);
+    printf("%s: %d stars in the reference catalog\n", fileName.toUtf8().data(), static_cast<int>(reference.count()));
+    fflush( stdout );
+
+    // The extractions wait for their partitions, which run in the global pool, so they get a pool of their own
+    QThreadPool extractionPool;
+    extractionPool.setMaxThreadCount(extractionsToRun);
+    QList<QFuture<QList<FITSImage::Star>>> futures;
+    for(int i = 0; i < extractionsToRun; i++)
+        futures.append(QtConcurrent::run(&extractionPool, &TestConcurrentExtraction::runExtraction, stats, imageBuffer));
+
+    bool passed = true;
+    for(int i = 0; i < futures.count(); i++)
+    {
+        if(!sameCatalog(reference, futures[i].result()))
+        {
+            printf("%s: catalog of concurrent extraction #%d differs from the reference\n", fileName.toUtf8().data(), i);
+            passed = false;
+        }
+    }
+    fflush( stdout );
+    delete[] imageBuffer;
+    return passed;
+}
+
+QList<FITSImage::Star> TestConcurrentExtraction::runExtraction(const FITSImage::Statistic &stats, const uint8_t *imageBuffer)
+{
+    StellarSolver stellarSolver(stats, imageBuffer, nullptr);
+    stellarSolver.setParameterProfile(SSolver::Parameters::ALL_STARS);
+    if(!stellarSolver.extract(true))
+        return QList<FITSImage::Star>();
+    return stellarSolver.getStarList();
+}
+
+bool TestConcurrentExtraction::sameCatalog(const QList<FITSImage::Star> &reference, const QList<FITSImage::Star> &stars)
+{
+    if(reference.count() != stars.count())
+        return false;
+    for(int i = 0; i < reference.count(); i++)
+    {
+        const FITSImage::Star &s1 = reference.at(i);
+        const FITSImage::Star &s2 = stars.at(i);
+        // Bit for bit, any difference means the extractions influenced each other
+        if(s1.x != s2.x || s1.y != s2.y || s1.mag != s2.mag || s1.flux != s2.flux || s1.peak != s2.peak
+                || s1.HFR != s2.HFR || s1.a != s2.a || s1.b != s2.b || s1.theta != s2.theta || s1.numPixels != s2.numPixels)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    TestConcurrentExtraction *test = new TestConcurrentExtraction();
+    app.exec();
+
+    delete test;
+
+    return 0;
+}
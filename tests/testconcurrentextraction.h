@@ -0,0 +1,28 @@
+#ifndef TESTCONCURRENTEXTRACTION_H
+#define TESTCONCURRENTEXTRACTION_H
+
+//Qt Includes
+#include <QApplication>
+#include <QObject>
+#include <QtConcurrent>
+
+#include <stdio.h>
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "stellarsolver.h"
+#include "ssolverutils/fileio.h"
+
+// This runs the same star extraction many times at once and checks that every catalog is
+// identical to one made by a single extraction, including the stars split up by deblending.
+class TestConcurrentExtraction : public QObject
+{
+    Q_OBJECT
+public:
+    TestConcurrentExtraction();
+    bool runConcurrentExtractions(QString fileName, int extractionsToRun);
+    static QList<FITSImage::Star> runExtraction(const FITSImage::Statistic &stats, const uint8_t *imageBuffer);
+    static bool sameCatalog(const QList<FITSImage::Star> &reference, const QList<FITSImage::Star> &stars);
+};
+
+#endif // TESTCONCURRENTEXTRACTION_H
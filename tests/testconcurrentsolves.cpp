@@ -0,0 +1,131 @@
+#include "testconcurrentsolves.h"
+
+extern "C" {
+#include "astrometry/errors.h"
+}
+
+TestConcurrentSolves::TestConcurrentSolves()
+{
+    bool passed = checkErrorStacks(64, 1000);
+    passed = runConcurrentSolves("pleiades.jpg", 32) && passed;
+    if(passed)
+        printf("All concurrent solves agree and kept their errors to themselves.\n");
+    fflush( stdout );
+    exit(passed ? 0 : 1);
+}
+
+bool TestConcurrentSolves::checkErrorStacks(int threadsToRun, int errorsPerThread)
+{
+    QThreadPool errorPool;
+    errorPool.setMaxThreadCount(threadsToRun);
+    QList<QFuture<bool>> futures;
+    for(int i = 0; i < threadsToRun; i++)
+        futures.append(QtConcurrent::run(&errorPool, &TestConcurrentSolves::reportErrors, i, errorsPerThread));
+
+    bool passed = true;
+    for(int i = 0; i < futures.count(); i++)
+    {
+        if(!futures[i].result())
+        {
+            printf("The error stack of thread #%d has errors of other threads or is missing some\n", i);
+            passed = false;
+        }
+    }
+    fflush( stdout );
+    return passed;
+}
+
+bool TestConcurrentSolves::reportErrors(int thread, int errorsPerThread)
+{
+    errors_start_logging_to_string();
+    for(int i = 0; i < errorsPerThread; i++)
+        report_error(__FILE__, __LINE__, __func__, "thread %d error %d", thread, i);
+    char *errors = errors_stop_logging_to_string("\n");
+
+    // The errors come back newest first
+    QStringList expected;
+    for(int i = errorsPerThread - 1; i >= 0; i--)
+        expected.append(QString("thread %1 error %2").arg(thread).arg(i));
+    bool passed = (QString::fromUtf8(errors) == expected.join("\n"));
+    free(errors);
+    errors_free();
+    return passed;
+}
+
+bool TestConcurrentSolves::runConcurrentSolves(QString fileName, int solvesToRun)
+{
+    fileio imageLoader;
+    if(!imageLoader.loadImage(fileName))
+    {
+        printf("Error in loading file");
+        exit(1);
+    }
+    FITSImage::Statistic stats = imageLoader.getStats();
+    const uint8_t *imageBuffer = imageLoader.getImageBuffer();
+
+    // The reference solution is found while nothing else is solving
+    FITSImage::Solution reference;
+    if(!runSolve(stats, imageBuffer, &reference))
+    {
+        printf("%s: the reference solve failed\n", fileName.toUtf8().data());
+        delete[] imageBuffer;
+        return false;
+    }
+    printf("%s: reference solution (RA,Dec) = (%f, %f) deg.\n", fileName.toUtf8().data(), reference.ra, reference.dec);
+    fflush( stdout );
+
+    QThreadPool solvePool;
+    solvePool.setMaxThreadCount(solvesToRun);
+    QVector<FITSImage::Solution> solutions(solvesToRun);
+    QList<QFuture<bool>> futures;
+    for(int i = 0; i < solvesToRun; i++)
+        futures.append(QtConcurrent::run(&solvePool, &TestConcurrentSolves::runSolve, stats, imageBuffer, &solutions[i]));
+
+    bool passed = true;
+    for(int i = 0; i < futures.count(); i++)
+    {
+        if(!futures[i].result())
+        {
+            printf("%s: concurrent solve #%d failed\n", fileName.toUtf8().data(), i);
+            passed = false;
+        }
+        else if(fabs(solutions[i].ra - reference.ra) > 1e-6 || fabs(solutions[i].dec - reference.dec) > 1e-6
+                || fabs(solutions[i].pixscale - reference.pixscale) > 1e-6)
+        {
+            printf("%s: concurrent solve #%d found (%f, %f) deg.\n", fileName.toUtf8().data(), i, solutions[i].ra, solutions[i].dec);
+            passed = false;
+        }
+    }
+    fflush( stdout );
+    delete[] imageBuffer;
+    return passed;
+}
+
+bool TestConcurrentSolves::runSolve(const FITSImage::Statistic &stats, const uint8_t *imageBuffer, FITSImage::Solution *solution)
+{
+    StellarSolver stellarSolver(stats, imageBuffer, nullptr);
+    stellarSolver.setProperty("ExtractorType", SSolver::EXTRACTOR_INTERNAL);
+    stellarSolver.setProperty("SolverType", SSolver::SOLVER_STELLARSOLVER);
+    stellarSolver.setProperty("ProcessType", SSolver::SOLVE);
+    stellarSolver.setParameterProfile(SSolver::Parameters::SINGLE_THREAD_SOLVING);
+    // The missing folder makes every solve report an error while it looks for index files
+    stellarSolver.setIndexFolderPaths(QStringList() << "astrometry" << "missing-index-folder");
+    if(!stellarSolver.solve())
+        return false;
+    *solution = stellarSolver.getSolution();
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    TestConcurrentSolves *test = new TestConcurrentSolves();
+    app.exec();
+
+    delete test;
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef TESTCONCURRENTSOLVES_H
+#define TESTCONCURRENTSOLVES_H
+
+//Qt Includes
+#include <QApplication>
+#include <QObject>
+#include <QtConcurrent>
+
+#include <stdio.h>
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "stellarsolver.h"
+#include "ssolverutils/fileio.h"
+
+// This runs many solves at once, each of them reporting astrometry.net errors, and checks that every
+// solve finds the same solution and that the error stacks of the threads don't mix.
+// Build it with USE_THREAD_SANITIZER to also check for data races.
+class TestConcurrentSolves : public QObject
+{
+    Q_OBJECT
+public:
+    TestConcurrentSolves();
+    bool checkErrorStacks(int threadsToRun, int errorsPerThread);
+    static bool reportErrors(int thread, int errorsPerThread);
+    bool runConcurrentSolves(QString fileName, int solvesToRun);
+    static bool runSolve(const FITSImage::Statistic &stats, const uint8_t *imageBuffer, FITSImage::Solution *solution);
+};
+
+#endif // TESTCONCURRENTSOLVES_H
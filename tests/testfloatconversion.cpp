@@ -0,0 +1,134 @@
+#include "testfloatconversion.h"
+
+FloatConversionSolver::FloatConversionSolver(const FITSImage::Statistic &stats, const uint8_t *imageBuffer) :
+    InternalExtractorSolver(EXTRACT, EXTRACTOR_INTERNAL, SOLVER_STELLARSOLVER, stats, imageBuffer)
+{
+}
+
+bool FloatConversionSolver::convert(int d)
+{
+    return convertToFloatImage(d);
+}
+
+const float *FloatConversionSolver::floatImage() const
+{
+    return reinterpret_cast<const float *>(m_ImageBuffer);
+}
+
+const FITSImage::Statistic &FloatConversionSolver::statistics() const
+{
+    return m_Statistics;
+}
+
+TestFloatConversion::TestFloatConversion()
+{
+    bool passed = true;
+    for(int d = 1; d <= 2; d++)
+    {
+        passed = checkMono(FITSImage::AVERAGE_RGB, d) && passed;
+        passed = checkMono(FITSImage::INTEGRATED_RGB, d) && passed;
+        passed = checkMono(FITSImage::GREEN, d) && passed;
+    }
+    passed = checkAverageRGB() && passed;
+    if(passed)
+        printf("The float images keep the pixel values.\n");
+    fflush( stdout );
+    exit(passed ? 0 : 1);
+}
+
+bool TestFloatConversion::checkMono(int colorChannel, int d)
+{
+    const int width = 64, height = 48;
+    FITSImage::Statistic stats = makeStats(width, height, 1);
+    std::vector<unsigned short> image(width * height);
+    for(int i = 0; i < width * height; i++)
+        image[i] = static_cast<unsigned short>((i * 37) % 60000);
+
+    FloatConversionSolver solver(stats, reinterpret_cast<const uint8_t *>(image.data()));
+    solver.m_ColorChannel = colorChannel;
+    if(!solver.convert(d))
+    {
+        printf("Converting the mono image with color channel %d and downsample %d failed\n", colorChannel, d);
+        return false;
+    }
+
+    const FITSImage::Statistic &newStats = solver.statistics();
+    const float *floatImage = solver.floatImage();
+    for(int y = 0; y < newStats.height; y++)
+    {
+        for(int x = 0; x < newStats.width; x++)
+        {
+            double expected = 0;
+            for(int y2 = 0; y2 < d; y2++)
+                for(int x2 = 0; x2 < d; x2++)
+                    expected += image[(y * d + y2) * width + x * d + x2];
+            expected /= d * d;
+            if(fabs(floatImage[y * newStats.width + x] - expected) > 1e-3 * expected + 1e-3)
+            {
+                printf("The mono pixel (%d, %d) with color channel %d and downsample %d is %f instead of %f\n", x, y,
+                       colorChannel, d, floatImage[y * newStats.width + x], expected);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool TestFloatConversion::checkAverageRGB()
+{
+    const int width = 32, height = 24, samples = width * height;
+    FITSImage::Statistic stats = makeStats(width, height, 3);
+    std::vector<unsigned short> image(samples * 3);
+    for(int i = 0; i < samples; i++)
+    {
+        image[i] = static_cast<unsigned short>(i % 1000);
+        image[i + samples] = static_cast<unsigned short>(2 * (i % 1000));
+        image[i + 2 * samples] = static_cast<unsigned short>(3 * (i % 1000));
+    }
+
+    FloatConversionSolver solver(stats, reinterpret_cast<const uint8_t *>(image.data()));
+    solver.m_ColorChannel = FITSImage::AVERAGE_RGB;
+    if(!solver.convert(1))
+    {
+        printf("Merging the RGB image failed\n");
+        return false;
+    }
+    const float *floatImage = solver.floatImage();
+    for(int i = 0; i < samples; i++)
+    {
+        const double expected = 2.0 * (i % 1000);
+        if(fabs(floatImage[i] - expected) > 1e-3)
+        {
+            printf("The averaged RGB pixel %d is %f instead of %f\n", i, floatImage[i], expected);
+            return false;
+        }
+    }
+    return true;
+}
+
+FITSImage::Statistic TestFloatConversion::makeStats(int width, int height, int channels)
+{
+    FITSImage::Statistic stats;
+    stats.dataType = TUSHORT;
+    stats.bytesPerPixel = sizeof(unsigned short);
+    stats.width = width;
+    stats.height = height;
+    stats.channels = channels;
+    stats.ndim = channels == 1 ? 2 : 3;
+    stats.samples_per_channel = width * height;
+    return stats;
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    TestFloatConversion *test = new TestFloatConversion();
+    app.exec();
+
+    delete test;
+
+    return 0;
+}
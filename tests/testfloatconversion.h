@@ -0,0 +1,38 @@
+#ifndef TESTFLOATCONVERSION_H
+#define TESTFLOATCONVERSION_H
+
+//Qt Includes
+#include <QApplication>
+#include <QObject>
+
+#include <stdio.h>
+#include <vector>
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "internalextractorsolver.h"
+#include "fitsio.h"
+
+// This lets the test convert an image to floats the way the star extraction does
+class FloatConversionSolver : public InternalExtractorSolver
+{
+public:
+    FloatConversionSolver(const FITSImage::Statistic &stats, const uint8_t *imageBuffer);
+    bool convert(int d);
+    const float *floatImage() const;
+    const FITSImage::Statistic &statistics() const;
+};
+
+// This checks that converting a mono image to floats for SEP keeps its pixel values, whatever the color
+// channel setting, and that only the merge of the RGB channels averages them.
+class TestFloatConversion : public QObject
+{
+    Q_OBJECT
+public:
+    TestFloatConversion();
+    bool checkMono(int colorChannel, int d);
+    bool checkAverageRGB();
+    static FITSImage::Statistic makeStats(int width, int height, int channels);
+};
+
+#endif // TESTFLOATCONVERSION_H
@@ -0,0 +1,161 @@
+#include "testindexfiles.h"
+
+#include <algorithm>
+#include <vector>
+
+extern "C" {
+#include "astrometry/index.h"
+#include "astrometry/kdtree.h"
+}
+
+TestIndexFiles::TestIndexFiles()
+{
+    bool passed = runChecks();
+    if(passed)
+        printf("Each index is listed once and its native index searches the same.\n");
+    fflush( stdout );
+    exit(passed ? 0 : 1);
+}
+
+bool TestIndexFiles::runChecks()
+{
+    // The folder is removed when this returns
+    QTemporaryDir folder;
+    if(!folder.isValid() || !createFile(folder.filePath("index-4107.fits")) || !createFile(folder.filePath("index-4107.ssidx"))
+            || !createFile(folder.filePath("index-4108-03.fit")) || !createFile(folder.filePath("index-4108-03.ssidx"))
+            || !createFile(folder.filePath("index-4109.fits")))
+    {
+        printf("Error in creating the index folder\n");
+        return false;
+    }
+
+    const QStringList folders = QStringList() << folder.path();
+    bool passed = true;
+    passed = checkIndexFiles(folders, -1, -1, QStringList() << "index-4107.ssidx" << "index-4108-03.ssidx" << "index-4109.fits") && passed;
+    passed = checkIndexFiles(folders, 4107, -1, QStringList() << "index-4107.ssidx") && passed;
+    passed = checkIndexFiles(folders, 4108, 3, QStringList() << "index-4108-03.ssidx") && passed;
+    passed = checkIndexFiles(folders, 4109, -1, QStringList() << "index-4109.fits") && passed;
+    passed = checkSelectedIndexes("astrometry/index-4107.fits") && passed;
+    passed = checkNativeIndex("astrometry/index-4107.fits") && passed;
+    return passed;
+}
+
+// The solver picks its indexes from the folder itself, so a .fit index with a native index next to it is searched once.
+bool TestIndexFiles::checkSelectedIndexes(const QString &indexFile)
+{
+    QTemporaryDir folder;
+    const QString fitsIndex = folder.filePath("index-4107.fit");
+    const QString nativeIndex = folder.filePath("index-4107.ssidx");
+    if(!folder.isValid() || !QFile::copy(indexFile, fitsIndex) || !StellarSolver::convertIndexFile(fitsIndex, nativeIndex))
+    {
+        printf("Error in converting the index file %s\n", indexFile.toUtf8().data());
+        return false;
+    }
+
+    const QStringList selected = InternalExtractorSolver::selectIndexFiles(QStringList() << folder.path(), QStringList(),
+                                 0.1, 1e6, false, 0, 0, 0);
+    if(selected != QStringList() << nativeIndex)
+    {
+        printf("The solver selected %s instead of %s\n", selected.join(", ").toUtf8().data(), nativeIndex.toUtf8().data());
+        return false;
+    }
+    return true;
+}
+
+// Searches both trees around every 50th of their points, and expects the same points back from each index.
+static bool searchesAgree(const char *treeName, const kdtree_t *fitsTree, const kdtree_t *nativeTree, double maxd2)
+{
+    if(fitsTree->ndata != nativeTree->ndata || fitsTree->ndim != nativeTree->ndim)
+    {
+        printf("The native %s tree holds %d points of %d dimensions instead of %d of %d\n", treeName,
+               nativeTree->ndata, nativeTree->ndim, fitsTree->ndata, fitsTree->ndim);
+        return false;
+    }
+
+    std::vector<double> point(fitsTree->ndim);
+    const int step = std::max(1, fitsTree->ndata / 50);
+    for(int i = 0; i < fitsTree->ndata; i += step)
+    {
+        kdtree_copy_data_double(fitsTree, i, 1, point.data());
+        kdtree_qres_t* fitsResult = kdtree_rangesearch(fitsTree, point.data(), maxd2);
+        kdtree_qres_t* nativeResult = kdtree_rangesearch(nativeTree, point.data(), maxd2);
+        std::vector<unsigned int> fitsFound, nativeFound;
+        if(fitsResult)
+            fitsFound.assign(fitsResult->inds, fitsResult->inds + fitsResult->nres);
+        if(nativeResult)
+            nativeFound.assign(nativeResult->inds, nativeResult->inds + nativeResult->nres);
+        kdtree_free_query(fitsResult);
+        kdtree_free_query(nativeResult);
+        std::sort(fitsFound.begin(), fitsFound.end());
+        std::sort(nativeFound.begin(), nativeFound.end());
+        if(fitsFound.empty() || fitsFound != nativeFound)
+        {
+            printf("Searching the %s trees around point %d found %d points in the FITS index and %d in the native index\n",
+                   treeName, i, (int)fitsFound.size(), (int)nativeFound.size());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TestIndexFiles::checkNativeIndex(const QString &indexFile)
+{
+    QTemporaryDir folder;
+    const QString nativeIndex = folder.filePath("index-4107.ssidx");
+    if(!folder.isValid() || !StellarSolver::convertIndexFile(indexFile, nativeIndex))
+    {
+        printf("Error in converting the index file %s\n", indexFile.toUtf8().data());
+        return false;
+    }
+
+    index_t* fitsIndex = index_load(indexFile.toUtf8().constData(), 0, NULL);
+    index_t* loadedIndex = index_load(nativeIndex.toUtf8().constData(), 0, NULL);
+    bool passed = fitsIndex && loadedIndex;
+    if(!passed)
+        printf("Error in loading the index %s\n", (fitsIndex ? nativeIndex : indexFile).toUtf8().data());
+    else
+    {
+        passed = searchesAgree("code", fitsIndex->codekd->tree, loadedIndex->codekd->tree, 1e-3);
+        passed = searchesAgree("star", fitsIndex->starkd->tree, loadedIndex->starkd->tree, 1e-5) && passed;
+    }
+    if(fitsIndex)
+        index_free(fitsIndex);
+    if(loadedIndex)
+        index_free(loadedIndex);
+    return passed;
+}
+
+bool TestIndexFiles::checkIndexFiles(const QStringList &folders, int indexToUse, int healpixToUse, const QStringList &expected)
+{
+    QStringList found;
+    foreach(const QString &indexFile, StellarSolver::getIndexFiles(folders, indexToUse, healpixToUse))
+        found << QFileInfo(indexFile).fileName();
+    found.sort();
+    if(found != expected)
+    {
+        printf("Index %d, healpix %d: found %s instead of %s\n", indexToUse, healpixToUse,
+               found.join(", ").toUtf8().data(), expected.join(", ").toUtf8().data());
+        return false;
+    }
+    return true;
+}
+
+bool TestIndexFiles::createFile(const QString &path)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly);
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    TestIndexFiles *test = new TestIndexFiles();
+    app.exec();
+
+    delete test;
+
+    return 0;
+}
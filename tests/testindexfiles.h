@@ -0,0 +1,29 @@
+#ifndef TESTINDEXFILES_H
+#define TESTINDEXFILES_H
+
+//Qt Includes
+#include <QApplication>
+#include <QObject>
+#include <QTemporaryDir>
+
+#include <stdio.h>
+
+//Includes for this project
+#include "stellarsolver.h"
+#include "internalextractorsolver.h"
+
+// This checks that an index folder holding a FITS index and the native index converted from it
+// lists that index once, through the native file, and that the native index searches the same way.
+class TestIndexFiles : public QObject
+{
+    Q_OBJECT
+public:
+    TestIndexFiles();
+    bool runChecks();
+    bool checkIndexFiles(const QStringList &folders, int indexToUse, int healpixToUse, const QStringList &expected);
+    bool checkSelectedIndexes(const QString &indexFile);
+    bool checkNativeIndex(const QString &indexFile);
+    static bool createFile(const QString &path);
+};
+
+#endif // TESTINDEXFILES_H
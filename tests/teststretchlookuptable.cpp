@@ -0,0 +1,116 @@
+#include "teststretchlookuptable.h"
+
+#include <random>
+
+TestStretchLookupTable::TestStretchLookupTable()
+{
+    bool passed = true;
+    for(int sampling = 1; sampling <= 2; sampling++)
+    {
+        passed = compareWithFormula(1999, 1333, 1, sampling) && passed;
+        passed = compareWithFormula(1999, 1333, 3, sampling) && passed;
+    }
+    if(passed)
+        printf("Lookup table stretches are identical to the formula.\n");
+    fflush( stdout );
+
+    // 9520 x 6320 is about 60 megapixels
+    timeStretch(9520, 6320, 1, TUSHORT, 1);
+    timeStretch(9520, 6320, 1, TUSHORT, 2);
+    timeStretch(9520, 6320, 1, TFLOAT, 1);
+    timeStretch(9520, 6320, 3, TUSHORT, 2);
+    exit(passed ? 0 : 1);
+}
+
+// TLONG samples don't go through the lookup table, so they are stretched with the formula.
+bool TestStretchLookupTable::compareWithFormula(int width, int height, int channels, int sampling)
+{
+    std::vector<unsigned short> sky = makeSky(width, height, channels);
+    std::vector<long> wideSky(sky.begin(), sky.end());
+
+    Stretch stretch(width, height, channels, TUSHORT);
+    stretch.setParams(stretch.computeParams(reinterpret_cast<uint8_t *>(sky.data())));
+    QImage image = makeImage(width, height, channels, sampling);
+    stretch.run(reinterpret_cast<uint8_t *>(sky.data()), &image, sampling);
+
+    Stretch formulaStretch(width, height, channels, TLONG);
+    formulaStretch.setParams(stretch.getParams());
+    QImage formulaImage = makeImage(width, height, channels, sampling);
+    formulaStretch.run(reinterpret_cast<uint8_t *>(wideSky.data()), &formulaImage, sampling);
+
+    if(image != formulaImage)
+    {
+        printf("%d channel stretch with sampling %d differs from the formula\n", channels, sampling);
+        return false;
+    }
+    return true;
+}
+
+void TestStretchLookupTable::timeStretch(int width, int height, int channels, int dataType, int sampling)
+{
+    std::vector<unsigned short> sky = makeSky(width, height, channels);
+    std::vector<float> floatSky;
+    uint8_t *buffer = reinterpret_cast<uint8_t *>(sky.data());
+    if(dataType == TFLOAT)
+    {
+        floatSky.assign(sky.begin(), sky.end());
+        buffer = reinterpret_cast<uint8_t *>(floatSky.data());
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    Stretch stretch(width, height, channels, dataType);
+    stretch.setParams(stretch.computeParams(buffer));
+    const qint64 paramsTime = timer.elapsed();
+
+    QImage image = makeImage(width, height, channels, sampling);
+    timer.restart();
+    stretch.run(buffer, &image, sampling);
+    printf("%d x %d %s, %d channel(s), sampling %d: parameters %lld ms, stretch %lld ms\n", width, height,
+           dataType == TFLOAT ? "float" : "16 bit", channels, sampling, paramsTime, timer.elapsed());
+    fflush( stdout );
+}
+
+std::vector<unsigned short> TestStretchLookupTable::makeSky(int width, int height, int channels)
+{
+    // A noisy background with a few saturated pixels, so the stretch has shadows and highlights to clip
+    std::mt19937 generator(1);
+    std::normal_distribution<float> noise(1200, 40);
+    std::uniform_int_distribution<int> stars(0, 999);
+    std::vector<unsigned short> sky(static_cast<size_t>(width) * height * channels);
+    for(auto &sample : sky)
+        sample = stars(generator) == 0 ? 65535 : static_cast<unsigned short>(std::max(0.0f, noise(generator)));
+    return sky;
+}
+
+QImage TestStretchLookupTable::makeImage(int width, int height, int channels, int sampling)
+{
+    const int w = (width + sampling - 1) / sampling;
+    const int h = (height + sampling - 1) / sampling;
+    if(channels == 1)
+    {
+        QImage image(w, h, QImage::Format_Indexed8);
+        image.setColorCount(256);
+        for (int i = 0; i < 256; i++)
+            image.setColor(i, qRgb(i, i, i));
+        image.fill(0);
+        return image;
+    }
+    QImage image(w, h, QImage::Format_RGB32);
+    image.fill(0);
+    return image;
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    TestStretchLookupTable *test = new TestStretchLookupTable();
+    app.exec();
+
+    delete test;
+
+    return 0;
+}
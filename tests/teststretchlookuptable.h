@@ -0,0 +1,30 @@
+#ifndef TESTSTRETCHLOOKUPTABLE_H
+#define TESTSTRETCHLOOKUPTABLE_H
+
+//Qt Includes
+#include <QApplication>
+#include <QObject>
+#include <QImage>
+#include <QElapsedTimer>
+
+#include <stdio.h>
+#include <vector>
+
+//Includes for this project
+#include "ssolverutils/stretch.h"
+#include "fitsio.h"
+
+// This checks that 16 bit images stretched with the lookup table come out identical to the
+// same values stretched sample by sample, and times the stretch of a 60 megapixel preview.
+class TestStretchLookupTable : public QObject
+{
+    Q_OBJECT
+public:
+    TestStretchLookupTable();
+    bool compareWithFormula(int width, int height, int channels, int sampling);
+    void timeStretch(int width, int height, int channels, int dataType, int sampling);
+    static std::vector<unsigned short> makeSky(int width, int height, int channels);
+    static QImage makeImage(int width, int height, int channels, int sampling);
+};
+
+#endif // TESTSTRETCHLOOKUPTABLE_H
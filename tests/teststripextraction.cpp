@@ -0,0 +1,117 @@
+#include "teststripextraction.h"
+
+TestStripExtraction::TestStripExtraction()
+{
+    fileio imageLoader;
+    if(!imageLoader.loadImage("randomsky.fits"))
+    {
+        printf("Error in loading file");
+        exit(1);
+    }
+    FITSImage::Statistic stats = imageLoader.getStats();
+    const uint8_t *imageBuffer = imageLoader.getImageBuffer();
+
+    StellarSolver stellarSolver(stats, imageBuffer, nullptr);
+    stellarSolver.setParameterProfile(SSolver::Parameters::ALL_STARS);
+    if(!stellarSolver.extract())
+    {
+        printf("The extraction of the whole image failed\n");
+        exit(1);
+    }
+    QList<FITSImage::Star> reference = stellarSolver.getStarList();
+    printf("%d stars in the whole image\n", static_cast<int>(reference.count()));
+
+    bool passed = true;
+    for(int stripRows : {1, 16, 100, 1024})
+        passed = runStripExtraction(stats, imageBuffer, reference, stripRows) && passed;
+    if(passed)
+        printf("The stars of the strips match the whole image.\n");
+    fflush( stdout );
+    delete[] imageBuffer;
+    exit(passed ? 0 : 1);
+}
+
+bool TestStripExtraction::runStripExtraction(const FITSImage::Statistic &stats, const uint8_t *imageBuffer,
+        const QList<FITSImage::Star> &reference, int stripRows)
+{
+    StellarSolver stellarSolver;
+    stellarSolver.setParameterProfile(SSolver::Parameters::ALL_STARS);
+    if(!stellarSolver.startStripExtraction(stats))
+    {
+        printf("%d row strips: the strip extraction did not start\n", stripRows);
+        return false;
+    }
+    QList<FITSImage::Star> stars;
+    const int rowSize = stats.width * stats.bytesPerPixel;
+    for(int row = 0; row < stats.height; row += stripRows)
+    {
+        const int rows = qMin(stripRows, stats.height - row);
+        const QList<FITSImage::Star> stripStars = stellarSolver.addImageStrip(imageBuffer + static_cast<size_t>(row) * rowSize, rows);
+        for(const auto &oneStar : stripStars)
+        {
+            // A star comes out once the rows of its margin and a batch of new rows are in, about 120 rows at most
+            if(oneStar.y < row + rows - maxDelayRows - stripRows)
+            {
+                printf("%d row strips: star at row %.1f returned only after row %d\n", stripRows, oneStar.y, row + rows);
+                return false;
+            }
+        }
+        stars.append(stripStars);
+    }
+    stars.append(stellarSolver.finishStripExtraction());
+
+    if(stars.count() != stellarSolver.getStarList().count())
+    {
+        printf("%d row strips: %d stars returned, but %d in the star list\n", stripRows, static_cast<int>(stars.count()),
+               static_cast<int>(stellarSolver.getStarList().count()));
+        return false;
+    }
+
+    // Every star is returned once, and the background of each window differs a little from the one of the whole image,
+    // so nearly all the stars of each list are found in the other at the same position
+    int matched = 0;
+    for(const auto &oneStar : stars)
+    {
+        if(countMatches(stars, oneStar, maxDistance) > 1)
+        {
+            printf("%d row strips: star at %.1f, %.1f was returned twice\n", stripRows, oneStar.x, oneStar.y);
+            return false;
+        }
+        if(countMatches(reference, oneStar, maxDistance) == 1)
+            matched++;
+    }
+    int found = 0;
+    for(const auto &oneStar : reference)
+    {
+        if(countMatches(stars, oneStar, maxDistance) == 1)
+            found++;
+    }
+    printf("%d row strips: %d stars, %d of them in the whole image, and %d of its %d stars found\n", stripRows,
+           static_cast<int>(stars.count()), matched, found, static_cast<int>(reference.count()));
+    return matched >= stars.count() * 0.95 && found >= reference.count() * 0.95;
+}
+
+int TestStripExtraction::countMatches(const QList<FITSImage::Star> &stars, const FITSImage::Star &star, float distance)
+{
+    int matches = 0;
+    for(const auto &oneStar : stars)
+    {
+        if(qAbs(oneStar.x - star.x) < distance && qAbs(oneStar.y - star.y) < distance)
+            matches++;
+    }
+    return matches;
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    TestStripExtraction *test = new TestStripExtraction();
+    app.exec();
+
+    delete test;
+
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef TESTSTRIPEXTRACTION_H
+#define TESTSTRIPEXTRACTION_H
+
+//Qt Includes
+#include <QApplication>
+#include <QObject>
+
+#include <stdio.h>
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "stellarsolver.h"
+#include "ssolverutils/fileio.h"
+
+// This feeds an image to the strip extraction a few rows at a time and checks that the stars it returns
+// match the stars of a star extraction on the whole image within half a pixel, once each and soon after their rows.
+class TestStripExtraction : public QObject
+{
+    Q_OBJECT
+public:
+    TestStripExtraction();
+    bool runStripExtraction(const FITSImage::Statistic &stats, const uint8_t *imageBuffer,
+                            const QList<FITSImage::Star> &reference, int stripRows);
+    static int countMatches(const QList<FITSImage::Star> &stars, const FITSImage::Star &star, float distance);
+
+    // The largest delay in rows between a star and the strip that returns it, not counting the strip itself
+    static constexpr int maxDelayRows = 120;
+    // The largest distance in pixels between a star of the strips and the same star in the whole image
+    static constexpr float maxDistance = 0.5f;
+};
+
+#endif // TESTSTRIPEXTRACTION_H